@@ -11,6 +11,12 @@
 /* Define is no secure id variant is available */
 /* #undef _EVENT_DNS_USE_GETTIMEOFDAY_FOR_ID */
 
+/* Define to 1 to lay out struct event with the fields used by dispatch
+   first; this changes the ABI, see event_get_abi_version().  Off by
+   default, a build that wants it defines it here or with -D for the
+   library and every program that uses it */
+/* #undef _EVENT_COMPACT_EVENT */
+
 /* Define to 1 if you have the `clock_gettime' function. */
 #define _EVENT_HAVE_CLOCK_GETTIME 1
 
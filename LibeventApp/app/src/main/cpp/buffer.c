@@ -44,6 +44,7 @@
 #ifdef HAVE_SYS_TIME_H
 #include <sys/time.h>
 #endif
+#include <sys/queue.h>
 
 #ifdef HAVE_SYS_IOCTL_H
 #include <sys/ioctl.h>
@@ -51,6 +52,7 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -64,14 +66,16 @@
 #include "event.h"
 #include "config.h"
 #include "evutil.h"
+#include "event-internal.h"
 #include "./log.h"
+#include "mm-internal.h"
 
 struct evbuffer *
 evbuffer_new(void)
 {
 	struct evbuffer *buffer;
 	
-	buffer = calloc(1, sizeof(struct evbuffer));
+	buffer = mm_calloc(1, sizeof(struct evbuffer), EVENT_MEM_BUFFER);
 
 	return (buffer);
 }
@@ -79,9 +83,23 @@ evbuffer_new(void)
 void
 evbuffer_free(struct evbuffer *buffer)
 {
+	if (buffer->cb_base != NULL)
+		event_deferred_evbuffer_cancel(buffer->cb_base, buffer);
 	if (buffer->orig_buffer != NULL)
-		free(buffer->orig_buffer);
-	free(buffer);
+		mm_free(buffer->orig_buffer, EVENT_MEM_BUFFER);
+	mm_free(buffer, EVENT_MEM_BUFFER);
+}
+
+/* Tells the callback of buf that its length changed from oldoff */
+static void
+evbuffer_invoke_cb(struct evbuffer *buf, size_t oldoff)
+{
+	if (buf->cb == NULL)
+		return;
+	if (buf->cb_base != NULL)
+		event_deferred_evbuffer(buf->cb_base, buf, oldoff);
+	else
+		(*buf->cb)(buf, oldoff, buf->off, buf->cbarg);
 }
 
 /* 
@@ -117,10 +135,10 @@ evbuffer_add_buffer(struct evbuffer *outbuf, struct evbuffer *inbuf)
 		 * buffer if necessary of the changes. oldoff is the amount
 		 * of data that we transfered from inbuf to outbuf
 		 */
-		if (inbuf->off != oldoff && inbuf->cb != NULL)
-			(*inbuf->cb)(inbuf, oldoff, inbuf->off, inbuf->cbarg);
-		if (oldoff && outbuf->cb != NULL)
-			(*outbuf->cb)(outbuf, 0, oldoff, outbuf->cbarg);
+		if (inbuf->off != oldoff)
+			evbuffer_invoke_cb(inbuf, oldoff);
+		if (oldoff)
+			evbuffer_invoke_cb(outbuf, 0);
 		
 		return (0);
 	}
@@ -165,8 +183,7 @@ evbuffer_add_vprintf(struct evbuffer *buf, const char *fmt, va_list ap)
 			return (-1);
 		if ((size_t)sz < space) {
 			buf->off += sz;
-			if (buf->cb != NULL)
-				(*buf->cb)(buf, oldoff, buf->off, buf->cbarg);
+			evbuffer_invoke_cb(buf, oldoff);
 			return (sz);
 		}
 		if (evbuffer_expand(buf, sz + 1) == -1)
@@ -204,13 +221,20 @@ evbuffer_remove(struct evbuffer *buf, void *data, size_t datlen)
 	return (nread);
 }
 
+static void *
+evbuffer_libc_malloc(size_t sz, int tag)
+{
+	return (malloc(sz));
+}
+
 /*
  * Reads a line terminated by either '\r\n', '\n\r' or '\r' or '\n'.
- * The returned buffer needs to be freed by the called.
+ * The line is allocated with alloc and tag.
  */
 
-char *
-evbuffer_readline(struct evbuffer *buffer)
+static char *
+evbuffer_readline_alloc(struct evbuffer *buffer,
+    void *(*alloc)(size_t, int), int tag)
 {
 	u_char *data = EVBUFFER_DATA(buffer);
 	size_t len = EVBUFFER_LENGTH(buffer);
@@ -225,7 +249,7 @@ evbuffer_readline(struct evbuffer *buffer)
 	if (i == len)
 		return (NULL);
 
-	if ((line = malloc(i + 1)) == NULL) {
+	if ((line = alloc(i + 1, tag)) == NULL) {
 		fprintf(stderr, "%s: out of memory\n", __func__);
 		return (NULL);
 	}
@@ -250,6 +274,20 @@ evbuffer_readline(struct evbuffer *buffer)
 	return (line);
 }
 
+/* The returned buffer needs to be freed by the caller with free() */
+char *
+evbuffer_readline(struct evbuffer *buffer)
+{
+	return (evbuffer_readline_alloc(buffer, evbuffer_libc_malloc, 0));
+}
+
+/* The line comes from mm_malloc() instead, for the library itself */
+char *
+evbuffer_readline_mm(struct evbuffer *buffer, int tag)
+{
+	return (evbuffer_readline_alloc(buffer, event_mm_malloc_, tag));
+}
+
 
 char *
 evbuffer_readln(struct evbuffer *buffer, size_t *n_read_out,
@@ -390,7 +428,8 @@ evbuffer_expand(struct evbuffer *buf, size_t datlen)
 
 		if (buf->orig_buffer != buf->buffer)
 			evbuffer_align(buf);
-		if ((newbuf = realloc(buf->buffer, length)) == NULL)
+		if ((newbuf = mm_realloc(buf->buffer, length,
+		    EVENT_MEM_BUFFER)) == NULL)
 			return (-1);
 
 		buf->orig_buffer = buf->buffer = newbuf;
@@ -414,8 +453,8 @@ evbuffer_add(struct evbuffer *buf, const void *data, size_t datlen)
 	memcpy(buf->buffer + buf->off, data, datlen);
 	buf->off += datlen;
 
-	if (datlen && buf->cb != NULL)
-		(*buf->cb)(buf, oldoff, buf->off, buf->cbarg);
+	if (datlen)
+		evbuffer_invoke_cb(buf, oldoff);
 
 	return (0);
 }
@@ -439,9 +478,8 @@ evbuffer_drain(struct evbuffer *buf, size_t len)
 
  done:
 	/* Tell someone about changes in this buffer */
-	if (buf->off != oldoff && buf->cb != NULL)
-		(*buf->cb)(buf, oldoff, buf->off, buf->cbarg);
-
+	if (buf->off != oldoff)
+		evbuffer_invoke_cb(buf, oldoff);
 }
 
 /*
@@ -502,8 +540,8 @@ evbuffer_read(struct evbuffer *buf, int fd, int howmuch)
 	buf->off += n;
 
 	/* Tell someone about changes in this buffer */
-	if (buf->off != oldoff && buf->cb != NULL)
-		(*buf->cb)(buf, oldoff, buf->off, buf->cbarg);
+	if (buf->off != oldoff)
+		evbuffer_invoke_cb(buf, oldoff);
 
 	return (n);
 }
@@ -549,6 +587,17 @@ void evbuffer_setcb(struct evbuffer *buffer,
     void (*cb)(struct evbuffer *, size_t, size_t, void *),
     void *cbarg)
 {
+	/* a queued callback is for the old one */
+	if (buffer->cb_base != NULL)
+		event_deferred_evbuffer_cancel(buffer->cb_base, buffer);
 	buffer->cb = cb;
 	buffer->cbarg = cbarg;
 }
+
+void
+evbuffer_defer_callbacks(struct evbuffer *buffer, struct event_base *base)
+{
+	if (buffer->cb_base != NULL)
+		event_deferred_evbuffer_cancel(buffer->cb_base, buffer);
+	buffer->cb_base = base;
+}
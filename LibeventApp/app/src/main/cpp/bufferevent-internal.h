@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2026 The LibeventApp authors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _BUFFEREVENT_INTERNAL_H_
+#define _BUFFEREVENT_INTERNAL_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int bufferevent_add(struct event *ev, int timeout);
+void bufferevent_read_pressure_cb(struct evbuffer *, size_t, size_t, void *);
+
+#ifdef HAVE_IO_URING
+/*
+ * Bufferevents created with bufferevent_uring_new() are told apart by the
+ * callback of their read event; evbuffer.c hands them over to the
+ * functions below.
+ */
+void bufferevent_uring_readcb(int fd, short event, void *arg);
+#define BEV_IS_URING(bufev) \
+	((bufev)->ev_read.ev_callback == bufferevent_uring_readcb)
+
+int bufferevent_uring_enable(struct bufferevent *bufev, short event);
+int bufferevent_uring_disable(struct bufferevent *bufev, short event);
+void bufferevent_uring_start_write(struct bufferevent *bufev);
+void bufferevent_uring_start_read(struct bufferevent *bufev);
+void bufferevent_uring_settimeout(struct bufferevent *bufev);
+void bufferevent_uring_setfd(struct bufferevent *bufev, int fd);
+void bufferevent_uring_free(struct bufferevent *bufev);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _BUFFEREVENT_INTERNAL_H_ */
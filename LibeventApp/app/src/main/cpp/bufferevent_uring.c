@@ -0,0 +1,510 @@
+/*
+ * Copyright (c) 2026 The LibeventApp authors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+#include <sys/queue.h>
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "event.h"
+
+#ifdef HAVE_IO_URING
+
+#include "event-internal.h"
+#include "bufferevent-internal.h"
+#include "iouring-internal.h"
+#include "mm-internal.h"
+
+/*
+ * A bufferevent that does its I/O with io_uring requests instead of
+ * waiting for readiness and then calling read() or write().
+ *
+ * While reading is enabled a receive request is kept in the kernel.  It
+ * completes into one of the provided buffers of the base, which is copied
+ * to the input buffer and handed back right away.  Writing copies the
+ * head of the output buffer to a private buffer that stays untouched while
+ * the send request is in flight; the output buffer is drained as the send
+ * completes, just like bufferevent_writecb() does it.
+ *
+ * Completions arrive within the dispatch of the loop; they only update
+ * the buffers and activate ev_read or ev_write, whose callbacks then call
+ * the user like the readiness-based bufferevent does.  The two events
+ * watch no fd and otherwise only carry the read and write timeouts.
+ */
+
+struct bufferevent_uring {
+	struct bufferevent bev;
+
+	struct uringop *uringop;
+	int fd;
+
+	struct evuring_req recv_req;
+	struct evuring_req send_req;
+	struct evbuffer *sending;	/* copy of the head of output in flight */
+
+	size_t nread;		/* bytes received since the last readcb */
+	short read_what;	/* how reading stopped, 0 while it is fine */
+	short write_what;	/* how writing stopped, 0 while it is fine */
+	short read_report;	/* read_what still has to go to errorcb */
+	short write_report;	/* write_what still has to go to errorcb */
+	int dead;		/* freed while requests were in flight */
+	unsigned gen;		/* bumped when setfd replaces the fd */
+	unsigned recv_gen;	/* gen that the receive in flight began in */
+	unsigned send_gen;	/* gen that the send in flight began in */
+};
+
+/* most bytes of the output buffer that one send request carries */
+#define BEV_URING_SEND_MAX	65536
+
+static void bufferevent_uring_writecb(int, short, void *);
+static void bufferevent_uring_recv_done(struct evuring_req *, int, unsigned);
+static void bufferevent_uring_send_done(struct evuring_req *, int, unsigned);
+
+static int
+bufferevent_uring_read(struct bufferevent_uring *bu)
+{
+	struct bufferevent *bufev = &bu->bev;
+
+	if (bu->dead || bu->recv_req.inflight || bu->read_what != 0 ||
+	    !(bufev->enabled & EV_READ))
+		return (0);
+
+	/* back pressure; bufferevent_read_pressure_cb() starts us again */
+	if (bufev->wm_read.high != 0 &&
+	    EVBUFFER_LENGTH(bufev->input) >= bufev->wm_read.high) {
+		evbuffer_setcb(bufev->input,
+		    bufferevent_read_pressure_cb, bufev);
+		return (0);
+	}
+
+	if (evuring_recv(bu->uringop, &bu->recv_req, bu->fd) == -1)
+		return (-1);
+	bu->recv_gen = bu->gen;
+	bufferevent_add(&bufev->ev_read, bufev->timeout_read);
+	return (0);
+}
+
+static int
+bufferevent_uring_write(struct bufferevent_uring *bu)
+{
+	struct bufferevent *bufev = &bu->bev;
+	size_t len;
+
+	if (bu->dead || bu->send_req.inflight || bu->write_what != 0 ||
+	    !(bufev->enabled & EV_WRITE))
+		return (0);
+
+	if (EVBUFFER_LENGTH(bu->sending) == 0) {
+		len = EVBUFFER_LENGTH(bufev->output);
+		if (len == 0)
+			return (0);
+		if (len > BEV_URING_SEND_MAX)
+			len = BEV_URING_SEND_MAX;
+		if (evbuffer_add(bu->sending,
+			EVBUFFER_DATA(bufev->output), len) == -1)
+			return (-1);
+	}
+
+	if (evuring_send(bu->uringop, &bu->send_req, bu->fd,
+		EVBUFFER_DATA(bu->sending), EVBUFFER_LENGTH(bu->sending)) == -1)
+		return (-1);
+	bu->send_gen = bu->gen;
+	bufferevent_add(&bufev->ev_write, bufev->timeout_write);
+	return (0);
+}
+
+/* Frees a bufferevent that was freed by the user once the kernel is done */
+static int
+bufferevent_uring_reap(struct bufferevent_uring *bu)
+{
+	if (!bu->dead)
+		return (0);
+	if (!bu->recv_req.inflight && !bu->send_req.inflight) {
+		evbuffer_free(bu->sending);
+		mm_free(bu, EVENT_MEM_BUFFER);
+	}
+	return (1);
+}
+
+static void
+bufferevent_uring_recv_done(struct evuring_req *req, int res, unsigned flags)
+{
+	struct bufferevent_uring *bu = req->arg;
+	struct bufferevent *bufev = &bu->bev;
+	const void *data;
+	short what = 0;
+
+	/* whatever happened on the fd before setfd does not concern us */
+	if (bu->recv_gen != bu->gen)
+		res = -ECANCELED;
+
+	if (res > 0 && !bu->dead) {
+		data = evuring_buffer(bu->uringop, flags);
+		if (data == NULL || evbuffer_add(bufev->input, data, res) == -1)
+			res = -ENOMEM;
+	}
+	evuring_buffer_release(bu->uringop, flags);
+
+	if (bufferevent_uring_reap(bu) || (flags & EVURING_F_GONE))
+		return;
+
+	/* handed out by bufferevent_uring_enable() if reading stopped */
+	if (res > 0)
+		bu->nread += res;
+
+	if (bu->read_what != 0)
+		return;		/* stopped already, e.g. by a timeout */
+
+	if (res > 0) {
+		if (bufev->enabled & EV_READ)
+			event_active_nolock(bufev->ev_base, &bufev->ev_read,
+			    EV_READ, 1);
+	} else if (res == 0) {
+		what = EVBUFFER_READ | EVBUFFER_EOF;
+	} else if (res != -ENOBUFS && res != -EINTR && res != -EAGAIN &&
+	    res != -ECANCELED) {
+		errno = -res;
+		what = EVBUFFER_READ | EVBUFFER_ERROR;
+	}
+
+	if (what == 0 && bufferevent_uring_read(bu) == -1)
+		what = EVBUFFER_READ | EVBUFFER_ERROR;
+	if (what != 0) {
+		bu->read_what = what;
+		bu->read_report = 1;
+		event_active_nolock(bufev->ev_base, &bufev->ev_read,
+		    EV_READ, 1);
+	}
+}
+
+static void
+bufferevent_uring_send_done(struct evuring_req *req, int res, unsigned flags)
+{
+	struct bufferevent_uring *bu = req->arg;
+	struct bufferevent *bufev = &bu->bev;
+	short what = 0;
+
+	if (bufferevent_uring_reap(bu) || (flags & EVURING_F_GONE))
+		return;
+
+	if (bu->send_gen != bu->gen) {
+		/* sent on the old fd; the new one gets output from the start */
+		evbuffer_drain(bu->sending, EVBUFFER_LENGTH(bu->sending));
+		res = -ECANCELED;
+	}
+
+	if (res > 0) {
+		evbuffer_drain(bufev->output, res);
+		evbuffer_drain(bu->sending, res);
+	}
+	if (bu->write_what != 0)
+		return;		/* stopped already, e.g. by a timeout */
+
+	if (res == 0) {
+		what = EVBUFFER_WRITE | EVBUFFER_EOF;
+	} else if (res < 0 && res != -EINTR && res != -EAGAIN &&
+	    res != -ECANCELED) {
+		errno = -res;
+		what = EVBUFFER_WRITE | EVBUFFER_ERROR;
+	}
+
+	if (what == 0 && bufferevent_uring_write(bu) == -1)
+		what = EVBUFFER_WRITE | EVBUFFER_ERROR;
+
+	/* the write timeout only runs while a send is in flight */
+	if (!bu->send_req.inflight)
+		event_del(&bufev->ev_write);
+
+	if (what != 0) {
+		bu->write_what = what;
+		bu->write_report = 1;
+		event_active_nolock(bufev->ev_base, &bufev->ev_write,
+		    EV_WRITE, 1);
+	} else if (res > 0 &&
+	    EVBUFFER_LENGTH(bufev->output) <= bufev->wm_write.low)
+		event_active_nolock(bufev->ev_base, &bufev->ev_write,
+		    EV_WRITE, 1);
+}
+
+void
+bufferevent_uring_readcb(int fd, short event, void *arg)
+{
+	struct bufferevent *bufev = arg;
+	struct bufferevent_uring *bu = (struct bufferevent_uring *)bufev;
+
+	if (event == EV_TIMEOUT) {
+		bu->read_what = EVBUFFER_READ | EVBUFFER_TIMEOUT;
+		evuring_cancel(bu->uringop, &bu->recv_req);
+		(*bufev->errorcb)(bufev, bu->read_what, bufev->cbarg);
+		return;
+	}
+
+	/* running the callback deleted the timeout */
+	if (bu->recv_req.inflight)
+		bufferevent_add(&bufev->ev_read, bufev->timeout_read);
+
+	if (bu->nread > 0) {
+		bu->nread = 0;
+		/* hand out the data first, the next call reports the error */
+		if (bu->read_report)
+			event_active(&bufev->ev_read, EV_READ, 1);
+		if (EVBUFFER_LENGTH(bufev->input) >= bufev->wm_read.low &&
+		    bufev->readcb != NULL)
+			(*bufev->readcb)(bufev, bufev->cbarg);
+		return;
+	}
+
+	if (bu->read_report) {
+		bu->read_report = 0;
+		(*bufev->errorcb)(bufev, bu->read_what, bufev->cbarg);
+	}
+}
+
+static void
+bufferevent_uring_writecb(int fd, short event, void *arg)
+{
+	struct bufferevent *bufev = arg;
+	struct bufferevent_uring *bu = (struct bufferevent_uring *)bufev;
+
+	if (event == EV_TIMEOUT) {
+		bu->write_what = EVBUFFER_WRITE | EVBUFFER_TIMEOUT;
+		evuring_cancel(bu->uringop, &bu->send_req);
+		(*bufev->errorcb)(bufev, bu->write_what, bufev->cbarg);
+		return;
+	}
+
+	if (bu->send_req.inflight)
+		bufferevent_add(&bufev->ev_write, bufev->timeout_write);
+
+	if (bu->write_report) {
+		bu->write_report = 0;
+		(*bufev->errorcb)(bufev, bu->write_what, bufev->cbarg);
+		return;
+	}
+
+	if (EVBUFFER_LENGTH(bufev->output) <= bufev->wm_write.low &&
+	    bufev->writecb != NULL)
+		(*bufev->writecb)(bufev, bufev->cbarg);
+}
+
+struct bufferevent *
+bufferevent_uring_new(struct event_base *base, int fd, evbuffercb readcb,
+    evbuffercb writecb, everrorcb errorcb, void *cbarg)
+{
+	struct bufferevent_uring *bu;
+	struct bufferevent *bufev;
+	struct uringop *uringop;
+
+	if ((uringop = evuring_get(base)) == NULL ||
+	    evuring_buffers_init(uringop) == -1) {
+		errno = EOPNOTSUPP;
+		return (NULL);
+	}
+
+	if ((bu = mm_calloc(1, sizeof(struct bufferevent_uring),
+	    EVENT_MEM_BUFFER)) == NULL)
+		return (NULL);
+	bufev = &bu->bev;
+
+	if ((bufev->input = evbuffer_new()) == NULL)
+		goto error;
+	if ((bufev->output = evbuffer_new()) == NULL)
+		goto error;
+	if ((bu->sending = evbuffer_new()) == NULL)
+		goto error;
+
+	bu->uringop = uringop;
+	bu->fd = fd;
+	bu->recv_req.cb = bufferevent_uring_recv_done;
+	bu->recv_req.arg = bu;
+	bu->send_req.cb = bufferevent_uring_send_done;
+	bu->send_req.arg = bu;
+
+	event_set(&bufev->ev_read, fd, 0, bufferevent_uring_readcb, bufev);
+	event_set(&bufev->ev_write, fd, 0, bufferevent_uring_writecb, bufev);
+	bufferevent_base_set(base, bufev);
+
+	bufferevent_setcb(bufev, readcb, writecb, errorcb, cbarg);
+
+	/* as with bufferevent_new(), writing is enabled from the start */
+	bufev->enabled = EV_WRITE;
+
+	return (bufev);
+
+ error:
+	if (bufev->input != NULL)
+		evbuffer_free(bufev->input);
+	if (bufev->output != NULL)
+		evbuffer_free(bufev->output);
+	mm_free(bu, EVENT_MEM_BUFFER);
+	return (NULL);
+}
+
+int
+bufferevent_uring_enable(struct bufferevent *bufev, short event)
+{
+	struct bufferevent_uring *bu = (struct bufferevent_uring *)bufev;
+
+	/* completions are edge-triggered by nature */
+	event &= EV_READ | EV_WRITE;
+	bufev->enabled |= event;
+
+	if (event & EV_READ) {
+		bu->read_what = bu->read_report = 0;
+		/* data that was received after reading stopped */
+		if (bu->nread > 0 && EVBUFFER_LENGTH(bufev->input) > 0)
+			event_active(&bufev->ev_read, EV_READ, 1);
+		if (bufferevent_uring_read(bu) == -1)
+			return (-1);
+	}
+	if (event & EV_WRITE) {
+		bu->write_what = bu->write_report = 0;
+		if (bufferevent_uring_write(bu) == -1)
+			return (-1);
+	}
+	return (0);
+}
+
+int
+bufferevent_uring_disable(struct bufferevent *bufev, short event)
+{
+	struct bufferevent_uring *bu = (struct bufferevent_uring *)bufev;
+
+	event &= EV_READ | EV_WRITE;
+	bufev->enabled &= ~event;
+
+	/* a send in flight is finished, but no new one is started */
+	if (event & EV_READ) {
+		event_del(&bufev->ev_read);
+		if (evuring_cancel(bu->uringop, &bu->recv_req) == -1)
+			return (-1);
+	}
+	if (event & EV_WRITE)
+		event_del(&bufev->ev_write);
+	return (0);
+}
+
+void
+bufferevent_uring_start_read(struct bufferevent *bufev)
+{
+	struct bufferevent_uring *bu = (struct bufferevent_uring *)bufev;
+
+	if (bufferevent_uring_read(bu) == -1) {
+		bu->read_what = EVBUFFER_READ | EVBUFFER_ERROR;
+		bu->read_report = 1;
+		event_active(&bufev->ev_read, EV_READ, 1);
+	}
+}
+
+void
+bufferevent_uring_start_write(struct bufferevent *bufev)
+{
+	struct bufferevent_uring *bu = (struct bufferevent_uring *)bufev;
+
+	if (bufferevent_uring_write(bu) == -1) {
+		bu->write_what = EVBUFFER_WRITE | EVBUFFER_ERROR;
+		bu->write_report = 1;
+		event_active(&bufev->ev_write, EV_WRITE, 1);
+	}
+}
+
+void
+bufferevent_uring_settimeout(struct bufferevent *bufev)
+{
+	struct bufferevent_uring *bu = (struct bufferevent_uring *)bufev;
+
+	event_del(&bufev->ev_read);
+	if (bu->recv_req.inflight)
+		bufferevent_add(&bufev->ev_read, bufev->timeout_read);
+	event_del(&bufev->ev_write);
+	if (bu->send_req.inflight)
+		bufferevent_add(&bufev->ev_write, bufev->timeout_write);
+}
+
+void
+bufferevent_uring_setfd(struct bufferevent *bufev, int fd)
+{
+	struct bufferevent_uring *bu = (struct bufferevent_uring *)bufev;
+
+	event_del(&bufev->ev_read);
+	event_del(&bufev->ev_write);
+	evuring_cancel(bu->uringop, &bu->recv_req);
+	evuring_cancel(bu->uringop, &bu->send_req);
+
+	/*
+	 * Requests in flight finish on the old fd and their completions are
+	 * ignored; the next ones use fd.  The kernel may still read sending
+	 * until the send completes, so only then it is dropped.
+	 */
+	bu->fd = bufev->ev_read.ev_fd = bufev->ev_write.ev_fd = fd;
+	++bu->gen;
+	bu->read_what = bu->write_what = 0;
+	bu->read_report = bu->write_report = 0;
+	if (!bu->send_req.inflight)
+		evbuffer_drain(bu->sending, EVBUFFER_LENGTH(bu->sending));
+}
+
+void
+bufferevent_uring_free(struct bufferevent *bufev)
+{
+	struct bufferevent_uring *bu = (struct bufferevent_uring *)bufev;
+
+	event_del(&bufev->ev_read);
+	event_del(&bufev->ev_write);
+	evuring_cancel(bu->uringop, &bu->recv_req);
+	evuring_cancel(bu->uringop, &bu->send_req);
+
+	evbuffer_free(bufev->input);
+	evbuffer_free(bufev->output);
+
+	bu->dead = 1;
+	bufferevent_uring_reap(bu);
+}
+
+#else /* !HAVE_IO_URING */
+
+struct bufferevent *
+bufferevent_uring_new(struct event_base *base, int fd, evbuffercb readcb,
+    evbuffercb writecb, everrorcb errorcb, void *cbarg)
+{
+	errno = EOPNOTSUPP;
+	return (NULL);
+}
+
+#endif /* HAVE_IO_URING */
@@ -40,6 +40,12 @@
 
 #include <sys/queue.h>
 #include <sys/epoll.h>
+#ifdef HAVE_SYS_TIMERFD_H
+#include <sys/timerfd.h>
+#endif
+#ifdef HAVE_SYS_SYSCALL_H
+#include <sys/syscall.h>
+#endif
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -54,23 +60,51 @@
 #include "event-internal.h"
 #include "evsignal.h"
 #include "log.h"
+#include "mm-internal.h"
 
 /* due to limitations in the epoll interface, we need to keep track of
- * all file descriptors outself.
+ * all file descriptors outself.  Any number of events may wait on an fd;
+ * the kernel is told the union of their interest.
  */
 struct evepoll {
-	struct event *evread;
-	struct event *evwrite;
+	struct event_list events;
+	int nread;		/* events with EV_READ */
+	int nwrite;		/* events with EV_WRITE */
+	/* used with EVENT_BASE_FLAG_EPOLL_CHANGELIST */
+	int kernel_events;	/* what the kernel was last told */
+	short changed;		/* fd is on the changelist */
+	short was_deleted;	/* interest dropped to nothing meanwhile */
 };
 
+/*
+ * The evepolls are found by fd in a two-level table: the fd selects a page
+ * of EPOLL_PAGE_SIZE entries, which is allocated on first use.  A high fd
+ * thus costs a single page, and growing the table never moves entries.
+ */
+#define EPOLL_PAGE_SHIFT	10
+#define EPOLL_PAGE_SIZE		(1 << EPOLL_PAGE_SHIFT)
+#define EPOLL_PAGE_MASK		(EPOLL_PAGE_SIZE - 1)
+
 struct epollop {
-	struct evepoll *fds;
-	int nfds;
+	struct evepoll **pages;
+	int npages;
 	struct epoll_event *events;
 	int nevents;
 	int epfd;
+	int precise;		/* how timeouts below a msec are waited for */
+	int timerfd;
+	int timerfd_armed;
+	/* fds whose interest changed since the last epoll_wait */
+	int use_changelist;
+	int *changes;
+	int nchanges;
+	int changes_size;
 };
 
+#define EPOLL_PRECISE_NONE	0	/* epoll_wait, rounded up to msecs */
+#define EPOLL_PRECISE_PWAIT2	1	/* epoll_pwait2 with a timespec */
+#define EPOLL_PRECISE_TIMERFD	2	/* a timerfd in the epoll set */
+
 static void *epoll_init	(struct event_base *);
 static int epoll_add	(void *, struct event *);
 static int epoll_del	(void *, struct event *);
@@ -104,10 +138,73 @@ const struct eventop epollops = {
  */
 #define MAX_EPOLL_TIMEOUT_MSEC (35*60*1000)
 
-#define INITIAL_NFILES 32
 #define INITIAL_NEVENTS 32
 #define MAX_NEVENTS 4096
 
+#ifdef __NR_epoll_pwait2
+/* struct __kernel_timespec, which has a 64-bit tv_sec on all systems */
+struct epoll_timespec64 {
+	ev_int64_t tv_sec;
+	long long tv_nsec;
+};
+
+static int
+epoll_pwait2_tv(int epfd, struct epoll_event *events, int maxevents,
+    const struct timeval *tv)
+{
+	struct epoll_timespec64 ts, *tsp = NULL;
+
+	if (tv != NULL) {
+		ts.tv_sec = tv->tv_sec;
+		ts.tv_nsec = (long long)tv->tv_usec * 1000;
+		tsp = &ts;
+	}
+	return (syscall(__NR_epoll_pwait2, epfd, events, maxevents, tsp,
+		NULL, 0));
+}
+#endif
+
+/*
+ * Picks a way to wait with microsecond precision for bases created with
+ * EVENT_BASE_FLAG_PRECISE_TIMER: epoll_pwait2 takes a timespec, older
+ * kernels get a timerfd that is armed before every wait.
+ */
+static void
+epoll_init_precise(struct epollop *epollop)
+{
+#ifdef HAVE_SYS_TIMERFD_H
+	struct epoll_event epev;
+#endif
+#ifdef __NR_epoll_pwait2
+	struct timeval zero = { 0, 0 };
+
+	if (!evutil_getenv("EVENT_NOPWAIT2") &&
+	    epoll_pwait2_tv(epollop->epfd, epollop->events,
+		epollop->nevents, &zero) != -1) {
+		epollop->precise = EPOLL_PRECISE_PWAIT2;
+		return;
+	}
+#endif
+#ifdef HAVE_SYS_TIMERFD_H
+	epollop->timerfd = timerfd_create(CLOCK_MONOTONIC,
+	    TFD_NONBLOCK | TFD_CLOEXEC);
+	if (epollop->timerfd != -1) {
+		memset(&epev, 0, sizeof(epev));
+		epev.data.fd = epollop->timerfd;
+		epev.events = EPOLLIN;
+		if (epoll_ctl(epollop->epfd, EPOLL_CTL_ADD, epollop->timerfd,
+			&epev) == 0) {
+			epollop->precise = EPOLL_PRECISE_TIMERFD;
+			return;
+		}
+		close(epollop->timerfd);
+		epollop->timerfd = -1;
+	}
+#endif
+	event_warnx("%s: no precise timer available, using milliseconds",
+	    __func__);
+}
+
 static void *
 epoll_init(struct event_base *base)
 {
@@ -127,59 +224,196 @@ epoll_init(struct event_base *base)
 
 	FD_CLOSEONEXEC(epfd);
 
-	if (!(epollop = calloc(1, sizeof(struct epollop))))
+	if (!(epollop = mm_calloc(1, sizeof(struct epollop), EVENT_MEM_EVENT)))
 		return (NULL);
 
 	epollop->epfd = epfd;
 
 	/* Initalize fields */
-	epollop->events = malloc(INITIAL_NEVENTS * sizeof(struct epoll_event));
+	epollop->events = mm_malloc(INITIAL_NEVENTS *
+	    sizeof(struct epoll_event), EVENT_MEM_EVENT);
 	if (epollop->events == NULL) {
-		free(epollop);
+		mm_free(epollop, EVENT_MEM_EVENT);
 		return (NULL);
 	}
 	epollop->nevents = INITIAL_NEVENTS;
 
-	epollop->fds = calloc(INITIAL_NFILES, sizeof(struct evepoll));
-	if (epollop->fds == NULL) {
-		free(epollop->events);
-		free(epollop);
-		return (NULL);
-	}
-	epollop->nfds = INITIAL_NFILES;
+	epollop->timerfd = -1;
+	if (base->flags & EVENT_BASE_FLAG_PRECISE_TIMER)
+		epoll_init_precise(epollop);
+	if (base->flags & EVENT_BASE_FLAG_EPOLL_CHANGELIST)
+		epollop->use_changelist = 1;
 
 	evsignal_init(base);
 
 	return (epollop);
 }
 
+/* Returns the evepoll of fd, or NULL if its page does not exist */
+static inline struct evepoll *
+epoll_fd_lookup(struct epollop *epollop, int fd)
+{
+	struct evepoll *page;
+
+	if (fd < 0 || (fd >> EPOLL_PAGE_SHIFT) >= epollop->npages)
+		return (NULL);
+	page = epollop->pages[fd >> EPOLL_PAGE_SHIFT];
+	if (page == NULL)
+		return (NULL);
+	return (&page[fd & EPOLL_PAGE_MASK]);
+}
+
+/* Returns the evepoll of fd, allocating its page as necessary */
+static struct evepoll *
+epoll_fd_get(struct epollop *epollop, int fd)
+{
+	struct evepoll **pages;
+	int idx = fd >> EPOLL_PAGE_SHIFT, npages;
+
+	if (idx >= epollop->npages) {
+		/* only the page pointers are copied */
+		npages = epollop->npages ? epollop->npages : 1;
+		while (npages <= idx)
+			npages <<= 1;
+
+		pages = mm_realloc(epollop->pages,
+		    npages * sizeof(struct evepoll *), EVENT_MEM_EVENT);
+		if (pages == NULL) {
+			event_warn("realloc");
+			return (NULL);
+		}
+		memset(pages + epollop->npages, 0,
+		    (npages - epollop->npages) * sizeof(struct evepoll *));
+		epollop->pages = pages;
+		epollop->npages = npages;
+	}
+
+	if (epollop->pages[idx] == NULL) {
+		struct evepoll *page = mm_calloc(EPOLL_PAGE_SIZE,
+		    sizeof(struct evepoll), EVENT_MEM_EVENT);
+		int i;
+
+		if (page == NULL) {
+			event_warn("calloc");
+			return (NULL);
+		}
+		for (i = 0; i < EPOLL_PAGE_SIZE; ++i)
+			TAILQ_INIT(&page[i].events);
+		epollop->pages[idx] = page;
+	}
+
+	return (&epollop->pages[idx][fd & EPOLL_PAGE_MASK]);
+}
+
+/* All events on an fd are either edge- or level-triggered */
 static int
-epoll_recalc(struct event_base *base, void *arg, int max)
+epoll_fd_is_et(struct evepoll *evep)
 {
-	struct epollop *epollop = arg;
+	struct event *ev = TAILQ_FIRST(&evep->events);
+
+	return (ev != NULL && (ev->ev_events & EV_ET));
+}
+
+/* The interest of all events on an fd, as the kernel should know it */
+static int
+epoll_fd_events(struct evepoll *evep)
+{
+	int events = 0;
 
-	if (max >= epollop->nfds) {
-		struct evepoll *fds;
-		int nfds;
+	if (evep->nread)
+		events |= EPOLLIN;
+	if (evep->nwrite)
+		events |= EPOLLOUT;
+	if (events && epoll_fd_is_et(evep))
+		events |= EPOLLET;
+	return (events);
+}
 
-		nfds = epollop->nfds;
-		while (nfds <= max)
-			nfds <<= 1;
+/* Remembers that the interest in fd changed, for epoll_apply_changes() */
+static int
+epoll_note_change(struct epollop *epollop, int fd)
+{
+	struct evepoll *evep = epoll_fd_lookup(epollop, fd);
+
+	if (evep->changed)
+		return (0);
 
-		fds = realloc(epollop->fds, nfds * sizeof(struct evepoll));
-		if (fds == NULL) {
+	if (epollop->nchanges == epollop->changes_size) {
+		int size = epollop->changes_size ? epollop->changes_size * 2 : 64;
+		int *changes = mm_realloc(epollop->changes, size * sizeof(int),
+		    EVENT_MEM_EVENT);
+		if (changes == NULL) {
 			event_warn("realloc");
 			return (-1);
 		}
-		epollop->fds = fds;
-		memset(fds + epollop->nfds, 0,
-		    (nfds - epollop->nfds) * sizeof(struct evepoll));
-		epollop->nfds = nfds;
+		epollop->changes = changes;
+		epollop->changes_size = size;
 	}
-
+	epollop->changes[epollop->nchanges++] = fd;
+	evep->changed = 1;
 	return (0);
 }
 
+/*
+ * Tells the kernel about the net changes on the changelist.  An fd that
+ * was added and deleted again, or the other way round, costs nothing.
+ * Errors can no longer be reported to event_add(), so they are logged.
+ */
+static void
+epoll_apply_changes(struct epollop *epollop)
+{
+	struct epoll_event epev;
+	struct evepoll *evep;
+	int i, fd, op, events;
+
+	for (i = 0; i < epollop->nchanges; ++i) {
+		fd = epollop->changes[i];
+		evep = epoll_fd_lookup(epollop, fd);
+
+		events = epoll_fd_events(evep);
+
+		/*
+		 * If all interest was dropped in between, the fd may have
+		 * been closed and reused for another file that the kernel
+		 * does not know yet, so an unchanged mask still needs a call;
+		 * a MOD of such an fd fails with ENOENT and becomes an ADD.
+		 */
+		if (events == evep->kernel_events && !evep->was_deleted)
+			goto next;
+
+		memset(&epev, 0, sizeof(epev));
+		epev.data.fd = fd;
+		epev.events = events;
+		if (events == 0) {
+			if (evep->kernel_events != 0 &&
+			    epoll_ctl(epollop->epfd, EPOLL_CTL_DEL, fd,
+				&epev) == -1 &&
+			    errno != ENOENT && errno != EBADF)
+				event_warn("epoll_ctl(DEL, %d)", fd);
+		} else {
+			op = evep->kernel_events ?
+			    EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+			if (epoll_ctl(epollop->epfd, op, fd, &epev) == -1) {
+				/* our idea of the kernel state was wrong */
+				op = op == EPOLL_CTL_MOD ?
+				    EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+				if ((errno == ENOENT || errno == EEXIST) &&
+				    epoll_ctl(epollop->epfd, op, fd,
+					&epev) == 0)
+					goto done;
+				event_warn("epoll_ctl(%d)", fd);
+				events = 0;
+			}
+		}
+	done:
+		evep->kernel_events = events;
+	next:
+		evep->changed = 0;
+		evep->was_deleted = 0;
+	}
+	epollop->nchanges = 0;
+}
+
 static int
 epoll_dispatch(struct event_base *base, void *arg, struct timeval *tv)
 {
@@ -197,8 +431,42 @@ epoll_dispatch(struct event_base *base, void *arg, struct timeval *tv)
 		timeout = MAX_EPOLL_TIMEOUT_MSEC;
 	}
 
+	if (epollop->nchanges)
+		epoll_apply_changes(epollop);
+
+#ifdef HAVE_SYS_TIMERFD_H
+	if (epollop->precise == EPOLL_PRECISE_TIMERFD &&
+	    (tv == NULL || evutil_timerisset(tv))) {
+		struct itimerspec its;
+
+		/* the timerfd wakes us up, a zero value disarms it */
+		memset(&its, 0, sizeof(its));
+		if (tv != NULL) {
+			its.it_value.tv_sec = tv->tv_sec;
+			its.it_value.tv_nsec = tv->tv_usec * 1000;
+		}
+		if ((tv != NULL || epollop->timerfd_armed) &&
+		    timerfd_settime(epollop->timerfd, 0, &its, NULL) == -1) {
+			event_warn("timerfd_settime");
+			return (-1);
+		}
+		epollop->timerfd_armed = tv != NULL;
+		timeout = -1;
+	}
+#endif
+
+	EVBASE_RELEASE_LOCK(base);
+
+#ifdef __NR_epoll_pwait2
+	if (epollop->precise == EPOLL_PRECISE_PWAIT2)
+		res = epoll_pwait2_tv(epollop->epfd, events, epollop->nevents,
+		    tv);
+	else
+#endif
 	res = epoll_wait(epollop->epfd, events, epollop->nevents, timeout);
 
+	EVBASE_ACQUIRE_LOCK(base);
+
 	if (res == -1) {
 		if (errno != EINTR) {
 			event_warn("epoll_wait");
@@ -215,33 +483,31 @@ epoll_dispatch(struct event_base *base, void *arg, struct timeval *tv)
 
 	for (i = 0; i < res; i++) {
 		int what = events[i].events;
-		struct event *evread = NULL, *evwrite = NULL;
+		struct event *ev;
 		int fd = events[i].data.fd;
 
-		if (fd < 0 || fd >= epollop->nfds)
+		if (fd == epollop->timerfd) {
+			ev_uint64_t expirations;
+			if (read(fd, &expirations, sizeof(expirations)) != -1)
+				epollop->timerfd_armed = 0;
+			continue;
+		}
+
+		if ((evep = epoll_fd_lookup(epollop, fd)) == NULL)
 			continue;
-		evep = &epollop->fds[fd];
 
 		if (what & (EPOLLHUP|EPOLLERR)) {
-			evread = evep->evread;
-			evwrite = evep->evwrite;
+			what = EV_READ|EV_WRITE;
 		} else {
-			if (what & EPOLLIN) {
-				evread = evep->evread;
-			}
-
-			if (what & EPOLLOUT) {
-				evwrite = evep->evwrite;
-			}
+			what = ((what & EPOLLIN) ? EV_READ : 0) |
+			    ((what & EPOLLOUT) ? EV_WRITE : 0);
 		}
 
-		if (!(evread||evwrite))
-			continue;
-
-		if (evread != NULL)
-			event_active(evread, EV_READ, 1);
-		if (evwrite != NULL)
-			event_active(evwrite, EV_WRITE, 1);
+		TAILQ_FOREACH(ev, &evep->events, ev_io_next) {
+			if (ev->ev_events & what)
+				event_active_nolock(base, ev,
+				    ev->ev_events & what, 1);
+		}
 	}
 
 	if (res == epollop->nevents && epollop->nevents < MAX_NEVENTS) {
@@ -250,8 +516,8 @@ epoll_dispatch(struct event_base *base, void *arg, struct timeval *tv)
 		int new_nevents = epollop->nevents * 2;
 		struct epoll_event *new_events;
 
-		new_events = realloc(epollop->events,
-		    new_nevents * sizeof(struct epoll_event));
+		new_events = mm_realloc(epollop->events,
+		    new_nevents * sizeof(struct epoll_event), EVENT_MEM_EVENT);
 		if (new_events) {
 			epollop->events = new_events;
 			epollop->nevents = new_nevents;
@@ -268,44 +534,57 @@ epoll_add(void *arg, struct event *ev)
 	struct epollop *epollop = arg;
 	struct epoll_event epev = {0, {0}};
 	struct evepoll *evep;
-	int fd, op, events;
+	int fd, op, events, old_events;
 
-	if (ev->ev_events & EV_SIGNAL)
+	if (ev->ev_events & EV_SIGNAL) {
+		if (ev->ev_events & EV_ET) {
+			errno = EINVAL;
+			return (-1);
+		}
 		return (evsignal_add(ev));
+	}
 
 	fd = ev->ev_fd;
-	if (fd >= epollop->nfds) {
-		/* Extent the file descriptor array as necessary */
-		if (epoll_recalc(ev->ev_base, epollop, fd) == -1)
-			return (-1);
-	}
-	evep = &epollop->fds[fd];
-	op = EPOLL_CTL_ADD;
-	events = 0;
-	if (evep->evread != NULL) {
-		events |= EPOLLIN;
-		op = EPOLL_CTL_MOD;
-	}
-	if (evep->evwrite != NULL) {
-		events |= EPOLLOUT;
-		op = EPOLL_CTL_MOD;
+	if ((evep = epoll_fd_get(epollop, fd)) == NULL)
+		return (-1);
+
+	/* epoll sets EPOLLET for the whole fd, so the events must agree */
+	if (!TAILQ_EMPTY(&evep->events) &&
+	    epoll_fd_is_et(evep) != ((ev->ev_events & EV_ET) != 0)) {
+		event_warnx("%s: mixing edge- and level-triggered events "
+		    "on fd %d", __func__, fd);
+		errno = EINVAL;
+		return (-1);
 	}
 
+	old_events = epoll_fd_events(evep);
+	events = old_events;
 	if (ev->ev_events & EV_READ)
 		events |= EPOLLIN;
 	if (ev->ev_events & EV_WRITE)
 		events |= EPOLLOUT;
+	if (ev->ev_events & EV_ET)
+		events |= EPOLLET;
+
+	/* the kernel only hears about changes of the union */
+	if (events != old_events) {
+		if (epollop->use_changelist) {
+			if (epoll_note_change(epollop, fd) == -1)
+				return (-1);
+		} else {
+			epev.data.fd = fd;
+			epev.events = events;
+			op = old_events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+			if (epoll_ctl(epollop->epfd, op, fd, &epev) == -1)
+				return (-1);
+		}
+	}
 
-	epev.data.fd = fd;
-	epev.events = events;
-	if (epoll_ctl(epollop->epfd, op, ev->ev_fd, &epev) == -1)
-			return (-1);
-
-	/* Update events responsible */
+	TAILQ_INSERT_TAIL(&evep->events, ev, ev_io_next);
 	if (ev->ev_events & EV_READ)
-		evep->evread = ev;
+		evep->nread++;
 	if (ev->ev_events & EV_WRITE)
-		evep->evwrite = ev;
+		evep->nwrite++;
 
 	return (0);
 }
@@ -316,46 +595,36 @@ epoll_del(void *arg, struct event *ev)
 	struct epollop *epollop = arg;
 	struct epoll_event epev = {0, {0}};
 	struct evepoll *evep;
-	int fd, events, op;
-	int needwritedelete = 1, needreaddelete = 1;
+	int fd, events, old_events;
 
 	if (ev->ev_events & EV_SIGNAL)
 		return (evsignal_del(ev));
 
 	fd = ev->ev_fd;
-	if (fd >= epollop->nfds)
+	if ((evep = epoll_fd_lookup(epollop, fd)) == NULL)
 		return (0);
-	evep = &epollop->fds[fd];
-
-	op = EPOLL_CTL_DEL;
-	events = 0;
 
+	old_events = epoll_fd_events(evep);
+	TAILQ_REMOVE(&evep->events, ev, ev_io_next);
 	if (ev->ev_events & EV_READ)
-		events |= EPOLLIN;
+		evep->nread--;
 	if (ev->ev_events & EV_WRITE)
-		events |= EPOLLOUT;
+		evep->nwrite--;
+	events = epoll_fd_events(evep);
 
-	if ((events & (EPOLLIN|EPOLLOUT)) != (EPOLLIN|EPOLLOUT)) {
-		if ((events & EPOLLIN) && evep->evwrite != NULL) {
-			needwritedelete = 0;
-			events = EPOLLOUT;
-			op = EPOLL_CTL_MOD;
-		} else if ((events & EPOLLOUT) && evep->evread != NULL) {
-			needreaddelete = 0;
-			events = EPOLLIN;
-			op = EPOLL_CTL_MOD;
-		}
+	if (events == old_events)
+		return (0);
+
+	if (epollop->use_changelist) {
+		if (events == 0)
+			evep->was_deleted = 1;
+		return (epoll_note_change(epollop, fd));
 	}
 
 	epev.events = events;
 	epev.data.fd = fd;
-
-	if (needreaddelete)
-		evep->evread = NULL;
-	if (needwritedelete)
-		evep->evwrite = NULL;
-
-	if (epoll_ctl(epollop->epfd, op, fd, &epev) == -1)
+	if (epoll_ctl(epollop->epfd, events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL,
+		fd, &epev) == -1)
 		return (-1);
 
 	return (0);
@@ -365,15 +634,22 @@ static void
 epoll_dealloc(struct event_base *base, void *arg)
 {
 	struct epollop *epollop = arg;
+	int i;
 
 	evsignal_dealloc(base);
-	if (epollop->fds)
-		free(epollop->fds);
+	for (i = 0; i < epollop->npages; ++i)
+		mm_free(epollop->pages[i], EVENT_MEM_EVENT);
+	if (epollop->pages)
+		mm_free(epollop->pages, EVENT_MEM_EVENT);
 	if (epollop->events)
-		free(epollop->events);
+		mm_free(epollop->events, EVENT_MEM_EVENT);
 	if (epollop->epfd >= 0)
 		close(epollop->epfd);
+	if (epollop->timerfd >= 0)
+		close(epollop->timerfd);
+	if (epollop->changes)
+		mm_free(epollop->changes, EVENT_MEM_EVENT);
 
 	memset(epollop, 0, sizeof(struct epollop));
-	free(epollop);
+	mm_free(epollop, EVENT_MEM_EVENT);
 }
@@ -49,12 +49,10 @@
 
 #include "evutil.h"
 #include "event.h"
+#include "bufferevent-internal.h"
+#include "mm-internal.h"
 
-/* prototypes */
-
-void bufferevent_read_pressure_cb(struct evbuffer *, size_t, size_t, void *);
-
-static int
+int
 bufferevent_add(struct event *ev, int timeout)
 {
 	struct timeval tv, *ptv = NULL;
@@ -84,6 +82,12 @@ bufferevent_read_pressure_cb(struct evbuffer *buf, size_t old, size_t now,
 	if (bufev->wm_read.high == 0 || now < bufev->wm_read.high) {
 		evbuffer_setcb(buf, NULL, NULL);
 
+#ifdef HAVE_IO_URING
+		if (BEV_IS_URING(bufev)) {
+			bufferevent_uring_start_read(bufev);
+			return;
+		}
+#endif
 		if (bufev->enabled & EV_READ)
 			bufferevent_add(&bufev->ev_read, bufev->timeout_read);
 	}
@@ -93,7 +97,7 @@ static void
 bufferevent_readcb(int fd, short event, void *arg)
 {
 	struct bufferevent *bufev = arg;
-	int res = 0;
+	int res = 0, nread = 0;
 	short what = EVBUFFER_READ;
 	size_t len;
 	int howmuch = -1;
@@ -103,6 +107,13 @@ bufferevent_readcb(int fd, short event, void *arg)
 		goto error;
 	}
 
+	/* the eof or error that came with the data of the last callback */
+	if (bufev->read_pending != 0) {
+		what = bufev->read_pending;
+		bufev->read_pending = 0;
+		goto error;
+	}
+
 	/*
 	 * If we have a high watermark configured then we don't want to
 	 * read more data than would make us reach the watermark.
@@ -120,21 +131,50 @@ bufferevent_readcb(int fd, short event, void *arg)
 	}
 
 	res = evbuffer_read(bufev->input, fd, howmuch);
+
+	/*
+	 * Edge-triggered: we are not told again about data that is already
+	 * there, so read until the socket would block or the high watermark
+	 * is reached.
+	 */
+	while ((bufev->ev_read.ev_events & EV_ET) && res > 0) {
+		nread += res;
+		if (bufev->wm_read.high != 0) {
+			howmuch = bufev->wm_read.high -
+			    EVBUFFER_LENGTH(bufev->input);
+			if (howmuch <= 0)
+				break;
+		}
+		res = evbuffer_read(bufev->input, fd, howmuch);
+	}
+
 	if (res == -1) {
-		if (errno == EAGAIN || errno == EINTR)
-			goto reschedule;
-		/* error case */
-		what |= EVBUFFER_ERROR;
+		if (errno == EAGAIN || errno == EINTR) {
+			if (nread == 0)
+				goto reschedule;
+		} else
+			/* error case */
+			what |= EVBUFFER_ERROR;
 	} else if (res == 0) {
 		/* eof case */
 		what |= EVBUFFER_EOF;
 	}
 
-	if (res <= 0)
+	if (res <= 0 && nread == 0)
 		goto error;
 
 	bufferevent_add(&bufev->ev_read, bufev->timeout_read);
 
+	/*
+	 * Hand out the data first; the next callback reports the eof or
+	 * error.  Should disabling reading drop that callback,
+	 * bufferevent_enable() schedules it again.
+	 */
+	if (what != EVBUFFER_READ) {
+		bufev->read_pending = what;
+		event_active(&bufev->ev_read, EV_READ, 1);
+	}
+
 	/* See if this callbacks meets the water marks */
 	len = EVBUFFER_LENGTH(bufev->input);
 	if (bufev->wm_read.low != 0 && len < bufev->wm_read.low)
@@ -164,7 +204,7 @@ static void
 bufferevent_writecb(int fd, short event, void *arg)
 {
 	struct bufferevent *bufev = arg;
-	int res = 0;
+	int res = 0, nwritten = 0;
 	short what = EVBUFFER_WRITE;
 
 	if (event == EV_TIMEOUT) {
@@ -174,7 +214,17 @@ bufferevent_writecb(int fd, short event, void *arg)
 
 	if (EVBUFFER_LENGTH(bufev->output)) {
 	    res = evbuffer_write(bufev->output, fd);
-	    if (res == -1) {
+	    /* Edge-triggered: write until the socket is full */
+	    while ((bufev->ev_write.ev_events & EV_ET) && res > 0 &&
+		EVBUFFER_LENGTH(bufev->output)) {
+		    nwritten += res;
+		    res = evbuffer_write(bufev->output, fd);
+	    }
+	    if (res == -1 && nwritten > 0 &&
+		(errno == EAGAIN || errno == EINTR)) {
+		    /* we made progress before the socket filled up */
+		    res = nwritten;
+	    } else if (res == -1) {
 #ifndef WIN32
 /*todo. evbuffer uses WriteFile when WIN32 is set. WIN32 system calls do not
  *set errno. thus this error checking is not portable*/
@@ -236,23 +286,28 @@ bufferevent_new(int fd, evbuffercb readcb, evbuffercb writecb,
 {
 	struct bufferevent *bufev;
 
-	if ((bufev = calloc(1, sizeof(struct bufferevent))) == NULL)
+	if ((bufev = mm_calloc(1, sizeof(struct bufferevent),
+	    EVENT_MEM_BUFFER)) == NULL)
 		return (NULL);
 
 	if ((bufev->input = evbuffer_new()) == NULL) {
-		free(bufev);
+		mm_free(bufev, EVENT_MEM_BUFFER);
 		return (NULL);
 	}
 
 	if ((bufev->output = evbuffer_new()) == NULL) {
 		evbuffer_free(bufev->input);
-		free(bufev);
+		mm_free(bufev, EVENT_MEM_BUFFER);
 		return (NULL);
 	}
 
 	event_set(&bufev->ev_read, fd, EV_READ, bufferevent_readcb, bufev);
 	event_set(&bufev->ev_write, fd, EV_WRITE, bufferevent_writecb, bufev);
 
+	/* the callbacks run from the loop of the current base, if any */
+	evbuffer_defer_callbacks(bufev->input, bufev->ev_read.ev_base);
+	evbuffer_defer_callbacks(bufev->output, bufev->ev_read.ev_base);
+
 	bufferevent_setcb(bufev, readcb, writecb, errorcb, cbarg);
 
 	/*
@@ -279,8 +334,15 @@ bufferevent_setcb(struct bufferevent *bufev,
 void
 bufferevent_setfd(struct bufferevent *bufev, int fd)
 {
+#ifdef HAVE_IO_URING
+	if (BEV_IS_URING(bufev)) {
+		bufferevent_uring_setfd(bufev, fd);
+		return;
+	}
+#endif
 	event_del(&bufev->ev_read);
 	event_del(&bufev->ev_write);
+	bufev->read_pending = 0;
 
 	event_set(&bufev->ev_read, fd, EV_READ, bufferevent_readcb, bufev);
 	event_set(&bufev->ev_write, fd, EV_WRITE, bufferevent_writecb, bufev);
@@ -308,13 +370,19 @@ bufferevent_priority_set(struct bufferevent *bufev, int priority)
 void
 bufferevent_free(struct bufferevent *bufev)
 {
+#ifdef HAVE_IO_URING
+	if (BEV_IS_URING(bufev)) {
+		bufferevent_uring_free(bufev);
+		return;
+	}
+#endif
 	event_del(&bufev->ev_read);
 	event_del(&bufev->ev_write);
 
 	evbuffer_free(bufev->input);
 	evbuffer_free(bufev->output);
 
-	free(bufev);
+	mm_free(bufev, EVENT_MEM_BUFFER);
 }
 
 /*
@@ -333,6 +401,13 @@ bufferevent_write(struct bufferevent *bufev, const void *data, size_t size)
 		return (res);
 
 	/* If everything is okay, we need to schedule a write */
+#ifdef HAVE_IO_URING
+	if (BEV_IS_URING(bufev)) {
+		if (size > 0)
+			bufferevent_uring_start_write(bufev);
+		return (res);
+	}
+#endif
 	if (size > 0 && (bufev->enabled & EV_WRITE))
 		bufferevent_add(&bufev->ev_write, bufev->timeout_write);
 
@@ -368,12 +443,50 @@ bufferevent_read(struct bufferevent *bufev, void *data, size_t size)
 	return (size);
 }
 
+/*
+ * Switches both events of bufev between edge- and level-triggered
+ * notification.  The flag cannot change while an event is added.
+ */
+static int
+bufferevent_set_et(struct bufferevent *bufev, short et)
+{
+	int reading, writing;
+
+	reading = event_pending(&bufev->ev_read, EV_READ|EV_TIMEOUT, NULL);
+	writing = event_pending(&bufev->ev_write, EV_WRITE|EV_TIMEOUT, NULL);
+	if (reading)
+		event_del(&bufev->ev_read);
+	if (writing)
+		event_del(&bufev->ev_write);
+
+	bufev->ev_read.ev_events = (bufev->ev_read.ev_events & ~EV_ET) | et;
+	bufev->ev_write.ev_events = (bufev->ev_write.ev_events & ~EV_ET) | et;
+
+	if (reading &&
+	    bufferevent_add(&bufev->ev_read, bufev->timeout_read) == -1)
+		return (-1);
+	if (writing &&
+	    bufferevent_add(&bufev->ev_write, bufev->timeout_write) == -1)
+		return (-1);
+	return (0);
+}
+
 int
 bufferevent_enable(struct bufferevent *bufev, short event)
 {
+#ifdef HAVE_IO_URING
+	if (BEV_IS_URING(bufev))
+		return (bufferevent_uring_enable(bufev, event));
+#endif
+	if ((event & EV_ET) && !(bufev->enabled & EV_ET)) {
+		if (bufferevent_set_et(bufev, EV_ET) == -1)
+			return (-1);
+	}
 	if (event & EV_READ) {
 		if (bufferevent_add(&bufev->ev_read, bufev->timeout_read) == -1)
 			return (-1);
+		if (bufev->read_pending != 0)
+			event_active(&bufev->ev_read, EV_READ, 1);
 	}
 	if (event & EV_WRITE) {
 		if (bufferevent_add(&bufev->ev_write, bufev->timeout_write) == -1)
@@ -387,6 +500,14 @@ bufferevent_enable(struct bufferevent *bufev, short event)
 int
 bufferevent_disable(struct bufferevent *bufev, short event)
 {
+#ifdef HAVE_IO_URING
+	if (BEV_IS_URING(bufev))
+		return (bufferevent_uring_disable(bufev, event));
+#endif
+	if ((event & EV_ET) && (bufev->enabled & EV_ET)) {
+		if (bufferevent_set_et(bufev, 0) == -1)
+			return (-1);
+	}
 	if (event & EV_READ) {
 		if (event_del(&bufev->ev_read) == -1)
 			return (-1);
@@ -410,6 +531,13 @@ bufferevent_settimeout(struct bufferevent *bufev,
 	bufev->timeout_read = timeout_read;
 	bufev->timeout_write = timeout_write;
 
+#ifdef HAVE_IO_URING
+	if (BEV_IS_URING(bufev)) {
+		bufferevent_uring_settimeout(bufev);
+		return;
+	}
+#endif
+
 	if (event_pending(&bufev->ev_read, EV_READ, NULL))
 		bufferevent_add(&bufev->ev_read, timeout_read);
 	if (event_pending(&bufev->ev_write, EV_WRITE, NULL))
@@ -444,7 +572,15 @@ bufferevent_base_set(struct event_base *base, struct bufferevent *bufev)
 {
 	int res;
 
+#ifdef HAVE_IO_URING
+	/* the requests of bufev are on the ring of its base */
+	if (BEV_IS_URING(bufev) && bufev->ev_base != NULL)
+		return (base == bufev->ev_base ? 0 : -1);
+#endif
+
 	bufev->ev_base = base;
+	evbuffer_defer_callbacks(bufev->input, base);
+	evbuffer_defer_callbacks(bufev->output, base);
 
 	res = event_base_set(base, &bufev->ev_read);
 	if (res == -1)
@@ -104,6 +104,7 @@
 #include "evdns.h"
 #include "evutil.h"
 #include "log.h"
+#include "mm-internal.h"
 #ifdef WIN32
 #include <winsock2.h>
 #include <windows.h>
@@ -583,13 +584,13 @@ request_finished(struct request *const req, struct request **head) {
 
 	if (!req->request_appended) {
 		/* need to free the request data on it's own */
-		free(req->request);
+		mm_free(req->request, EVENT_MEM_DNS);
 	} else {
 		/* the request data is appended onto the header */
 		/* so everything gets free()ed when we: */
 	}
 
-	free(req);
+	mm_free(req, EVENT_MEM_DNS);
 
 	evdns_requests_pump_waiting_queue();
 }
@@ -986,7 +987,7 @@ request_parse(u8 *packet, int length, struct evdns_server_port *port, struct soc
 	if (flags & 0x8000) return -1; /* Must not be an answer. */
 	flags &= 0x0110; /* Only RD and CD get preserved. */
 
-	server_req = malloc(sizeof(struct server_request));
+	server_req = mm_malloc(sizeof(struct server_request), EVENT_MEM_DNS);
 	if (server_req == NULL) return -1;
 	memset(server_req, 0, sizeof(struct server_request));
 
@@ -996,7 +997,7 @@ request_parse(u8 *packet, int length, struct evdns_server_port *port, struct soc
 
 	server_req->base.flags = flags;
 	server_req->base.nquestions = 0;
-	server_req->base.questions = malloc(sizeof(struct evdns_server_question *) * questions);
+	server_req->base.questions = mm_malloc(sizeof(struct evdns_server_question *) * questions, EVENT_MEM_DNS);
 	if (server_req->base.questions == NULL)
 		goto err;
 
@@ -1009,7 +1010,7 @@ request_parse(u8 *packet, int length, struct evdns_server_port *port, struct soc
 		GET16(type);
 		GET16(class);
 		namelen = strlen(tmp_name);
-		q = malloc(sizeof(struct evdns_server_question) + namelen);
+		q = mm_malloc(sizeof(struct evdns_server_question) + namelen, EVENT_MEM_DNS);
 		if (!q)
 			goto err;
 		q->type = type;
@@ -1036,10 +1037,10 @@ err:
 	if (server_req) {
 		if (server_req->base.questions) {
 			for (i = 0; i < server_req->base.nquestions; ++i)
-				free(server_req->base.questions[i]);
-			free(server_req->base.questions);
+				mm_free(server_req->base.questions[i], EVENT_MEM_DNS);
+			mm_free(server_req->base.questions, EVENT_MEM_DNS);
 		}
-		free(server_req);
+		mm_free(server_req, EVENT_MEM_DNS);
 	}
 	return -1;
 
@@ -1323,7 +1324,7 @@ dnslabel_clear(struct dnslabel_table *table)
 {
 	int i;
 	for (i = 0; i < table->n_labels; ++i)
-		free(table->labels[i].v);
+		mm_free(table->labels[i].v, EVENT_MEM_DNS);
 	table->n_labels = 0;
 }
 
@@ -1348,7 +1349,7 @@ dnslabel_table_add(struct dnslabel_table *table, const char *label, off_t pos)
 	int p;
 	if (table->n_labels == MAX_LABELS)
 		return (-1);
-	v = strdup(label);
+	v = mm_strdup(label, EVENT_MEM_DNS);
 	if (v == NULL)
 		return (-1);
 	p = table->n_labels++;
@@ -1481,7 +1482,7 @@ struct evdns_server_port *
 evdns_add_server_port(int socket, int is_tcp, evdns_request_callback_fn_type cb, void *user_data)
 {
 	struct evdns_server_port *port;
-	if (!(port = malloc(sizeof(struct evdns_server_port))))
+	if (!(port = mm_malloc(sizeof(struct evdns_server_port), EVENT_MEM_DNS)))
 		return NULL;
 	memset(port, 0, sizeof(struct evdns_server_port));
 
@@ -1539,12 +1540,12 @@ evdns_server_request_add_reply(struct evdns_server_request *_req, int section, c
 	while (*itemp) {
 		itemp = &((*itemp)->next);
 	}
-	item = malloc(sizeof(struct server_reply_item));
+	item = mm_malloc(sizeof(struct server_reply_item), EVENT_MEM_DNS);
 	if (!item)
 		return -1;
 	item->next = NULL;
-	if (!(item->name = strdup(name))) {
-		free(item);
+	if (!(item->name = mm_strdup(name, EVENT_MEM_DNS))) {
+		mm_free(item, EVENT_MEM_DNS);
 		return -1;
 	}
 	item->type = type;
@@ -1555,16 +1556,16 @@ evdns_server_request_add_reply(struct evdns_server_request *_req, int section, c
 	item->data = NULL;
 	if (data) {
 		if (item->is_name) {
-			if (!(item->data = strdup(data))) {
-				free(item->name);
-				free(item);
+			if (!(item->data = mm_strdup(data, EVENT_MEM_DNS))) {
+				mm_free(item->name, EVENT_MEM_DNS);
+				mm_free(item, EVENT_MEM_DNS);
 				return -1;
 			}
 			item->datalen = (u16)-1;
 		} else {
-			if (!(item->data = malloc(datalen))) {
-				free(item->name);
-				free(item);
+			if (!(item->data = mm_malloc(datalen, EVENT_MEM_DNS))) {
+				mm_free(item->name, EVENT_MEM_DNS);
+				mm_free(item, EVENT_MEM_DNS);
 				return -1;
 			}
 			item->datalen = datalen;
@@ -1713,7 +1714,7 @@ overflow:
 
 	req->response_len = j;
 
-	if (!(req->response = malloc(req->response_len))) {
+	if (!(req->response = mm_malloc(req->response_len, EVENT_MEM_DNS))) {
 		server_request_free_answers(req);
 		dnslabel_clear(&table);
 		return (-1);
@@ -1790,10 +1791,10 @@ server_request_free_answers(struct server_request *req)
 		victim = *list;
 		while (victim) {
 			next = victim->next;
-			free(victim->name);
+			mm_free(victim->name, EVENT_MEM_DNS);
 			if (victim->data)
-				free(victim->data);
-			free(victim);
+				mm_free(victim->data, EVENT_MEM_DNS);
+			mm_free(victim, EVENT_MEM_DNS);
 			victim = next;
 		}
 		*list = NULL;
@@ -1808,8 +1809,8 @@ server_request_free(struct server_request *req)
 	int i, rc=1;
 	if (req->base.questions) {
 		for (i = 0; i < req->base.nquestions; ++i)
-			free(req->base.questions[i]);
-		free(req->base.questions);
+			mm_free(req->base.questions[i], EVENT_MEM_DNS);
+		mm_free(req->base.questions, EVENT_MEM_DNS);
 	}
 
 	if (req->port) {
@@ -1823,7 +1824,7 @@ server_request_free(struct server_request *req)
 	}
 
 	if (req->response) {
-		free(req->response);
+		mm_free(req->response, EVENT_MEM_DNS);
 	}
 
 	server_request_free_answers(req);
@@ -1835,10 +1836,10 @@ server_request_free(struct server_request *req)
 
 	if (rc == 0) {
 		server_port_free(req->port);
-		free(req);
+		mm_free(req, EVENT_MEM_DNS);
 		return (1);
 	}
-	free(req);
+	mm_free(req, EVENT_MEM_DNS);
 	return (0);
 }
 
@@ -2068,7 +2069,7 @@ evdns_clear_nameservers_and_suspend(void)
 			(void) evtimer_del(&server->timeout_event);
 		if (server->socket >= 0)
 			CLOSE_SOCKET(server->socket);
-		free(server);
+		mm_free(server, EVENT_MEM_DNS);
 		if (next == started_at)
 			break;
 		server = next;
@@ -2126,7 +2127,7 @@ _evdns_nameserver_add_impl(unsigned long int address, int port) {
 		} while (server != started_at);
 	}
 
-	ns = (struct nameserver *) malloc(sizeof(struct nameserver));
+	ns = (struct nameserver *) mm_malloc(sizeof(struct nameserver), EVENT_MEM_DNS);
         if (!ns) return -1;
 
 	memset(ns, 0, sizeof(struct nameserver));
@@ -2169,7 +2170,7 @@ _evdns_nameserver_add_impl(unsigned long int address, int port) {
 out2:
 	CLOSE_SOCKET(ns->socket);
 out1:
-	free(ns);
+	mm_free(ns, EVENT_MEM_DNS);
 	log(EVDNS_LOG_WARN, "Unable to add nameserver %s: error %d", debug_ntoa(address), err);
 	return err;
 }
@@ -2245,7 +2246,7 @@ request_new(int type, const char *name, int flags,
 	const u16 trans_id = issuing_now ? transaction_id_pick() : 0xffff;
 	/* the request data is alloced in a single block with the header */
 	struct request *const req =
-	    (struct request *) malloc(sizeof(struct request) + request_max_len);
+	    (struct request *) mm_malloc(sizeof(struct request) + request_max_len, EVENT_MEM_DNS);
 	int rlen;
         (void) flags;
 
@@ -2273,7 +2274,7 @@ request_new(int type, const char *name, int flags,
 
 	return req;
 err1:
-	free(req);
+	mm_free(req, EVENT_MEM_DNS);
 	return NULL;
 }
 
@@ -2401,15 +2402,15 @@ search_state_decref(struct search_state *const state) {
 		struct search_domain *next, *dom;
 		for (dom = state->head; dom; dom = next) {
 			next = dom->next;
-			free(dom);
+			mm_free(dom, EVENT_MEM_DNS);
 		}
-		free(state);
+		mm_free(state, EVENT_MEM_DNS);
 	}
 }
 
 static struct search_state *
 search_state_new(void) {
-	struct search_state *state = (struct search_state *) malloc(sizeof(struct search_state));
+	struct search_state *state = (struct search_state *) mm_malloc(sizeof(struct search_state), EVENT_MEM_DNS);
         if (!state) return NULL;
 	memset(state, 0, sizeof(struct search_state));
 	state->refcount = 1;
@@ -2442,7 +2443,7 @@ search_postfix_add(const char *domain) {
         if (!global_search_state) return;
 	global_search_state->num_domains++;
 
-	sdomain = (struct search_domain *) malloc(sizeof(struct search_domain) + domain_len);
+	sdomain = (struct search_domain *) mm_malloc(sizeof(struct search_domain) + domain_len, EVENT_MEM_DNS);
         if (!sdomain) return;
 	memcpy( ((u8 *) sdomain) + sizeof(struct search_domain), domain, domain_len);
 	sdomain->next = global_search_state->head;
@@ -2505,7 +2506,7 @@ search_make_new(const struct search_state *const state, int n, const char *const
 			/* the actual postfix string is kept at the end of the structure */
 			const u8 *const postfix = ((u8 *) dom) + sizeof(struct search_domain);
 			const int postfix_len = dom->len;
-			char *const newname = (char *) malloc(base_len + need_to_append_dot + postfix_len + 1);
+			char *const newname = (char *) mm_malloc(base_len + need_to_append_dot + postfix_len + 1, EVENT_MEM_DNS);
                         if (!newname) return NULL;
 			memcpy(newname, base_name, base_len);
 			if (need_to_append_dot) newname[base_len] = '.';
@@ -2536,11 +2537,11 @@ search_request_new(int type, const char *const name, int flags, evdns_callback_t
 			char *const new_name = search_make_new(global_search_state, 0, name);
                         if (!new_name) return 1;
 			req = request_new(type, new_name, flags, user_callback, user_arg);
-			free(new_name);
+			mm_free(new_name, EVENT_MEM_DNS);
 			if (!req) return 1;
 			req->search_index = 0;
 		}
-		req->search_origname = strdup(name);
+		req->search_origname = mm_strdup(name, EVENT_MEM_DNS);
 		req->search_state = global_search_state;
 		req->search_flags = flags;
 		global_search_state->refcount++;
@@ -2585,7 +2586,7 @@ search_try_next(struct request *const req) {
                 if (!new_name) return 1;
 		log(EVDNS_LOG_DEBUG, "Search: now trying %s (%d)", new_name, req->search_index);
 		newreq = request_new(req->request_type, new_name, req->search_flags, req->user_callback, req->user_pointer);
-		free(new_name);
+		mm_free(new_name, EVENT_MEM_DNS);
 		if (!newreq) return 1;
 		newreq->search_origname = req->search_origname;
 		req->search_origname = NULL;
@@ -2606,7 +2607,7 @@ search_request_finished(struct request *const req) {
 		req->search_state = NULL;
 	}
 	if (req->search_origname) {
-		free(req->search_origname);
+		mm_free(req->search_origname, EVENT_MEM_DNS);
 		req->search_origname = NULL;
 	}
 }
@@ -2768,7 +2769,7 @@ evdns_resolv_conf_parse(int flags, const char *const filename) {
 	}
 	if (st.st_size > 65535) { err = 3; goto out1; }  /* no resolv.conf should be any bigger */
 
-	resolv = (u8 *) malloc((size_t)st.st_size + 1);
+	resolv = (u8 *) mm_malloc((size_t)st.st_size + 1, EVENT_MEM_DNS);
 	if (!resolv) { err = 4; goto out1; }
 
 	n = 0;
@@ -2804,7 +2805,7 @@ evdns_resolv_conf_parse(int flags, const char *const filename) {
 	}
 
 out2:
-	free(resolv);
+	mm_free(resolv, EVENT_MEM_DNS);
 out1:
 	close(fd);
 	return err;
@@ -2823,12 +2824,12 @@ evdns_nameserver_ip_add_line(const char *ips) {
 		addr = ips;
 		while (ISDIGIT(*ips) || *ips == '.' || *ips == ':')
 			++ips;
-		buf = malloc(ips-addr+1);
+		buf = mm_malloc(ips-addr+1, EVENT_MEM_DNS);
 		if (!buf) return 4;
 		memcpy(buf, addr, ips-addr);
 		buf[ips-addr] = '\0';
 		r = evdns_nameserver_ip_add(buf);
-		free(buf);
+		mm_free(buf, EVENT_MEM_DNS);
 		if (r) return r;
 	}
 	return 0;
@@ -2861,7 +2862,7 @@ load_nameservers_with_getnetworkparams(void)
 		goto done;
 	}
 
-	buf = malloc(size);
+	buf = mm_malloc(size, EVENT_MEM_DNS);
 	if (!buf) { status = 4; goto done; }
 	fixed = buf;
 	r = fn(fixed, &size);
@@ -2870,8 +2871,8 @@ load_nameservers_with_getnetworkparams(void)
 		goto done;
 	}
 	if (r != ERROR_SUCCESS) {
-		free(buf);
-		buf = malloc(size);
+		mm_free(buf, EVENT_MEM_DNS);
+		buf = mm_malloc(size, EVENT_MEM_DNS);
 		if (!buf) { status = 4; goto done; }
 		fixed = buf;
 		r = fn(fixed, &size);
@@ -2907,7 +2908,7 @@ load_nameservers_with_getnetworkparams(void)
 
  done:
 	if (buf)
-		free(buf);
+		mm_free(buf, EVENT_MEM_DNS);
 	if (handle)
 		FreeLibrary(handle);
 	return status;
@@ -2923,7 +2924,7 @@ config_nameserver_from_reg_key(HKEY key, const char *subkey)
 	if (RegQueryValueExA(key, subkey, 0, &type, NULL, &bufsz)
 	    != ERROR_MORE_DATA)
 		return -1;
-	if (!(buf = malloc(bufsz)))
+	if (!(buf = mm_malloc(bufsz, EVENT_MEM_DNS)))
 		return -1;
 
 	if (RegQueryValueExA(key, subkey, 0, &type, (LPBYTE)buf, &bufsz)
@@ -2931,7 +2932,7 @@ config_nameserver_from_reg_key(HKEY key, const char *subkey)
 		status = evdns_nameserver_ip_add_line(buf);
 	}
 
-	free(buf);
+	mm_free(buf, EVENT_MEM_DNS);
 	return status;
 }
 
@@ -3059,7 +3060,7 @@ evdns_shutdown(int fail_requests)
 		(void) event_del(&server->event);
 		if (server->state == 0)
                         (void) event_del(&server->timeout_event);
-		free(server);
+		mm_free(server, EVENT_MEM_DNS);
 		if (server_next == server_head)
 			break;
 	}
@@ -3069,9 +3070,9 @@ evdns_shutdown(int fail_requests)
 	if (global_search_state) {
 		for (dom = global_search_state->head; dom; dom = dom_next) {
 			dom_next = dom->next;
-			free(dom);
+			mm_free(dom, EVENT_MEM_DNS);
 		}
-		free(global_search_state);
+		mm_free(global_search_state, EVENT_MEM_DNS);
 		global_search_state = NULL;
 	}
 	evdns_log_fn = NULL;
@@ -32,7 +32,13 @@ extern "C" {
 #endif
 
 #include "config.h"
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+#endif
+#include <time.h>
 #include "min_heap.h"
+#include "min_heap4.h"
+#include "timer_wheel.h"
 #include "evsignal.h"
 
 struct eventop {
@@ -46,11 +52,76 @@ struct eventop {
 	int need_reinit;
 };
 
+/*
+ * The backends keep the events on an fd in a list.  The compact struct
+ * event has a link for it in its first cache line; otherwise an event on
+ * an fd is no signal, so its signal link is free for the fd.
+ */
+#ifndef _EVENT_COMPACT_EVENT
+#define ev_io_next	ev_signal_next
+#endif
+
+/*
+ * A cache of fixed-size objects, carved out of pages of EVENT_SLAB_NOBJS
+ * objects.  Freed objects go on a free list and pages are only released
+ * with the base.
+ */
+struct event_slab_page;
+struct event_slab {
+	size_t size;			/* of one object */
+	void *freelist;
+	struct event_slab_page *pages;
+};
+
+/*
+ * The trace ring of event_base_trace_start().  Records are written by
+ * whoever holds the base lock, so the ring needs no lock of its own; the
+ * oldest records are overwritten once it is full.
+ */
+struct event_trace_rec {
+	ev_uint64_t ticks;		/* of the cycle counter */
+	void *ptr;			/* callback of the event */
+	int fd;
+	short type;			/* EVENT_TRACE_* */
+	short res;
+};
+
+struct event_trace {
+	struct event_trace_rec *recs;
+	ev_uint64_t mask;		/* number of records - 1 */
+	ev_uint64_t head;		/* records written so far */
+	ev_uint64_t start_ticks;	/* to convert ticks to nanoseconds */
+	ev_uint64_t start_ns;
+	int id;				/* the thread of the Chrome trace */
+};
+
+#define EVENT_TRACE_DISPATCH_BEGIN	1
+#define EVENT_TRACE_DISPATCH_END	2	/* res: events now active */
+#define EVENT_TRACE_CALLBACK_BEGIN	3	/* res: ev_res */
+#define EVENT_TRACE_CALLBACK_END	4
+#define EVENT_TRACE_TIMER		5
+#define EVENT_TRACE_ADD			6	/* res: ev_events */
+#define EVENT_TRACE_DEL			7
+
+#define EVENT_TRACE(base, type, ptr, fd, res) do {			\
+	if ((base)->trace_on)						\
+		event_trace_record((base)->trace, type, ptr, fd, res);	\
+} while (0)
+
+/* Per active queue, for EVENT_BASE_FLAG_GROUP_CALLBACKS */
+#define EVENT_GROUP_SLOTS	64
+
+struct event_group_slot {
+	void (*callback)(int, short, void *);
+	struct event *tail;		/* last active event with callback */
+};
+
 struct event_base {
 	const struct eventop *evsel;
 	void *evbase;
 	int event_count;		/* counts number of total events */
 	int event_count_active;	/* counts number of active events */
+	int virtual_event_count;	/* requests that keep the loop going */
 
 	int event_gotterm;		/* Set to terminate loop */
 	int event_break;		/* Set to terminate loop immediately */
@@ -59,6 +130,50 @@ struct event_base {
 	struct event_list **activequeues;
 	int nactivequeues;
 
+	/* weighted scheduling, see event_base_priority_weights() */
+	int *sched_weights;		/* NULL for strict priorities */
+	int *sched_deficit;		/* callbacks each queue may still run */
+	int sched_current;		/* the queue being serviced */
+	int sched_in_round;		/* sched_current got its quantum */
+	int sched_budget;		/* callbacks per iteration, 0 for all */
+
+	/* EVENT_GROUP_SLOTS per active queue, see event_group_insert() */
+	struct event_group_slot *group_slots;
+
+	/* EVLOOP_BUSYPOLL, see event_base_set_busypoll() */
+	struct timeval busypoll_window;	/* spin this long after activity */
+	struct timeval busypoll_last;	/* when the loop last found work */
+	int busypoll_budget;		/* callbacks per spinning iteration */
+	int busypolling;		/* the loop runs with EVLOOP_BUSYPOLL */
+	struct event_busypoll_stats busypoll_stats;
+
+#ifdef USE_EVENT_STATS
+	/* see event_base_get_stats() */
+	struct event_base_stats stats;
+	ev_uint64_t stats_batch;	/* callbacks run by this iteration */
+#endif
+
+	/* the running callback, for event_base_set_watchdog() */
+	struct event_watchdog *watchdog;
+	unsigned int wd_seq;		/* odd while a callback runs */
+	void (*wd_callback)(int, short, void *);
+	int wd_fd;
+	short wd_res;
+	ev_uint64_t wd_stalls;		/* callbacks the watchdog reported */
+
+	/* see event_base_trace_start() */
+	struct event_trace *trace;
+	int trace_on;
+
+	/* evbuffers with a deferred callback, in the order they changed */
+	struct evbuffer *deferred_head;
+	struct evbuffer **deferred_tail;
+	unsigned int deferred_gen;
+
+	/* event_new() and event_base_once() allocate from here */
+	struct event_slab ev_slab;
+	struct event_slab once_slab;
+
 	/* signal handling info */
 	struct evsignal_info sig;
 
@@ -66,10 +181,78 @@ struct event_base {
 	struct timeval event_tv;
 
 	struct min_heap timeheap;
+	/* timer store selected with event_base_set_timer_method() */
+	int timer_method;
+	struct min_heap4 timeheap4;
+	struct timer_wheel *timewheel;
+
+	/* see event_base_now(), 0 while it is not cached */
+	ev_uint64_t now_ns;
+	/* the wall clock minus now_ns, see event_base_gettimeofday_cached() */
+	ev_uint64_t wall_offset_ns;
+	ev_uint64_t wall_offset_at;	/* when the offset was taken */
+
+	int flags;		/* EVENT_BASE_FLAG_* given at creation */
+
+	/* thread support, only set up with EVENT_BASE_FLAG_LOCKING */
+#ifdef HAVE_PTHREADS
+	pthread_mutex_t *th_base_lock;
+	int th_lock_depth;		/* times th_base_lock is held */
+	pthread_t th_owner_id;		/* thread running the loop */
+	/* signalled when the callback of current_event returns */
+	pthread_cond_t th_current_cond;
+	int th_current_waiters;
+#endif
+	struct event *current_event;	/* whose callback the loop runs */
+	int running_loop;
+	/* wakes up the dispatch of the loop thread */
+	int th_notify_fd[2];
+	struct event th_notify;
+	int is_notify_pending;
+
+	/* closures from event_base_post(), a lock-free LIFO of tasks */
+	struct event_post_task *volatile post_head;
+	/* tasks that already ran, recycled by event_base_post() */
+	struct event_post_task *volatile post_free;
+	volatile int post_nfree;
+};
 
-	struct timeval tv_cache;
+/* A closure handed to the loop with event_base_post() */
+struct event_post_task {
+	struct event_post_task *next;
+	void (*fn)(void *);
+	void *arg;
 };
 
+/*
+ * With EVENT_BASE_FLAG_LOCKING every public entry point takes the base
+ * lock.  The loop thread holds it except while it waits in the backend
+ * and while it runs callbacks.  The lock is recursive so that library
+ * code may call back into the public functions while holding it.
+ */
+#ifdef HAVE_PTHREADS
+#define EVBASE_ACQUIRE_LOCK(base) do {					\
+	if ((base)->th_base_lock != NULL) {				\
+		pthread_mutex_lock((base)->th_base_lock);		\
+		(base)->th_lock_depth++;				\
+	}								\
+} while (0)
+#define EVBASE_RELEASE_LOCK(base) do {					\
+	if ((base)->th_base_lock != NULL) {				\
+		(base)->th_lock_depth--;				\
+		pthread_mutex_unlock((base)->th_base_lock);		\
+	}								\
+} while (0)
+/* true if the calling thread has to wake up the loop of base */
+#define EVBASE_NEED_NOTIFY(base)					\
+	((base)->th_base_lock != NULL && (base)->running_loop &&	\
+	    !pthread_equal((base)->th_owner_id, pthread_self()))
+#else
+#define EVBASE_ACQUIRE_LOCK(base) do { (void)(base); } while (0)
+#define EVBASE_RELEASE_LOCK(base) do { (void)(base); } while (0)
+#define EVBASE_NEED_NOTIFY(base) 0
+#endif
+
 /* Internal use only: Functions that might be missing from <sys/queue.h> */
 #ifndef HAVE_TAILQFOREACH
 #define	TAILQ_FIRST(head)		((head)->tqh_first)
@@ -91,9 +274,57 @@ int _evsignal_set_handler(struct event_base *base, int evsignal,
 			  void (*fn)(int));
 int _evsignal_restore_handler(struct event_base *base, int evsignal);
 
+/* Versions of the public functions for callers holding the base lock */
+int event_add_nolock(struct event *ev, const struct timeval *tv);
+int event_del_nolock(struct event *ev);
+void event_active_nolock(struct event_base *base, struct event *ev, int res,
+    short ncalls);
+
+/*
+ * Backend work that is not an event but still keeps event_base_loop()
+ * from returning for lack of events, like io_uring requests in flight.
+ */
+void event_base_add_virtual(struct event_base *base);
+void event_base_del_virtual(struct event_base *base);
+
+/* Queues the callback of an evbuffer, see evbuffer_defer_callbacks() */
+void event_deferred_evbuffer(struct event_base *base, struct evbuffer *buf,
+    size_t oldoff);
+void event_deferred_evbuffer_cancel(struct event_base *base,
+    struct evbuffer *buf);
+
+/* Stops the watchdog thread of a base, defined in watchdog.c */
+void event_watchdog_free(struct event_watchdog *wd);
+/* Formats addr as symbol+offset, or as offset into its object */
+void event_symbol(void *addr, char *buf, size_t len);
+
+/* defined in trace.c */
+void event_trace_record(struct event_trace *trace, int type, void *ptr,
+    int fd, int res);
+void event_trace_free(struct event_trace *trace);
+
 /* defined in evutil.c */
 const char *evutil_getenv(const char *varname);
 
+/*
+ * Nanoseconds of the monotonic clock, or of the wall clock where there is
+ * none.  On the platforms we care about this is read from the vDSO
+ * without entering the kernel.
+ */
+static inline ev_uint64_t
+event_monotonic_ns(void)
+{
+	struct timeval tv;
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+		return ((ev_uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+#endif
+	evutil_gettimeofday(&tv, NULL);
+	return ((ev_uint64_t)tv.tv_sec * 1000000000 + tv.tv_usec * 1000);
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -40,12 +40,19 @@
 #include <sys/_libevent_time.h>
 #endif
 #include <sys/queue.h>
+#ifdef HAVE_SYS_SOCKET_H
+#include <sys/socket.h>
+#endif
+#ifdef HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
+#endif
 #include <stdio.h>
 #include <stdlib.h>
 #ifndef WIN32
 #include <unistd.h>
 #endif
 #include <errno.h>
+#include <limits.h>
 #include <signal.h>
 #include <string.h>
 #include <assert.h>
@@ -55,6 +62,7 @@
 #include "event-internal.h"
 #include "evutil.h"
 #include "log.h"
+#include "mm-internal.h"
 
 #ifdef HAVE_EVENT_PORTS
 extern const struct eventop evportops;
@@ -68,6 +76,9 @@ extern const struct eventop pollops;
 #ifdef HAVE_EPOLL
 extern const struct eventop epollops;
 #endif
+#ifdef HAVE_IO_URING
+extern const struct eventop uringops;
+#endif
 #ifdef HAVE_WORKING_KQUEUE
 extern const struct eventop kqops;
 #endif
@@ -89,6 +100,9 @@ static const struct eventop *eventops[] = {
 #ifdef HAVE_EPOLL
 	&epollops,
 #endif
+#ifdef HAVE_IO_URING
+	&uringops,
+#endif
 #ifdef HAVE_DEVPOLL
 	&devpollops,
 #endif
@@ -107,7 +121,23 @@ static const struct eventop *eventops[] = {
 /* Global state */
 struct event_base *current_base = NULL;
 extern struct event_base *evsignal_base;
-static int use_monotonic = 1;
+static int use_monotonic;
+
+/* An event that frees itself after its callback, see event_base_once() */
+
+struct event_once {
+	struct event ev;
+
+	void (*cb)(int, short, void *);
+	void *arg;
+};
+
+/* EVLOOP_BUSYPOLL defaults, see event_base_set_busypoll() */
+#define BUSYPOLL_WINDOW_USEC	50
+#define BUSYPOLL_BUDGET		64
+
+/* how many run tasks event_process_posted() keeps for event_base_post() */
+#define POST_FREE_MAX		256
 
 /* Prototypes */
 static void	event_queue_insert(struct event_base *, struct event *, int);
@@ -119,29 +149,90 @@ static void	event_process_active(struct event_base *);
 static int	timeout_next(struct event_base *, struct timeval **);
 static void	timeout_process(struct event_base *);
 static void	timeout_correct(struct event_base *, struct timeval *);
+static void	timeout_reschedule(struct event_base *, struct event *,
+		    struct timeval *);
+
+static int	timeout_store_reserve(struct event_base *);
+static void	timeout_store_push(struct event_base *, struct event *);
+static void	timeout_store_erase(struct event_base *, struct event *);
+static int	timeout_store_empty(struct event_base *);
+static struct event *timeout_store_top(struct event_base *);
+
+static int	evthread_notify_init(struct event_base *);
+static void	evthread_notify_dealloc(struct event_base *);
+static int	evthread_notify_base(struct event_base *);
+static int	evthread_notify_write(struct event_base *);
+static void	event_process_posted(struct event_base *);
+static void	event_process_deferred(struct event_base *);
+static void	event_group_close(struct event_base *, struct event *);
+static int	event_busypoll_spin(struct event_base *);
+static void	event_slab_init(struct event_slab *, size_t);
+static void	event_slab_dtor(struct event_slab *);
+static void	detect_monotonic(struct event_base *);
+#ifdef USE_EVENT_STATS
+static unsigned	timeout_store_size(struct event_base *);
+static void	event_stats_callback(struct event_base *, ev_uint64_t);
+static void	event_stats_batch(struct event_base *);
+#endif
 
-static int
-gettime(struct event_base *base, struct timeval *tp)
+/*
+ * Decides once whether there is a monotonic clock, and for each base with
+ * EVENT_BASE_FLAG_COARSE_CLOCK whether the coarse one works; if not that
+ * base uses CLOCK_MONOTONIC instead.
+ */
+static void
+detect_monotonic(struct event_base *base)
 {
-	if (base->tv_cache.tv_sec) {
-		*tp = base->tv_cache;
-		return (0);
-	}
-
 #if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+	static int use_monotonic_initialized;
 	struct timespec	ts;
 
-	if (use_monotonic &&
-	    clock_gettime(CLOCK_MONOTONIC, &ts) == 0) {
-		tp->tv_sec = ts.tv_sec;
-		tp->tv_usec = ts.tv_nsec / 1000;
-		return (0);
+	if (!use_monotonic_initialized) {
+		if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+			use_monotonic = 1;
+		use_monotonic_initialized = 1;
 	}
+#ifdef CLOCK_MONOTONIC_COARSE
+	if (use_monotonic && (base->flags & EVENT_BASE_FLAG_COARSE_CLOCK) &&
+	    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts) == 0)
+		return;
+#endif
+#endif
+	base->flags &= ~EVENT_BASE_FLAG_COARSE_CLOCK;
+}
+
+/*
+ * The clock of the loop in nanoseconds: monotonic where we have it, with
+ * EVENT_BASE_FLAG_COARSE_CLOCK the coarse variant that is read without
+ * touching the hardware counters.
+ */
+static ev_uint64_t
+event_clock_ns(struct event_base *base)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC_COARSE)
+	struct timespec	ts;
+
+	if ((base->flags & EVENT_BASE_FLAG_COARSE_CLOCK) &&
+	    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts) == 0)
+		return ((ev_uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
 #endif
+	return (event_monotonic_ns());
+}
 
-	use_monotonic = 0;
+/*
+ * The time of the loop, cached from after the last poll of the backend
+ * while the loop runs.
+ */
+static int
+gettime(struct event_base *base, struct timeval *tp)
+{
+	ev_uint64_t now = base->now_ns;
 
-	return (evutil_gettimeofday(tp, NULL));
+	if (now == 0)
+		now = event_clock_ns(base);
+	tp->tv_sec = now / 1000000000;
+	tp->tv_usec = (now % 1000000000) / 1000;
+	return (0);
 }
 
 struct event_base *
@@ -157,19 +248,37 @@ event_init(void)
 
 struct event_base *
 event_base_new(void)
+{
+	return (event_base_new_with_flags(0));
+}
+
+struct event_base *
+event_base_new_with_flags(int flags)
 {
 	int i;
 	struct event_base *base;
 
-	if ((base = calloc(1, sizeof(struct event_base))) == NULL)
+	if ((base = mm_calloc(1, sizeof(struct event_base),
+	    EVENT_MEM_EVENT)) == NULL)
 		event_err(1, "%s: calloc", __func__);
 
+	base->flags = flags;
+	detect_monotonic(base);
 	gettime(base, &base->event_tv);
 	
 	min_heap_ctor(&base->timeheap);
+	min_heap4_ctor(&base->timeheap4);
 	TAILQ_INIT(&base->eventqueue);
 	base->sig.ev_signal_pair[0] = -1;
 	base->sig.ev_signal_pair[1] = -1;
+	base->sig.ev_signalfd = -1;
+	base->th_notify_fd[0] = -1;
+	base->th_notify_fd[1] = -1;
+	base->busypoll_window.tv_usec = BUSYPOLL_WINDOW_USEC;
+	base->busypoll_budget = BUSYPOLL_BUDGET;
+	base->deferred_tail = &base->deferred_head;
+	event_slab_init(&base->ev_slab, sizeof(struct event));
+	event_slab_init(&base->once_slab, sizeof(struct event_once));
 	
 	base->evbase = NULL;
 	for (i = 0; eventops[i] && !base->evbase; i++) {
@@ -188,9 +297,130 @@ event_base_new(void)
 	/* allocate a single active event queue */
 	event_base_priority_init(base, 1);
 
+	if ((flags & EVENT_BASE_FLAG_LOCKING) &&
+	    evthread_notify_init(base) == -1) {
+		event_base_free(base);
+		return (NULL);
+	}
+
 	return (base);
 }
 
+/*
+ * Thread support: the base lock and the notification fd that lets other
+ * threads wake up a loop blocked in the backend.  An eventfd is used
+ * where available, otherwise a socketpair like the signal code does.
+ */
+
+static void
+evthread_notify_drain(int fd, short what, void *arg)
+{
+	struct event_base *base = arg;
+	char buf[128];
+
+#ifdef HAVE_SYS_EVENTFD_H
+	if (base->th_notify_fd[1] == -1) {
+		ev_uint64_t msg;
+		if (read(fd, &msg, sizeof(msg)) == -1 && errno != EAGAIN)
+			event_warn("%s: read", __func__);
+	} else
+#endif
+	while (recv(fd, buf, sizeof(buf), 0) > 0)
+		;
+
+	EVBASE_ACQUIRE_LOCK(base);
+	base->is_notify_pending = 0;
+	EVBASE_RELEASE_LOCK(base);
+}
+
+static int
+evthread_notify_init(struct event_base *base)
+{
+#ifdef HAVE_PTHREADS
+	pthread_mutexattr_t attr;
+
+	if (base->th_base_lock == NULL) {
+		base->th_base_lock = mm_malloc(sizeof(pthread_mutex_t),
+		    EVENT_MEM_EVENT);
+		if (base->th_base_lock == NULL) {
+			event_warn("%s: malloc", __func__);
+			return (-1);
+		}
+		pthread_mutexattr_init(&attr);
+		pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+		pthread_mutex_init(base->th_base_lock, &attr);
+		pthread_mutexattr_destroy(&attr);
+		pthread_cond_init(&base->th_current_cond, NULL);
+	}
+
+#ifdef HAVE_SYS_EVENTFD_H
+	base->th_notify_fd[0] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#endif
+	if (base->th_notify_fd[0] == -1) {
+		if (evutil_socketpair(AF_UNIX, SOCK_STREAM, 0,
+			base->th_notify_fd) == -1) {
+			event_warn("%s: socketpair", __func__);
+			return (-1);
+		}
+		evutil_make_socket_nonblocking(base->th_notify_fd[0]);
+		evutil_make_socket_nonblocking(base->th_notify_fd[1]);
+	}
+
+	event_set(&base->th_notify, base->th_notify_fd[0],
+	    EV_READ | EV_PERSIST, evthread_notify_drain, base);
+	base->th_notify.ev_base = base;
+	base->th_notify.ev_flags |= EVLIST_INTERNAL;
+	base->is_notify_pending = 0;
+
+	return (event_add_nolock(&base->th_notify, NULL));
+#else
+	event_warnx("%s: no thread support", __func__);
+	return (-1);
+#endif
+}
+
+static void
+evthread_notify_dealloc(struct event_base *base)
+{
+	if (base->th_notify.ev_flags & EVLIST_INSERTED)
+		event_del_nolock(&base->th_notify);
+	if (base->th_notify_fd[0] != -1)
+		EVUTIL_CLOSESOCKET(base->th_notify_fd[0]);
+	if (base->th_notify_fd[1] != -1)
+		EVUTIL_CLOSESOCKET(base->th_notify_fd[1]);
+	base->th_notify_fd[0] = base->th_notify_fd[1] = -1;
+}
+
+/* Wakes up the loop thread; several wakeups before it runs coalesce */
+static int
+evthread_notify_base(struct event_base *base)
+{
+	if (base->is_notify_pending)
+		return (0);
+	base->is_notify_pending = 1;
+
+	return (evthread_notify_write(base));
+}
+
+/* Makes the notification fd readable; safe to call without the lock */
+static int
+evthread_notify_write(struct event_base *base)
+{
+#ifdef HAVE_SYS_EVENTFD_H
+	if (base->th_notify_fd[1] == -1) {
+		ev_uint64_t msg = 1;
+		if (write(base->th_notify_fd[0], &msg, sizeof(msg)) == -1 &&
+		    errno != EAGAIN)
+			return (-1);
+		return (0);
+	}
+#endif
+	if (send(base->th_notify_fd[1], "a", 1, 0) == -1 &&
+	    !(errno == EAGAIN || errno == EINTR))
+		return (-1);
+	return (0);
+}
+
 void
 event_base_free(struct event_base *base)
 {
@@ -204,6 +434,8 @@ event_base_free(struct event_base *base)
 
 	/* XXX(niels) - check for internal events first */
 	assert(base);
+	if (base->watchdog != NULL)
+		event_watchdog_free(base->watchdog);
 	/* Delete all non-internal events. */
 	for (ev = TAILQ_FIRST(&base->eventqueue); ev; ) {
 		struct event *next = TAILQ_NEXT(ev, ev_next);
@@ -213,7 +445,7 @@ event_base_free(struct event_base *base)
 		}
 		ev = next;
 	}
-	while ((ev = min_heap_top(&base->timeheap)) != NULL) {
+	while ((ev = timeout_store_top(base)) != NULL) {
 		event_del(ev);
 		++n_deleted;
 	}
@@ -233,22 +465,58 @@ event_base_free(struct event_base *base)
 		event_debug(("%s: %d events were still set in base",
 			__func__, n_deleted));
 
+	evthread_notify_dealloc(base);
+
+	/* closures that never got to run are dropped */
+	while (base->post_head != NULL) {
+		struct event_post_task *task = base->post_head;
+		base->post_head = task->next;
+		mm_free(task, EVENT_MEM_EVENT);
+	}
+	while (base->post_free != NULL) {
+		struct event_post_task *task = base->post_free;
+		base->post_free = task->next;
+		mm_free(task, EVENT_MEM_EVENT);
+	}
+	while (base->deferred_head != NULL)
+		event_deferred_evbuffer_cancel(base, base->deferred_head);
+
 	if (base->evsel->dealloc != NULL)
 		base->evsel->dealloc(base, base->evbase);
 
 	for (i = 0; i < base->nactivequeues; ++i)
 		assert(TAILQ_EMPTY(base->activequeues[i]));
 
-	assert(min_heap_empty(&base->timeheap));
+	assert(timeout_store_empty(base));
 	min_heap_dtor(&base->timeheap);
+	min_heap4_dtor(&base->timeheap4);
+	if (base->timewheel != NULL) {
+		timer_wheel_dtor(base->timewheel);
+		mm_free(base->timewheel, EVENT_MEM_EVENT);
+	}
 
 	for (i = 0; i < base->nactivequeues; ++i)
-		free(base->activequeues[i]);
-	free(base->activequeues);
+		mm_free(base->activequeues[i], EVENT_MEM_EVENT);
+	mm_free(base->activequeues, EVENT_MEM_EVENT);
+	mm_free(base->sched_weights, EVENT_MEM_EVENT);
+	mm_free(base->sched_deficit, EVENT_MEM_EVENT);
+	mm_free(base->group_slots, EVENT_MEM_EVENT);
+	event_slab_dtor(&base->ev_slab);
+	event_slab_dtor(&base->once_slab);
+	if (base->trace != NULL)
+		event_trace_free(base->trace);
 
 	assert(TAILQ_EMPTY(&base->eventqueue));
 
-	free(base);
+#ifdef HAVE_PTHREADS
+	if (base->th_base_lock != NULL) {
+		pthread_cond_destroy(&base->th_current_cond);
+		pthread_mutex_destroy(base->th_base_lock);
+		mm_free(base->th_base_lock, EVENT_MEM_EVENT);
+	}
+#endif
+
+	mm_free(base, EVENT_MEM_EVENT);
 }
 
 /* reinitialized the event base after a fork */
@@ -260,6 +528,8 @@ event_reinit(struct event_base *base)
 	int res = 0;
 	struct event *ev;
 
+	EVBASE_ACQUIRE_LOCK(base);
+
 #if 0
 	/* Right now, reinit always takes effect, since even if the
 	   backend doesn't require it, the signal socketpair code does.
@@ -281,6 +551,18 @@ event_reinit(struct event_base *base)
 		base->sig.ev_signal_added = 0;
 	}
 
+	/* the notification fd is shared with the parent after a fork */
+	if (base->th_notify.ev_flags & EVLIST_INSERTED) {
+		event_queue_remove(base, &base->th_notify, EVLIST_INSERTED);
+		if (base->th_notify.ev_flags & EVLIST_ACTIVE)
+			event_queue_remove(base, &base->th_notify,
+			    EVLIST_ACTIVE);
+		EVUTIL_CLOSESOCKET(base->th_notify_fd[0]);
+		if (base->th_notify_fd[1] != -1)
+			EVUTIL_CLOSESOCKET(base->th_notify_fd[1]);
+		base->th_notify_fd[0] = base->th_notify_fd[1] = -1;
+	}
+
 	if (base->evsel->dealloc != NULL)
 		base->evsel->dealloc(base, base->evbase);
 	evbase = base->evbase = evsel->init(base);
@@ -293,6 +575,11 @@ event_reinit(struct event_base *base)
 			res = -1;
 	}
 
+	if ((base->flags & EVENT_BASE_FLAG_LOCKING) &&
+	    evthread_notify_init(base) == -1)
+		res = -1;
+
+	EVBASE_RELEASE_LOCK(base);
 	return (res);
 }
 
@@ -313,22 +600,43 @@ event_base_priority_init(struct event_base *base, int npriorities)
 	if (npriorities == base->nactivequeues)
 		return (0);
 
+#ifdef _EVENT_COMPACT_EVENT
+	/* the compact struct event keeps the priority in a short */
+	if (npriorities > SHRT_MAX)
+		return (-1);
+#endif
+
 	if (base->nactivequeues) {
 		for (i = 0; i < base->nactivequeues; ++i) {
-			free(base->activequeues[i]);
+			mm_free(base->activequeues[i], EVENT_MEM_EVENT);
 		}
-		free(base->activequeues);
+		mm_free(base->activequeues, EVENT_MEM_EVENT);
+	}
+
+	/* the weights were given per priority */
+	mm_free(base->sched_weights, EVENT_MEM_EVENT);
+	mm_free(base->sched_deficit, EVENT_MEM_EVENT);
+	base->sched_weights = base->sched_deficit = NULL;
+
+	if (base->flags & EVENT_BASE_FLAG_GROUP_CALLBACKS) {
+		mm_free(base->group_slots, EVENT_MEM_EVENT);
+		base->group_slots = mm_calloc(npriorities * EVENT_GROUP_SLOTS,
+		    sizeof(struct event_group_slot), EVENT_MEM_EVENT);
+		if (base->group_slots == NULL)
+			event_err(1, "%s: calloc", __func__);
 	}
 
 	/* Allocate our priority queues */
 	base->nactivequeues = npriorities;
 	base->activequeues = (struct event_list **)
-	    calloc(base->nactivequeues, sizeof(struct event_list *));
+	    mm_calloc(base->nactivequeues, sizeof(struct event_list *),
+		EVENT_MEM_EVENT);
 	if (base->activequeues == NULL)
 		event_err(1, "%s: calloc", __func__);
 
 	for (i = 0; i < base->nactivequeues; ++i) {
-		base->activequeues[i] = malloc(sizeof(struct event_list));
+		base->activequeues[i] = mm_malloc(sizeof(struct event_list),
+		    EVENT_MEM_EVENT);
 		if (base->activequeues[i] == NULL)
 			event_err(1, "%s: malloc", __func__);
 		TAILQ_INIT(base->activequeues[i]);
@@ -340,22 +648,157 @@ event_base_priority_init(struct event_base *base, int npriorities)
 int
 event_haveevents(struct event_base *base)
 {
-	return (base->event_count > 0);
+	return (base->event_count > 0 || base->virtual_event_count > 0);
+}
+
+void
+event_base_add_virtual(struct event_base *base)
+{
+	base->virtual_event_count++;
+}
+
+void
+event_base_del_virtual(struct event_base *base)
+{
+	base->virtual_event_count--;
+}
+
+/*
+ * Runs the callback of the first event on an active queue.  Returns -1 if
+ * the loop has been asked to break.
+ */
+static int
+event_process_one(struct event_base *base, struct event_list *activeq)
+{
+	struct event *ev = TAILQ_FIRST(activeq), *next;
+	short ncalls;
+	int res = 0;
+#ifdef USE_EVENT_STATS
+	ev_uint64_t start, end;
+#endif
+
+	if (ev->ev_events & EV_PERSIST)
+		event_queue_remove(base, ev, EVLIST_ACTIVE);
+	else
+		event_del_nolock(ev);
+	if (base->group_slots != NULL)
+		event_group_close(base, ev);
+
+	/*
+	 * Taking ev off the queue touched the next event; have the one
+	 * after it and the argument of the next on the way while the
+	 * callback runs.
+	 */
+	if (base->group_slots != NULL &&
+	    (next = TAILQ_FIRST(activeq)) != NULL) {
+		__builtin_prefetch(next->ev_arg);
+		if (TAILQ_NEXT(next, ev_active_next) != NULL)
+			__builtin_prefetch(TAILQ_NEXT(next, ev_active_next));
+	}
+
+	/* Allows deletes to work */
+	ncalls = ev->ev_ncalls;
+	ev->ev_pncalls = &ncalls;
+	/* event_del() in other threads waits for the callback to return */
+	base->current_event = ev;
+	EVENT_TRACE(base, EVENT_TRACE_CALLBACK_BEGIN, ev->ev_callback,
+	    ev->ev_fd, ev->ev_res);
+	/* Tell the watchdog which callback runs, see watchdog.c */
+	base->wd_callback = ev->ev_callback;
+	base->wd_fd = ev->ev_fd;
+	base->wd_res = ev->ev_res;
+	__atomic_store_n(&base->wd_seq, base->wd_seq + 1, __ATOMIC_RELEASE);
+	/* ncalls is changed by deletes, so it is only looked at locked */
+	while (ncalls) {
+		ncalls--;
+		ev->ev_ncalls = ncalls;
+		/* Other threads may use the base while the callback runs */
+		EVBASE_RELEASE_LOCK(base);
+#ifdef USE_EVENT_STATS
+		start = event_monotonic_ns();
+#endif
+		(*ev->ev_callback)((int)ev->ev_fd, ev->ev_res, ev->ev_arg);
+#ifdef USE_EVENT_STATS
+		end = event_monotonic_ns();
+		event_stats_callback(base, end - start);
+#endif
+		EVBASE_ACQUIRE_LOCK(base);
+		if (base->event_break) {
+			res = -1;
+			break;
+		}
+	}
+	__atomic_store_n(&base->wd_seq, base->wd_seq + 1, __ATOMIC_RELEASE);
+	EVENT_TRACE(base, EVENT_TRACE_CALLBACK_END, NULL, -1, 0);
+	base->current_event = NULL;
+#ifdef HAVE_PTHREADS
+	if (base->th_current_waiters) {
+		base->th_current_waiters = 0;
+		pthread_cond_broadcast(&base->th_current_cond);
+	}
+#endif
+	return (res);
+}
+
+/*
+ * Deficit round robin over the priority queues: on its turn every queue
+ * gets its weight in callbacks added to its deficit and runs callbacks
+ * until the deficit is used up or the queue is empty, which forfeits the
+ * rest.  The position survives the end of the budget, so the next
+ * iteration continues where this one stopped.
+ */
+static void
+event_process_weighted(struct event_base *base, int budget)
+{
+	struct event_list *activeq;
+	int i, ncallbacks = 0;
+
+	while (base->event_count_active) {
+		i = base->sched_current;
+		activeq = base->activequeues[i];
+		if (!base->sched_in_round) {
+			base->sched_deficit[i] += base->sched_weights[i];
+			base->sched_in_round = 1;
+		}
+
+		while (base->sched_deficit[i] > 0 && !TAILQ_EMPTY(activeq)) {
+			if (budget && ncallbacks == budget)
+				return;
+			base->sched_deficit[i]--;
+			ncallbacks++;
+			if (event_process_one(base, activeq) == -1)
+				return;
+		}
+
+		if (TAILQ_EMPTY(activeq))
+			base->sched_deficit[i] = 0;
+		base->sched_in_round = 0;
+		base->sched_current = (i + 1) % base->nactivequeues;
+	}
 }
 
 /*
  * Active events are stored in priority queues.  Lower priorities are always
  * process before higher priorities.  Low priority events can starve high
- * priority ones.
+ * priority ones, unless weights have been set.
  */
 
 static void
 event_process_active(struct event_base *base)
 {
-	struct event *ev;
 	struct event_list *activeq = NULL;
-	int i;
-	short ncalls;
+	int i, ncallbacks = 0;
+	int budget = base->sched_budget;
+
+	/* A spinning loop has to get back to its timers soon */
+	if (base->busypolling && base->busypoll_budget &&
+	    (!budget || base->busypoll_budget < budget))
+		budget = base->busypoll_budget;
+
+	if (base->sched_weights != NULL) {
+		event_process_weighted(base, budget);
+		return;
+	}
 
 	for (i = 0; i < base->nactivequeues; ++i) {
 		if (TAILQ_FIRST(base->activequeues[i]) != NULL) {
@@ -366,23 +809,54 @@ event_process_active(struct event_base *base)
 
 	assert(activeq != NULL);
 
-	for (ev = TAILQ_FIRST(activeq); ev; ev = TAILQ_FIRST(activeq)) {
-		if (ev->ev_events & EV_PERSIST)
-			event_queue_remove(base, ev, EVLIST_ACTIVE);
-		else
-			event_del(ev);
-		
-		/* Allows deletes to work */
-		ncalls = ev->ev_ncalls;
-		ev->ev_pncalls = &ncalls;
-		while (ncalls) {
-			ncalls--;
-			ev->ev_ncalls = ncalls;
-			(*ev->ev_callback)((int)ev->ev_fd, ev->ev_res, ev->ev_arg);
-			if (base->event_break)
-				return;
+	while (!TAILQ_EMPTY(activeq)) {
+		if (budget && ncallbacks++ == budget)
+			return;
+		if (event_process_one(base, activeq) == -1)
+			return;
+	}
+}
+
+int
+event_base_priority_weights(struct event_base *base, const int *weights,
+    int budget)
+{
+	int *w = NULL, *deficit = NULL;
+	int i, res = -1;
+
+	EVBASE_ACQUIRE_LOCK(base);
+	if (budget < 0)
+		goto done;
+
+	if (weights != NULL) {
+		for (i = 0; i < base->nactivequeues; ++i)
+			if (weights[i] <= 0)
+				goto done;
+		w = mm_malloc(base->nactivequeues * sizeof(int),
+		    EVENT_MEM_EVENT);
+		deficit = mm_calloc(base->nactivequeues, sizeof(int),
+		    EVENT_MEM_EVENT);
+		if (w == NULL || deficit == NULL) {
+			event_warn("%s: malloc", __func__);
+			mm_free(w, EVENT_MEM_EVENT);
+			mm_free(deficit, EVENT_MEM_EVENT);
+			goto done;
 		}
+		memcpy(w, weights, base->nactivequeues * sizeof(int));
 	}
+
+	mm_free(base->sched_weights, EVENT_MEM_EVENT);
+	mm_free(base->sched_deficit, EVENT_MEM_EVENT);
+	base->sched_weights = w;
+	base->sched_deficit = deficit;
+	base->sched_current = 0;
+	base->sched_in_round = 0;
+	base->sched_budget = budget;
+	res = 0;
+
+ done:
+	EVBASE_RELEASE_LOCK(base);
+	return (res);
 }
 
 /*
@@ -443,7 +917,11 @@ event_base_loopbreak(struct event_base *event_base)
 	if (event_base == NULL)
 		return (-1);
 
+	EVBASE_ACQUIRE_LOCK(event_base);
 	event_base->event_break = 1;
+	if (EVBASE_NEED_NOTIFY(event_base))
+		evthread_notify_base(event_base);
+	EVBASE_RELEASE_LOCK(event_base);
 	return (0);
 }
 
@@ -464,12 +942,22 @@ event_base_loop(struct event_base *base, int flags)
 	void *evbase = base->evbase;
 	struct timeval tv;
 	struct timeval *tv_p;
-	int res, done;
+	int res, done, spinning, retval = 0;
+#ifdef USE_EVENT_STATS
+	ev_uint64_t start;
+#endif
 
-	/* clear time cache */
-	base->tv_cache.tv_sec = 0;
+	EVBASE_ACQUIRE_LOCK(base);
+	base->running_loop = 1;
+	base->busypolling = (flags & EVLOOP_BUSYPOLL) != 0;
+#ifdef HAVE_PTHREADS
+	base->th_owner_id = pthread_self();
+#endif
+
+	/* the polls of the backend keep this up to date from now on */
+	base->now_ns = event_clock_ns(base);
 
-	if (base->sig.ev_signal_added)
+	if (base->sig.ev_signal_added && base->sig.ev_signalfd == -1)
 		evsignal_base = base;
 	done = 0;
 	while (!done) {
@@ -487,7 +975,9 @@ event_base_loop(struct event_base *base, int flags)
 		timeout_correct(base, &tv);
 
 		tv_p = &tv;
-		if (!base->event_count_active && !(flags & EVLOOP_NONBLOCK)) {
+		if (!base->event_count_active && base->post_head == NULL &&
+		    base->deferred_head == NULL &&
+		    !(flags & EVLOOP_NONBLOCK)) {
 			timeout_next(base, &tv_p);
 		} else {
 			/* 
@@ -498,101 +988,560 @@ event_base_loop(struct event_base *base, int flags)
 		}
 		
 		/* If we have no events, we just exit */
-		if (!event_haveevents(base)) {
+		if (!event_haveevents(base) && base->post_head == NULL &&
+		    base->deferred_head == NULL) {
 			event_debug(("%s: no events registered.", __func__));
-			return (1);
+			retval = 1;
+			goto done;
 		}
 
 		/* update last old time */
 		gettime(base, &base->event_tv);
 
 		/* clear time cache */
-		base->tv_cache.tv_sec = 0;
+		base->now_ns = 0;
+
+		spinning = 0;
+		if (base->busypolling &&
+		    (tv_p == NULL || evutil_timerisset(tv_p))) {
+			if (event_busypoll_spin(base)) {
+				evutil_timerclear(&tv);
+				tv_p = &tv;
+				spinning = 1;
+			} else
+				base->busypoll_stats.sleeps++;
+		}
 
+		EVENT_TRACE(base, EVENT_TRACE_DISPATCH_BEGIN, NULL, -1, 0);
+#ifdef USE_EVENT_STATS
+		start = event_monotonic_ns();
+#endif
 		res = evsel->dispatch(base, evbase, tv_p);
+		EVENT_TRACE(base, EVENT_TRACE_DISPATCH_END, NULL, -1,
+		    base->event_count_active);
 
-		if (res == -1)
-			return (-1);
-		gettime(base, &base->tv_cache);
+		if (res == -1) {
+			retval = -1;
+			goto done;
+		}
+		base->now_ns = event_clock_ns(base);
+#ifdef USE_EVENT_STATS
+		/* the time of the loop is just as good, unless it is coarse */
+		base->stats.dispatch_ns +=
+		    (base->flags & EVENT_BASE_FLAG_COARSE_CLOCK ?
+			event_monotonic_ns() : base->now_ns) - start;
+		base->stats.iterations++;
+		base->stats_batch = 0;
+#endif
 
 		timeout_process(base);
 
+		if (base->busypolling) {
+			if (base->event_count_active ||
+			    base->post_head != NULL) {
+				gettime(base, &base->busypoll_last);
+				if (spinning)
+					base->busypoll_stats.spin_hits++;
+			} else if (spinning)
+				base->busypoll_stats.spin_misses++;
+		}
+
+		if (base->post_head != NULL)
+			event_process_posted(base);
+
 		if (base->event_count_active) {
 			event_process_active(base);
 			if (!base->event_count_active && (flags & EVLOOP_ONCE))
 				done = 1;
 		} else if (flags & EVLOOP_NONBLOCK)
 			done = 1;
-	}
 
-	/* clear time cache */
-	base->tv_cache.tv_sec = 0;
+		if (base->deferred_head != NULL)
+			event_process_deferred(base);
+#ifdef USE_EVENT_STATS
+		event_stats_batch(base);
+#endif
+	}
 
 	event_debug(("%s: asked to terminate loop.", __func__));
-	return (0);
-}
 
-/* Sets up an event for processing once */
+ done:
+	/* clear time cache */
+	base->now_ns = 0;
 
-struct event_once {
-	struct event ev;
+	base->running_loop = 0;
+	base->busypolling = 0;
+	EVBASE_RELEASE_LOCK(base);
+	return (retval);
+}
 
-	void (*cb)(int, short, void *);
-	void *arg;
-};
+/*
+ * A busy polling loop keeps dispatching without blocking for as long as it
+ * found work within the window.
+ */
+static int
+event_busypoll_spin(struct event_base *base)
+{
+	struct timeval idle;
 
-/* One-time callback, it deletes itself */
+	if (!evutil_timerisset(&base->busypoll_window))
+		return (0);
+	evutil_timersub(&base->event_tv, &base->busypoll_last, &idle);
+	return (evutil_timercmp(&idle, &base->busypoll_window, <));
+}
 
-static void
-event_once_cb(int fd, short events, void *arg)
+ev_uint64_t
+event_base_now(struct event_base *base)
 {
-	struct event_once *eonce = arg;
+	ev_uint64_t now;
 
-	(*eonce->cb)(fd, events, eonce->arg);
-	free(eonce);
+	EVBASE_ACQUIRE_LOCK(base);
+	if ((now = base->now_ns) == 0)
+		now = event_clock_ns(base);
+	EVBASE_RELEASE_LOCK(base);
+	return (now);
 }
 
-/* not threadsafe, event scheduled once. */
 int
-event_once(int fd, short events,
-    void (*callback)(int, short, void *), void *arg, const struct timeval *tv)
+event_base_gettimeofday_cached(struct event_base *base, struct timeval *tv)
 {
-	return event_base_once(current_base, fd, events, callback, arg, tv);
+	ev_uint64_t now, wall;
+
+	EVBASE_ACQUIRE_LOCK(base);
+	if ((now = base->now_ns) == 0)
+		now = event_clock_ns(base);
+	/* the offset to the wall clock follows its adjustments each second */
+	if (base->wall_offset_at == 0 ||
+	    (ev_int64_t)(now - base->wall_offset_at) >= 1000000000) {
+		evutil_gettimeofday(tv, NULL);
+		base->wall_offset_at = event_clock_ns(base);
+		base->wall_offset_ns = (ev_uint64_t)tv->tv_sec * 1000000000 +
+		    tv->tv_usec * 1000 - base->wall_offset_at;
+		now = base->wall_offset_at;
+	}
+	wall = now + base->wall_offset_ns;
+	EVBASE_RELEASE_LOCK(base);
+
+	tv->tv_sec = wall / 1000000000;
+	tv->tv_usec = (wall % 1000000000) / 1000;
+	return (0);
 }
 
-/* Schedules an event once */
 int
-event_base_once(struct event_base *base, int fd, short events,
-    void (*callback)(int, short, void *), void *arg, const struct timeval *tv)
+event_base_set_busypoll(struct event_base *base,
+    const struct timeval *window, int budget)
 {
-	struct event_once *eonce;
-	struct timeval etv;
-	int res;
-
-	/* We cannot support signals that just fire once */
-	if (events & EV_SIGNAL)
+	if (budget < 0 || (window != NULL &&
+	    (window->tv_sec < 0 || window->tv_usec < 0 ||
+	     window->tv_usec >= 1000000)))
 		return (-1);
 
-	if ((eonce = calloc(1, sizeof(struct event_once))) == NULL)
-		return (-1);
+	EVBASE_ACQUIRE_LOCK(base);
+	if (window != NULL)
+		base->busypoll_window = *window;
+	else
+		evutil_timerclear(&base->busypoll_window);
+	base->busypoll_budget = budget;
+	EVBASE_RELEASE_LOCK(base);
+	return (0);
+}
 
-	eonce->cb = callback;
-	eonce->arg = arg;
+void
+event_base_get_busypoll_stats(struct event_base *base,
+    struct event_busypoll_stats *stats)
+{
+	EVBASE_ACQUIRE_LOCK(base);
+	*stats = base->busypoll_stats;
+	EVBASE_RELEASE_LOCK(base);
+}
 
-	if (events == EV_TIMEOUT) {
-		if (tv == NULL) {
-			evutil_timerclear(&etv);
-			tv = &etv;
-		}
+#ifdef USE_EVENT_STATS
+/*
+ * Log-linear buckets: values below 8 have their own bucket, above that
+ * the three bits after the leading one select one of eight buckets per
+ * power of two.
+ */
+static int
+event_stats_bucket(ev_uint64_t ns)
+{
+	int msb, bucket;
+
+	if (ns < 8)
+		return ((int)ns);
+	msb = 63 - __builtin_clzll(ns);
+	bucket = (msb - 2) * 8 + (int)((ns >> (msb - 3)) & 7);
+	if (bucket >= EVENT_STATS_HIST_BUCKETS)
+		bucket = EVENT_STATS_HIST_BUCKETS - 1;
+	return (bucket);
+}
 
-		evtimer_set(&eonce->ev, event_once_cb, eonce);
-	} else if (events & (EV_READ|EV_WRITE)) {
-		events &= EV_READ|EV_WRITE;
+static void
+event_stats_callback(struct event_base *base, ev_uint64_t ns)
+{
+	base->stats.callbacks++;
+	base->stats.callback_ns += ns;
+	base->stats.callback_hist[event_stats_bucket(ns)]++;
+	base->stats_batch++;
+}
 
-		event_set(&eonce->ev, fd, events, event_once_cb, eonce);
-	} else {
+/* Accounts for the callbacks of the iteration that just ended */
+static void
+event_stats_batch(struct event_base *base)
+{
+	ev_uint64_t n = base->stats_batch;
+	int bucket = 0;
+
+	if (n > base->stats.max_callbacks)
+		base->stats.max_callbacks = n;
+	if (n)
+		bucket = 64 - __builtin_clzll(n);
+	if (bucket >= EVENT_STATS_BATCH_BUCKETS)
+		bucket = EVENT_STATS_BATCH_BUCKETS - 1;
+	base->stats.batch_hist[bucket]++;
+}
+#endif
+
+int
+event_base_get_stats(struct event_base *base, struct event_base_stats *stats)
+{
+#ifdef USE_EVENT_STATS
+	struct event *ev;
+	int i;
+
+	EVBASE_ACQUIRE_LOCK(base);
+	*stats = base->stats;
+	stats->npriorities = base->nactivequeues;
+	for (i = 0; i < base->nactivequeues && i < EVENT_STATS_PRIORITIES;
+	    ++i) {
+		stats->active[i] = 0;
+		TAILQ_FOREACH(ev, base->activequeues[i], ev_active_next)
+			stats->active[i]++;
+	}
+	stats->timers = timeout_store_size(base);
+	stats->stalls = base->wd_stalls;
+	EVBASE_RELEASE_LOCK(base);
+	return (0);
+#else
+	memset(stats, 0, sizeof(*stats));
+	return (-1);
+#endif
+}
+
+ev_uint64_t
+event_stats_bucket_ns(int bucket)
+{
+	if (bucket < 8)
+		return (bucket < 0 ? 0 : (ev_uint64_t)bucket);
+	return ((ev_uint64_t)(8 + bucket % 8) << (bucket / 8 - 1));
+}
+
+ev_uint64_t
+event_stats_percentile(const struct event_base_stats *stats,
+    double percentile)
+{
+	ev_uint64_t total = 0, rank, seen = 0;
+	int i;
+
+	for (i = 0; i < EVENT_STATS_HIST_BUCKETS; ++i)
+		total += stats->callback_hist[i];
+	if (total == 0)
+		return (0);
+
+	rank = (ev_uint64_t)(total * percentile / 100);
+	if (rank >= total)
+		rank = total - 1;
+	for (i = 0; i < EVENT_STATS_HIST_BUCKETS; ++i) {
+		seen += stats->callback_hist[i];
+		if (seen > rank)
+			break;
+	}
+	return (event_stats_bucket_ns(i + 1) - 1);
+}
+
+int
+event_base_post(struct event_base *base, void (*fn)(void *), void *arg)
+{
+	struct event_post_task *task, *head, *rest, *last;
+
+	/*
+	 * Recycled tasks are taken by swapping out the whole list and
+	 * putting back what is left: popping a single node with a
+	 * compare-and-swap could succeed on a node that another poster
+	 * took, ran and recycled in the meantime (ABA).
+	 */
+	if ((task = __sync_lock_test_and_set(&base->post_free, NULL)) != NULL) {
+		__sync_fetch_and_sub(&base->post_nfree, 1);
+		if ((rest = task->next) != NULL &&
+		    !__sync_bool_compare_and_swap(&base->post_free, NULL, rest)) {
+			for (last = rest; last->next != NULL; last = last->next)
+				;
+			do {
+				head = base->post_free;
+				last->next = head;
+			} while (!__sync_bool_compare_and_swap(&base->post_free,
+			    head, rest));
+		}
+	} else if ((task = mm_malloc(sizeof(struct event_post_task),
+	    EVENT_MEM_EVENT)) == NULL) {
+		event_warn("%s: malloc", __func__);
+		return (-1);
+	}
+	task->fn = fn;
+	task->arg = arg;
+
+	do {
+		head = base->post_head;
+		task->next = head;
+	} while (!__sync_bool_compare_and_swap(&base->post_head, head, task));
+
+	/*
+	 * Only the post that finds the queue empty wakes up the loop; the
+	 * others are picked up by the same drain.
+	 */
+	if (head == NULL && base->th_notify_fd[0] != -1)
+		return (evthread_notify_write(base));
+	return (0);
+}
+
+/* Runs all closures posted so far, in the order they were posted */
+static void
+event_process_posted(struct event_base *base)
+{
+	struct event_post_task *task, *next, *fifo = NULL;
+	struct event_post_task *done = NULL, *last = NULL, *head;
+	int nkeep, ndone = 0;
+
+	task = __sync_lock_test_and_set(&base->post_head, NULL);
+	for (; task != NULL; task = next) {
+		next = task->next;
+		task->next = fifo;
+		fifo = task;
+	}
+
+	EVBASE_RELEASE_LOCK(base);
+	nkeep = POST_FREE_MAX - base->post_nfree;
+	for (task = fifo; task != NULL; task = next) {
+		next = task->next;
+		(*task->fn)(task->arg);
+		if (ndone < nkeep) {
+			if (done == NULL)
+				last = task;
+			task->next = done;
+			done = task;
+			++ndone;
+		} else
+			mm_free(task, EVENT_MEM_EVENT);
+	}
+	EVBASE_ACQUIRE_LOCK(base);
+
+	if (done == NULL)
+		return;
+	__sync_fetch_and_add(&base->post_nfree, ndone);
+	do {
+		head = base->post_free;
+		last->next = head;
+	} while (!__sync_bool_compare_and_swap(&base->post_free, head, done));
+}
+
+void
+event_deferred_evbuffer(struct event_base *base, struct evbuffer *buf,
+    size_t oldoff)
+{
+	EVBASE_ACQUIRE_LOCK(base);
+	/* a queued callback covers this change as well */
+	if (buf->cb_pprev == NULL) {
+		buf->cb_orig_off = oldoff;
+		buf->cb_gen = base->deferred_gen;
+		buf->cb_next = NULL;
+		buf->cb_pprev = base->deferred_tail;
+		*base->deferred_tail = buf;
+		base->deferred_tail = &buf->cb_next;
+		if (EVBASE_NEED_NOTIFY(base))
+			evthread_notify_base(base);
+	}
+	EVBASE_RELEASE_LOCK(base);
+}
+
+void
+event_deferred_evbuffer_cancel(struct event_base *base, struct evbuffer *buf)
+{
+	EVBASE_ACQUIRE_LOCK(base);
+	if (buf->cb_pprev != NULL) {
+		*buf->cb_pprev = buf->cb_next;
+		if (buf->cb_next != NULL)
+			buf->cb_next->cb_pprev = buf->cb_pprev;
+		else
+			base->deferred_tail = buf->cb_pprev;
+		buf->cb_pprev = NULL;
+	}
+	EVBASE_RELEASE_LOCK(base);
+}
+
+/*
+ * Runs the callbacks of the evbuffers that changed before this iteration
+ * got here.  Buffers queued by these callbacks wait for the next one, the
+ * ones left over by a loopbreak are older and go first next time.
+ */
+static void
+event_process_deferred(struct event_base *base)
+{
+	struct evbuffer *buf;
+	unsigned int gen = base->deferred_gen++;
+	size_t orig_off;
+
+	while ((buf = base->deferred_head) != NULL &&
+	    (int)(buf->cb_gen - gen) <= 0) {
+		event_deferred_evbuffer_cancel(base, buf);
+		if (buf->cb == NULL)
+			continue;
+		orig_off = buf->cb_orig_off;
+
+		EVBASE_RELEASE_LOCK(base);
+		(*buf->cb)(buf, orig_off, buf->off, buf->cbarg);
+		EVBASE_ACQUIRE_LOCK(base);
+
+		if (base->event_break)
+			break;
+	}
+}
+
+#define EVENT_SLAB_NOBJS	64
+
+#ifdef _EVENT_COMPACT_EVENT
+/* puts the hot fields of every event into a single cache line */
+#define EVENT_SLAB_ALIGN	64
+#else
+#define EVENT_SLAB_ALIGN	sizeof(struct event_slab_page)
+#endif
+
+struct event_slab_page {
+	struct event_slab_page *next;
+	void *mem;			/* as allocated, before aligning */
+};
+
+static void
+event_slab_init(struct event_slab *slab, size_t size)
+{
+	slab->size = (size + EVENT_SLAB_ALIGN - 1) & ~(EVENT_SLAB_ALIGN - 1);
+	slab->freelist = NULL;
+	slab->pages = NULL;
+}
+
+/* Takes an object from the slab, the base has to be locked */
+static void *
+event_slab_alloc(struct event_slab *slab)
+{
+	struct event_slab_page *page;
+	char *obj, *mem;
+	int i;
+
+	if (slab->freelist == NULL) {
+		/*
+		 * the header takes the place of one object; the allocator
+		 * of event_set_mem_functions() need not align the page
+		 */
+		if ((mem = mm_malloc((EVENT_SLAB_NOBJS + 1) * slab->size +
+			    EVENT_SLAB_ALIGN - 1, EVENT_MEM_EVENT)) == NULL)
+			return (NULL);
+		page = (struct event_slab_page *)(mem + (EVENT_SLAB_ALIGN -
+			(size_t)mem % EVENT_SLAB_ALIGN) % EVENT_SLAB_ALIGN);
+		page->mem = mem;
+		page->next = slab->pages;
+		slab->pages = page;
+
+		/* thread the new objects so they are handed out in order */
+		obj = (char *)page + EVENT_SLAB_NOBJS * slab->size;
+		for (i = 0; i < EVENT_SLAB_NOBJS; ++i, obj -= slab->size) {
+			*(void **)obj = slab->freelist;
+			slab->freelist = obj;
+		}
+	}
+
+	obj = slab->freelist;
+	slab->freelist = *(void **)obj;
+	memset(obj, 0, slab->size);
+	return (obj);
+}
+
+static void
+event_slab_free(struct event_slab *slab, void *obj)
+{
+	*(void **)obj = slab->freelist;
+	slab->freelist = obj;
+}
+
+static void
+event_slab_dtor(struct event_slab *slab)
+{
+	struct event_slab_page *page;
+
+	while ((page = slab->pages) != NULL) {
+		slab->pages = page->next;
+		mm_free(page->mem, EVENT_MEM_EVENT);
+	}
+	slab->freelist = NULL;
+}
+
+/* One-time callback, it deletes itself */
+
+static void
+event_once_cb(int fd, short events, void *arg)
+{
+	struct event_once *eonce = arg;
+	struct event_base *base = eonce->ev.ev_base;
+
+	(*eonce->cb)(fd, events, eonce->arg);
+	EVBASE_ACQUIRE_LOCK(base);
+	event_slab_free(&base->once_slab, eonce);
+	EVBASE_RELEASE_LOCK(base);
+}
+
+/* not threadsafe, event scheduled once. */
+int
+event_once(int fd, short events,
+    void (*callback)(int, short, void *), void *arg, const struct timeval *tv)
+{
+	return event_base_once(current_base, fd, events, callback, arg, tv);
+}
+
+/* Schedules an event once */
+int
+event_base_once(struct event_base *base, int fd, short events,
+    void (*callback)(int, short, void *), void *arg, const struct timeval *tv)
+{
+	struct event_once *eonce;
+	struct timeval etv;
+	int res;
+
+	/* We cannot support signals that just fire once */
+	if (events & EV_SIGNAL)
+		return (-1);
+
+	EVBASE_ACQUIRE_LOCK(base);
+	eonce = event_slab_alloc(&base->once_slab);
+	EVBASE_RELEASE_LOCK(base);
+	if (eonce == NULL)
+		return (-1);
+
+	eonce->cb = callback;
+	eonce->arg = arg;
+
+	if (events == EV_TIMEOUT) {
+		if (tv == NULL) {
+			evutil_timerclear(&etv);
+			tv = &etv;
+		}
+
+		evtimer_set(&eonce->ev, event_once_cb, eonce);
+	} else if (events & (EV_READ|EV_WRITE)) {
+		events &= EV_READ|EV_WRITE;
+
+		event_set(&eonce->ev, fd, events, event_once_cb, eonce);
+	} else {
 		/* Bad event combination */
-		free(eonce);
+		EVBASE_ACQUIRE_LOCK(base);
+		event_slab_free(&base->once_slab, eonce);
+		EVBASE_RELEASE_LOCK(base);
 		return (-1);
 	}
 
@@ -600,13 +1549,45 @@ event_base_once(struct event_base *base, int fd, short events,
 	if (res == 0)
 		res = event_add(&eonce->ev, tv);
 	if (res != 0) {
-		free(eonce);
+		EVBASE_ACQUIRE_LOCK(base);
+		event_slab_free(&base->once_slab, eonce);
+		EVBASE_RELEASE_LOCK(base);
 		return (res);
 	}
 
 	return (0);
 }
 
+struct event *
+event_new(struct event_base *base, int fd, short events,
+    void (*callback)(int, short, void *), void *arg)
+{
+	struct event *ev;
+
+	EVBASE_ACQUIRE_LOCK(base);
+	ev = event_slab_alloc(&base->ev_slab);
+	EVBASE_RELEASE_LOCK(base);
+	if (ev == NULL) {
+		event_warn("%s: malloc", __func__);
+		return (NULL);
+	}
+
+	event_set(ev, fd, events, callback, arg);
+	event_base_set(base, ev);
+	return (ev);
+}
+
+void
+event_free(struct event *ev)
+{
+	struct event_base *base = ev->ev_base;
+
+	EVBASE_ACQUIRE_LOCK(base);
+	event_del_nolock(ev);
+	event_slab_free(&base->ev_slab, ev);
+	EVBASE_RELEASE_LOCK(base);
+}
+
 void
 event_set(struct event *ev, int fd, short events,
 	  void (*callback)(int, short, void *), void *arg)
@@ -622,6 +1603,7 @@ event_set(struct event *ev, int fd, short events,
 	ev->ev_flags = EVLIST_INIT;
 	ev->ev_ncalls = 0;
 	ev->ev_pncalls = NULL;
+	evutil_timerclear(&ev->ev_interval);
 
 	min_heap_elem_init(ev);
 
@@ -671,6 +1653,7 @@ event_pending(struct event *ev, short event, struct timeval *tv)
 	struct timeval	now, res;
 	int flags = 0;
 
+	EVBASE_ACQUIRE_LOCK(ev->ev_base);
 	if (ev->ev_flags & EVLIST_INSERTED)
 		flags |= (ev->ev_events & (EV_READ|EV_WRITE|EV_SIGNAL));
 	if (ev->ev_flags & EVLIST_ACTIVE)
@@ -688,12 +1671,28 @@ event_pending(struct event *ev, short event, struct timeval *tv)
 		evutil_gettimeofday(&now, NULL);
 		evutil_timeradd(&now, &res, tv);
 	}
+	EVBASE_RELEASE_LOCK(ev->ev_base);
 
 	return (flags & event);
 }
 
 int
 event_add(struct event *ev, const struct timeval *tv)
+{
+	struct event_base *base = ev->ev_base;
+	int res;
+
+	EVBASE_ACQUIRE_LOCK(base);
+	EVENT_TRACE(base, EVENT_TRACE_ADD, ev->ev_callback, ev->ev_fd,
+	    ev->ev_events);
+	res = event_add_nolock(ev, tv);
+	EVBASE_RELEASE_LOCK(base);
+
+	return (res);
+}
+
+int
+event_add_nolock(struct event *ev, const struct timeval *tv)
 {
 	struct event_base *base = ev->ev_base;
 	const struct eventop *evsel = base->evsel;
@@ -715,8 +1714,7 @@ event_add(struct event *ev, const struct timeval *tv)
 	 * failure on any step, we should not change any state.
 	 */
 	if (tv != NULL && !(ev->ev_flags & EVLIST_TIMEOUT)) {
-		if (min_heap_reserve(&base->timeheap,
-			1 + min_heap_size(&base->timeheap)) == -1)
+		if (timeout_store_reserve(base) == -1)
 			return (-1);  /* ENOMEM == errno */
 	}
 
@@ -749,7 +1747,7 @@ event_add(struct event *ev, const struct timeval *tv)
 			/* See if we are just active executing this
 			 * event in a loop
 			 */
-			if (ev->ev_ncalls && ev->ev_pncalls) {
+			if (base->current_event == ev) {
 				/* Abort loop */
 				*ev->ev_pncalls = 0;
 			}
@@ -760,6 +1758,17 @@ event_add(struct event *ev, const struct timeval *tv)
 		gettime(base, &now);
 		evutil_timeradd(&now, tv, &ev->ev_timeout);
 
+		/*
+		 * Only pure timers are periodic, a timeout on an fd or a
+		 * signal still ends the event.  A zero period would fire in
+		 * every loop iteration.
+		 */
+		if ((ev->ev_events & (EV_PERSIST|EV_READ|EV_WRITE|EV_SIGNAL)) ==
+		    EV_PERSIST && evutil_timerisset(tv))
+			ev->ev_interval = *tv;
+		else
+			evutil_timerclear(&ev->ev_interval);
+
 		event_debug((
 			 "event_add: timeout in %ld seconds, call %p",
 			 tv->tv_sec, ev->ev_callback));
@@ -767,13 +1776,60 @@ event_add(struct event *ev, const struct timeval *tv)
 		event_queue_insert(base, ev, EVLIST_TIMEOUT);
 	}
 
+	/* the loop has to pick up the new fd or timeout */
+	if (res != -1 && EVBASE_NEED_NOTIFY(base))
+		evthread_notify_base(base);
+
 	return (res);
 }
 
+#ifdef HAVE_PTHREADS
+/*
+ * Waits for the loop thread to return from the callback of ev.  The
+ * caller may hold the base lock more than once; all holds are given up
+ * while waiting and taken again afterwards.
+ */
+static void
+event_wait_current(struct event_base *base, struct event *ev)
+{
+	int depth = base->th_lock_depth, i;
+
+	for (i = 1; i < depth; i++)
+		pthread_mutex_unlock(base->th_base_lock);
+	base->th_lock_depth = 0;
+	while (base->current_event == ev) {
+		base->th_current_waiters++;
+		pthread_cond_wait(&base->th_current_cond, base->th_base_lock);
+	}
+	for (i = 1; i < depth; i++)
+		pthread_mutex_lock(base->th_base_lock);
+	base->th_lock_depth = depth;
+}
+#endif
+
 int
 event_del(struct event *ev)
+{
+	int res;
+
+	/* An event without a base has not been added */
+	if (ev->ev_base == NULL)
+		return (-1);
+
+	EVBASE_ACQUIRE_LOCK(ev->ev_base);
+	EVENT_TRACE(ev->ev_base, EVENT_TRACE_DEL, ev->ev_callback, ev->ev_fd,
+	    ev->ev_events);
+	res = event_del_nolock(ev);
+	EVBASE_RELEASE_LOCK(ev->ev_base);
+
+	return (res);
+}
+
+int
+event_del_nolock(struct event *ev)
 {
 	struct event_base *base;
+	int res = 0;
 
 	event_debug(("event_del: %p, callback %p",
 		 ev, ev->ev_callback));
@@ -787,11 +1843,20 @@ event_del(struct event *ev)
 	assert(!(ev->ev_flags & ~EVLIST_ALL));
 
 	/* See if we are just active executing this event in a loop */
-	if (ev->ev_ncalls && ev->ev_pncalls) {
+	if (base->current_event == ev) {
 		/* Abort loop */
 		*ev->ev_pncalls = 0;
 	}
 
+#ifdef HAVE_PTHREADS
+	/*
+	 * If the loop runs the callback of ev in another thread, wait for
+	 * it to return so that the caller may free ev and its argument.
+	 */
+	if (base->current_event == ev && EVBASE_NEED_NOTIFY(base))
+		event_wait_current(base, ev);
+#endif
+
 	if (ev->ev_flags & EVLIST_TIMEOUT)
 		event_queue_remove(base, ev, EVLIST_TIMEOUT);
 
@@ -800,14 +1865,33 @@ event_del(struct event *ev)
 
 	if (ev->ev_flags & EVLIST_INSERTED) {
 		event_queue_remove(base, ev, EVLIST_INSERTED);
-		return (base->evsel->del(base->evbase, ev));
+		res = base->evsel->del(base->evbase, ev);
 	}
 
-	return (0);
+	if (res != -1 && EVBASE_NEED_NOTIFY(base))
+		evthread_notify_base(base);
+
+	return (res);
 }
 
 void
 event_active(struct event *ev, int res, short ncalls)
+{
+	struct event_base *base = ev->ev_base;
+
+	EVBASE_ACQUIRE_LOCK(base);
+	event_active_nolock(base, ev, res, ncalls);
+	EVBASE_RELEASE_LOCK(base);
+}
+
+/*
+ * The base is passed in by the caller, which has it at hand, so that
+ * activating an event only touches the fields that come first in the
+ * compact struct event.
+ */
+void
+event_active_nolock(struct event_base *base, struct event *ev, int res,
+    short ncalls)
 {
 	/* We get different kinds of events, add them together */
 	if (ev->ev_flags & EVLIST_ACTIVE) {
@@ -817,32 +1901,42 @@ event_active(struct event *ev, int res, short ncalls)
 
 	ev->ev_res = res;
 	ev->ev_ncalls = ncalls;
-	ev->ev_pncalls = NULL;
-	event_queue_insert(ev->ev_base, ev, EVLIST_ACTIVE);
+	event_queue_insert(base, ev, EVLIST_ACTIVE);
+
+	if (EVBASE_NEED_NOTIFY(base))
+		evthread_notify_base(base);
 }
 
 static int
 timeout_next(struct event_base *base, struct timeval **tv_p)
 {
-	struct timeval now;
+	struct timeval now, deadline;
 	struct event *ev;
 	struct timeval *tv = *tv_p;
 
-	if ((ev = min_heap_top(&base->timeheap)) == NULL) {
-		/* if no time-based events are active wait for I/O */
-		*tv_p = NULL;
-		return (0);
+	if (base->timer_method == EVENT_TIMER_WHEEL) {
+		if (timer_wheel_next(base->timewheel, &deadline) == -1) {
+			*tv_p = NULL;
+			return (0);
+		}
+	} else {
+		if ((ev = timeout_store_top(base)) == NULL) {
+			/* if no time-based events are active wait for I/O */
+			*tv_p = NULL;
+			return (0);
+		}
+		deadline = ev->ev_timeout;
 	}
 
 	if (gettime(base, &now) == -1)
 		return (-1);
 
-	if (evutil_timercmp(&ev->ev_timeout, &now, <=)) {
+	if (evutil_timercmp(&deadline, &now, <=)) {
 		evutil_timerclear(tv);
 		return (0);
 	}
 
-	evutil_timersub(&ev->ev_timeout, &now, tv);
+	evutil_timersub(&deadline, &now, tv);
 
 	assert(tv->tv_sec >= 0);
 	assert(tv->tv_usec >= 0);
@@ -888,6 +1982,23 @@ timeout_correct(struct event_base *base, struct timeval *tv)
 		struct timeval *ev_tv = &(**pev).ev_timeout;
 		evutil_timersub(ev_tv, &off, ev_tv);
 	}
+	/* keys move along with the deadlines, the order stays the same */
+	for (size = 0; size < base->timeheap4.n; ++size) {
+		struct min_heap4_entry *x = &base->timeheap4.p[size];
+		evutil_timersub(&x->ev->ev_timeout, &off, &x->ev->ev_timeout);
+		x->key = min_heap4_key(&x->ev->ev_timeout);
+	}
+	if (base->timewheel != NULL) {
+		struct timer_wheel *w = base->timewheel;
+		for (size = TW_NHEADS; size < w->a; ++size) {
+			struct event *ev = w->nodes[size].ev;
+			if (ev != NULL)
+				evutil_timersub(&ev->ev_timeout, &off,
+				    &ev->ev_timeout);
+		}
+		/* the slots depend on the deadlines */
+		timer_wheel_rebuild(w, tv);
+	}
 	/* Now remember what the new time turned out to be. */
 	base->event_tv = *tv;
 }
@@ -898,22 +2009,132 @@ timeout_process(struct event_base *base)
 	struct timeval now;
 	struct event *ev;
 
-	if (min_heap_empty(&base->timeheap))
+	if (timeout_store_empty(base))
 		return;
 
 	gettime(base, &now);
 
-	while ((ev = min_heap_top(&base->timeheap))) {
+	if (base->timer_method == EVENT_TIMER_WHEEL) {
+		timer_wheel_expire(base->timewheel, &now);
+		while ((ev = timer_wheel_first_due(base->timewheel))) {
+			if (evutil_timerisset(&ev->ev_interval))
+				timeout_reschedule(base, ev, &now);
+			else
+				event_del_nolock(ev);
+			event_active_nolock(base, ev, EV_TIMEOUT, 1);
+			EVENT_TRACE(base, EVENT_TRACE_TIMER, ev->ev_callback,
+			    ev->ev_fd, EV_TIMEOUT);
+		}
+		return;
+	}
+
+	while ((ev = timeout_store_top(base))) {
 		if (evutil_timercmp(&ev->ev_timeout, &now, >))
 			break;
 
-		/* delete this event from the I/O queues */
-		event_del(ev);
+		if (evutil_timerisset(&ev->ev_interval))
+			timeout_reschedule(base, ev, &now);
+		else
+			/* delete this event from the I/O queues */
+			event_del_nolock(ev);
 
 		event_debug(("timeout_process: call %p",
 			 ev->ev_callback));
-		event_active(ev, EV_TIMEOUT, 1);
+		event_active_nolock(base, ev, EV_TIMEOUT, 1);
+		EVENT_TRACE(base, EVENT_TRACE_TIMER, ev->ev_callback,
+		    ev->ev_fd, EV_TIMEOUT);
+	}
+}
+
+/*
+ * Moves the deadline of a periodic timeout one period ahead.  Deadlines
+ * advance from the previous deadline, not from now, so that they do not
+ * drift; periods that were missed entirely are skipped.
+ */
+static void
+timeout_reschedule(struct event_base *base, struct event *ev,
+    struct timeval *now)
+{
+	struct timeval next, late;
+	ev_uint64_t interval, skip;
+
+	evutil_timeradd(&ev->ev_timeout, &ev->ev_interval, &next);
+	if (evutil_timercmp(&next, now, <=)) {
+		evutil_timersub(now, &next, &late);
+		interval = (ev_uint64_t)ev->ev_interval.tv_sec * 1000000 +
+		    ev->ev_interval.tv_usec;
+		skip = ((ev_uint64_t)late.tv_sec * 1000000 + late.tv_usec) /
+		    interval + 1;
+		skip *= interval;
+		late.tv_sec = (long)(skip / 1000000);
+		late.tv_usec = (long)(skip % 1000000);
+		evutil_timeradd(&next, &late, &next);
 	}
+
+	event_queue_remove(base, ev, EVLIST_TIMEOUT);
+	ev->ev_timeout = next;
+	event_queue_insert(base, ev, EVLIST_TIMEOUT);
+}
+
+/*
+ * EVENT_BASE_FLAG_GROUP_CALLBACKS: every active queue has a small direct
+ * mapped table from callbacks to the last active event with that
+ * callback, and an event that becomes active goes right behind it.  A
+ * callback that collides with another one in the table takes over the
+ * slot and starts a new group at the end of the queue.  So does an event
+ * that becomes active once its group has started to run; it would
+ * otherwise go ahead of the rest of the queue, and a callback that keeps
+ * activating events with itself would starve it.
+ */
+static struct event_group_slot *
+event_group_slot(struct event_base *base, struct event *ev)
+{
+	unsigned long h = (unsigned long)ev->ev_callback;
+
+	h = (h >> 4) ^ (h >> 10);
+	return (&base->group_slots[ev->ev_pri * EVENT_GROUP_SLOTS +
+		h % EVENT_GROUP_SLOTS]);
+}
+
+static void
+event_group_insert(struct event_base *base, struct event *ev)
+{
+	struct event_list *activeq = base->activequeues[ev->ev_pri];
+	struct event_group_slot *slot = event_group_slot(base, ev);
+
+	if (slot->tail != NULL && slot->callback == ev->ev_callback) {
+		TAILQ_INSERT_AFTER(activeq, slot->tail, ev, ev_active_next);
+	} else {
+		TAILQ_INSERT_TAIL(activeq, ev, ev_active_next);
+		slot->callback = ev->ev_callback;
+	}
+	slot->tail = ev;
+}
+
+/* Called when the callback of ev is about to run */
+static void
+event_group_close(struct event_base *base, struct event *ev)
+{
+	struct event_group_slot *slot = event_group_slot(base, ev);
+
+	if (slot->callback == ev->ev_callback)
+		slot->tail = NULL;
+}
+
+/* Called before ev is taken off its active queue */
+static void
+event_group_remove(struct event_base *base, struct event *ev)
+{
+	struct event_group_slot *slot = event_group_slot(base, ev);
+	struct event *prev;
+
+	if (slot->tail != ev)
+		return;
+	prev = TAILQ_PREV(ev, event_list, ev_active_next);
+	if (prev != NULL && prev->ev_callback == ev->ev_callback)
+		slot->tail = prev;
+	else
+		slot->tail = NULL;
 }
 
 void
@@ -933,11 +2154,13 @@ event_queue_remove(struct event_base *base, struct event *ev, int queue)
 		break;
 	case EVLIST_ACTIVE:
 		base->event_count_active--;
+		if (base->group_slots != NULL)
+			event_group_remove(base, ev);
 		TAILQ_REMOVE(base->activequeues[ev->ev_pri],
 		    ev, ev_active_next);
 		break;
 	case EVLIST_TIMEOUT:
-		min_heap_erase(&base->timeheap, ev);
+		timeout_store_erase(base, ev);
 		break;
 	default:
 		event_errx(1, "%s: unknown queue %x", __func__, queue);
@@ -966,11 +2189,14 @@ event_queue_insert(struct event_base *base, struct event *ev, int queue)
 		break;
 	case EVLIST_ACTIVE:
 		base->event_count_active++;
-		TAILQ_INSERT_TAIL(base->activequeues[ev->ev_pri],
-		    ev,ev_active_next);
+		if (base->group_slots != NULL)
+			event_group_insert(base, ev);
+		else
+			TAILQ_INSERT_TAIL(base->activequeues[ev->ev_pri],
+			    ev,ev_active_next);
 		break;
 	case EVLIST_TIMEOUT: {
-		min_heap_push(&base->timeheap, ev);
+		timeout_store_push(base, ev);
 		break;
 	}
 	default:
@@ -978,6 +2204,157 @@ event_queue_insert(struct event_base *base, struct event *ev, int queue)
 	}
 }
 
+/*
+ * The timer store keeps the events that are on EVLIST_TIMEOUT, either in
+ * the min-heap or in the timing wheel.
+ */
+
+int
+event_base_set_timer_method(struct event_base *base, int method,
+    const struct timeval *tick)
+{
+	struct timer_wheel *w = NULL;
+	ev_uint64_t tick_usec = 1000;
+	struct timeval now;
+	int res = -1;
+
+	EVBASE_ACQUIRE_LOCK(base);
+	/* the timers cannot be moved between stores */
+	if (!timeout_store_empty(base))
+		goto done;
+
+	switch (method) {
+	case EVENT_TIMER_HEAP:
+	case EVENT_TIMER_HEAP4:
+		break;
+	case EVENT_TIMER_WHEEL:
+		if (tick != NULL) {
+			tick_usec = (ev_uint64_t)tick->tv_sec * 1000000 +
+			    tick->tv_usec;
+			if (tick->tv_sec < 0 || tick->tv_usec < 0 ||
+			    tick_usec == 0)
+				goto done;
+		}
+		if ((w = mm_malloc(sizeof(struct timer_wheel),
+		    EVENT_MEM_EVENT)) == NULL) {
+			event_warn("%s: malloc", __func__);
+			goto done;
+		}
+		gettime(base, &now);
+		if (timer_wheel_ctor(w, tick_usec, &now) == -1) {
+			event_warn("%s: malloc", __func__);
+			mm_free(w, EVENT_MEM_EVENT);
+			goto done;
+		}
+		break;
+	default:
+		goto done;
+	}
+
+	if (base->timewheel != NULL) {
+		timer_wheel_dtor(base->timewheel);
+		mm_free(base->timewheel, EVENT_MEM_EVENT);
+	}
+	base->timewheel = w;
+	base->timer_method = method;
+	res = 0;
+
+ done:
+	EVBASE_RELEASE_LOCK(base);
+	return (res);
+}
+
+static int
+timeout_store_reserve(struct event_base *base)
+{
+	switch (base->timer_method) {
+	case EVENT_TIMER_WHEEL:
+		return (timer_wheel_reserve(base->timewheel,
+			1 + timer_wheel_size(base->timewheel)));
+	case EVENT_TIMER_HEAP4:
+		return (min_heap4_reserve(&base->timeheap4,
+			1 + min_heap4_size(&base->timeheap4)));
+	default:
+		return (min_heap_reserve(&base->timeheap,
+			1 + min_heap_size(&base->timeheap)));
+	}
+}
+
+static void
+timeout_store_push(struct event_base *base, struct event *ev)
+{
+	switch (base->timer_method) {
+	case EVENT_TIMER_WHEEL:
+		timer_wheel_push(base->timewheel, ev);
+		break;
+	case EVENT_TIMER_HEAP4:
+		min_heap4_push(&base->timeheap4, ev);
+		break;
+	default:
+		min_heap_push(&base->timeheap, ev);
+	}
+}
+
+static void
+timeout_store_erase(struct event_base *base, struct event *ev)
+{
+	switch (base->timer_method) {
+	case EVENT_TIMER_WHEEL:
+		timer_wheel_erase(base->timewheel, ev);
+		break;
+	case EVENT_TIMER_HEAP4:
+		min_heap4_erase(&base->timeheap4, ev);
+		break;
+	default:
+		min_heap_erase(&base->timeheap, ev);
+	}
+}
+
+static int
+timeout_store_empty(struct event_base *base)
+{
+	switch (base->timer_method) {
+	case EVENT_TIMER_WHEEL:
+		return (timer_wheel_empty(base->timewheel));
+	case EVENT_TIMER_HEAP4:
+		return (min_heap4_empty(&base->timeheap4));
+	default:
+		return (min_heap_empty(&base->timeheap));
+	}
+}
+
+#ifdef USE_EVENT_STATS
+static unsigned
+timeout_store_size(struct event_base *base)
+{
+	switch (base->timer_method) {
+	case EVENT_TIMER_WHEEL:
+		return (timer_wheel_size(base->timewheel));
+	case EVENT_TIMER_HEAP4:
+		return (min_heap4_size(&base->timeheap4));
+	default:
+		return (min_heap_size(&base->timeheap));
+	}
+}
+#endif
+
+/*
+ * The timer with the earliest deadline; for the timing wheel, which is
+ * not sorted, just any of its timers.
+ */
+static struct event *
+timeout_store_top(struct event_base *base)
+{
+	switch (base->timer_method) {
+	case EVENT_TIMER_WHEEL:
+		return (timer_wheel_any(base->timewheel));
+	case EVENT_TIMER_HEAP4:
+		return (min_heap4_top(&base->timeheap4));
+	default:
+		return (min_heap_top(&base->timeheap));
+	}
+}
+
 /* Functions for debugging */
 
 const char *
@@ -986,6 +2363,12 @@ event_get_version(void)
 	return (VERSION);
 }
 
+int
+event_get_abi_version(void)
+{
+	return (_EVENT_ABI_VERSION);
+}
+
 /* 
  * No thread-safe interface needed - the information should be the same
  * for all threads.
@@ -996,3 +2379,83 @@ event_get_method(void)
 {
 	return (current_base->evsel->name);
 }
+
+/* Allocation, see event_set_mem_functions() */
+
+static void *(*mm_malloc_fn)(size_t, int);
+static void *(*mm_realloc_fn)(void *, size_t, int);
+static void (*mm_free_fn)(void *, int);
+
+int
+event_set_mem_functions(void *(*malloc_fn)(size_t, int),
+    void *(*realloc_fn)(void *, size_t, int), void (*free_fn)(void *, int))
+{
+	if ((malloc_fn == NULL) != (realloc_fn == NULL) ||
+	    (malloc_fn == NULL) != (free_fn == NULL)) {
+		event_warnx("%s: all functions or none have to be given",
+		    __func__);
+		return (-1);
+	}
+
+	mm_malloc_fn = malloc_fn;
+	mm_realloc_fn = realloc_fn;
+	mm_free_fn = free_fn;
+	return (0);
+}
+
+void *
+event_mm_malloc_(size_t sz, int tag)
+{
+	if (mm_malloc_fn != NULL)
+		return (mm_malloc_fn(sz, tag));
+	return (malloc(sz));
+}
+
+void *
+event_mm_calloc_(size_t count, size_t size, int tag)
+{
+	void *p;
+
+	if (mm_malloc_fn == NULL)
+		return (calloc(count, size));
+
+	if (size != 0 && count > (size_t)-1 / size) {
+		errno = ENOMEM;
+		return (NULL);
+	}
+	if ((p = mm_malloc_fn(count * size, tag)) != NULL)
+		memset(p, 0, count * size);
+	return (p);
+}
+
+char *
+event_mm_strdup_(const char *str, int tag)
+{
+	size_t len;
+	char *p;
+
+	if (mm_malloc_fn == NULL)
+		return (strdup(str));
+
+	len = strlen(str) + 1;
+	if ((p = mm_malloc_fn(len, tag)) != NULL)
+		memcpy(p, str, len);
+	return (p);
+}
+
+void *
+event_mm_realloc_(void *ptr, size_t sz, int tag)
+{
+	if (mm_realloc_fn != NULL)
+		return (mm_realloc_fn(ptr, sz, tag));
+	return (realloc(ptr, sz));
+}
+
+void
+event_mm_free_(void *ptr, int tag)
+{
+	if (mm_free_fn == NULL)
+		free(ptr);
+	else if (ptr != NULL)
+		mm_free_fn(ptr, tag);
+}
@@ -41,11 +41,11 @@
   servers. An application just needs to call event_dispatch() and then add or
   remove events dynamically without having to change the event loop.
 
-  Currently, libevent supports /dev/poll, kqueue(2), select(2), poll(2) and
-  epoll(4). It also has experimental support for real-time signals. The
-  internal event mechanism is completely independent of the exposed event API,
-  and a simple update of libevent can provide new functionality without having
-  to redesign the applications. As a result, Libevent allows for portable
+  Currently, libevent supports /dev/poll, kqueue(2), select(2), poll(2),
+  epoll(4) and io_uring(7). It also has experimental support for real-time
+  signals. The internal event mechanism is completely independent of the
+  exposed event API, and a simple update of libevent can provide new
+  functionality without having to redesign the applications. As a result, Libevent allows for portable
   application development and provides the most scalable event notification
   mechanism available on an operating system. Libevent can also be used for
   multi-threaded aplications; see Steven Grimm's explanation. Libevent should
@@ -197,6 +197,7 @@ typedef unsigned short u_short;
 #define EV_WRITE	0x04
 #define EV_SIGNAL	0x08
 #define EV_PERSIST	0x10	/* Persistant event */
+#define EV_ET		0x20	/* Edge-triggered, epoll and io_uring */
 
 /* Fix so that ppl dont have to run with <sys/queue.h> */
 #ifndef TAILQ_ENTRY
@@ -210,6 +211,38 @@ struct {								\
 
 struct event_base;
 #ifndef EVENT_NO_STRUCT
+#ifdef _EVENT_COMPACT_EVENT
+/*
+ * The fields used for every dispatched event come first and take 64 bytes
+ * on LP64, a single cache line when the event is aligned to it: the links
+ * of the active queue and of the other events on the same fd, the
+ * callback and its argument, the fd and the flags.  The backends and the
+ * loop pass the base along, so it follows with the links of the other
+ * queues and the timeout bookkeeping.
+ */
+struct event {
+	TAILQ_ENTRY (event) ev_active_next;
+	TAILQ_ENTRY (event) ev_io_next;	/* events on the same fd */
+	void (*ev_callback)(int, short, void *arg);
+	void *ev_arg;
+
+	int ev_fd;
+	int ev_flags;
+	short ev_events;
+	short ev_ncalls;
+	short ev_res;		/* result passed to event callback */
+	short ev_pri;		/* smaller numbers are higher priority */
+
+	struct event_base *ev_base;
+	short *ev_pncalls;	/* Allows deletes in callback */
+	TAILQ_ENTRY (event) ev_next;
+	TAILQ_ENTRY (event) ev_signal_next;
+	unsigned int min_heap_idx;	/* for managing timeouts */
+
+	struct timeval ev_timeout;
+	struct timeval ev_interval;	/* period of a persistent timeout */
+};
+#else
 struct event {
 	TAILQ_ENTRY (event) ev_next;
 	TAILQ_ENTRY (event) ev_active_next;
@@ -224,6 +257,7 @@ struct event {
 	short *ev_pncalls;	/* Allows deletes in callback */
 
 	struct timeval ev_timeout;
+	struct timeval ev_interval;	/* period of a persistent timeout */
 
 	int ev_pri;		/* smaller numbers are higher priority */
 
@@ -233,10 +267,23 @@ struct event {
 	int ev_res;		/* result passed to event callback */
 	int ev_flags;
 };
+#endif
 #else
 struct event;
 #endif
 
+/*
+ * Applications and the library have to agree on the layout of struct
+ * event; compare with event_get_abi_version().  A version is never
+ * reused: 1 is the layout of libevent 1.4 without ev_interval, 2 and 3
+ * are earlier compact layouts.
+ */
+#ifdef _EVENT_COMPACT_EVENT
+#define _EVENT_ABI_VERSION	4
+#else
+#define _EVENT_ABI_VERSION	5
+#endif
+
 #define EVENT_SIGNAL(ev)	(int)(ev)->ev_fd
 #define EVENT_FD(ev)		(int)(ev)->ev_fd
 
@@ -272,6 +319,98 @@ TAILQ_HEAD (evkeyvalq, evkeyval);
  */
 struct event_base *event_base_new(void);
 
+/** Protect the event base with a lock so that other threads may use it */
+#define EVENT_BASE_FLAG_LOCKING	0x01
+/**
+  Wait for timeouts with microsecond precision instead of rounding them up
+  to milliseconds.  The epoll backend uses epoll_pwait2() when the kernel
+  has it and a timerfd otherwise; the io_uring backend is always precise
+  and other backends ignore this flag.
+ */
+#define EVENT_BASE_FLAG_PRECISE_TIMER	0x02
+/**
+  Let the epoll backend collect the changes to the set of watched fds and
+  hand only the net changes to the kernel right before it waits, instead
+  of calling epoll_ctl() on every event_add() and event_del().  An event
+  that is deleted and added again within one loop iteration costs no
+  syscall at all.  The io_uring backend always works this way; other
+  backends ignore this flag.
+ */
+#define EVENT_BASE_FLAG_EPOLL_CHANGELIST	0x04
+/**
+  Queue an event that becomes active right behind the other active events
+  with the same callback, and prefetch the next event and its argument
+  while a callback runs.  When the backend returns many events for
+  different kinds of handlers this runs each handler for a whole group
+  and keeps its code in the instruction cache instead of alternating
+  between them.  Callbacks still run in priority order, but within a
+  priority no longer in the order their events became active.  Events
+  that become active while their group runs go to the end of the queue.
+ */
+#define EVENT_BASE_FLAG_GROUP_CALLBACKS	0x08
+/**
+  Keep the time of the loop with CLOCK_MONOTONIC_COARSE, which is cheaper
+  to read but only advances with the timer interrupt, every one to ten
+  milliseconds.  Timeouts are then no more precise than that.  Where the
+  coarse clock is not available the base uses CLOCK_MONOTONIC.
+ */
+#define EVENT_BASE_FLAG_COARSE_CLOCK	0x10
+/**
+  Read the signals of the base from a signalfd instead of catching them
+  with a signal handler, see signal_add().  Setting the EVENT_SIGNALFD
+  environment variable has the same effect.  This is only safe when the
+  program blocks the signals it watches in all of its threads.
+ */
+#define EVENT_BASE_FLAG_SIGNALFD	0x20
+
+/**
+  Initialize a new event base with creation flags.
+
+  Without flags this is the same as event_base_new().  With
+  EVENT_BASE_FLAG_LOCKING the base is protected by a lock, and
+  event_add(), event_del(), event_active() and event_base_loopbreak() may
+  be called from any thread, even while another thread is running the
+  loop.  A loop blocked in the backend is woken up through an eventfd (or
+  a socketpair where eventfd is not available) so that the change takes
+  effect right away.  The lock is released while callbacks run.
+
+  @param flags any combination of the EVENT_BASE_FLAG_* values
+  @return a new event base, or NULL if an error occurred
+  @see event_base_new(), event_base_free()
+ */
+struct event_base *event_base_new_with_flags(int flags);
+
+/** Keep timers in a binary min-heap; the default */
+#define EVENT_TIMER_HEAP	0
+/** Keep timers in a hierarchical timing wheel */
+#define EVENT_TIMER_WHEEL	1
+/** Keep timers in a 4-ary min-heap with the deadlines stored inline */
+#define EVENT_TIMER_HEAP4	2
+
+/**
+  Select how an event base keeps track of its timeouts.
+
+  The min-heap costs O(log n) for every event_add() and event_del() of an
+  event with a timeout and fires timers exactly.  The timing wheel adds
+  and removes timers in O(1), which pays off with many long timeouts that
+  are rescheduled more often than they fire, such as idle timeouts on a
+  large number of connections.  Its timers are rounded up to a multiple
+  of the tick, so they fire up to one tick late.  The 4-ary heap orders
+  timers like the min-heap but keeps the deadlines in the heap array, so
+  sifting does not touch the events; it is faster once the heap no longer
+  fits in the cache.
+
+  The method can only be changed while no timeouts are pending on base.
+
+  @param base the event_base to configure
+  @param method EVENT_TIMER_HEAP, EVENT_TIMER_HEAP4 or EVENT_TIMER_WHEEL
+  @param tick the granularity of the timing wheel, or NULL for one
+         millisecond; ignored for the min-heap
+  @return 0 if successful, or -1 if an error occurred
+ */
+int event_base_set_timer_method(struct event_base *base, int method,
+    const struct timeval *tick);
+
 /**
   Initialize the event API.
 
@@ -350,6 +489,42 @@ typedef void (*event_log_cb)(int severity, const char *msg);
   */
 void event_set_log_callback(event_log_cb cb);
 
+/* The subsystems of the library, passed with every allocation */
+#define EVENT_MEM_EVENT		0	/* bases, events and the backends */
+#define EVENT_MEM_BUFFER	1	/* evbuffers and bufferevents */
+#define EVENT_MEM_HTTP		2	/* evhttp, its connections and requests */
+#define EVENT_MEM_DNS		3	/* evdns */
+#define EVENT_MEM_RPC		4	/* evrpc */
+
+/**
+  Replace the functions that libevent allocates memory with.
+
+  Every allocation of the library goes through malloc_fn and realloc_fn
+  together with an EVENT_MEM_* tag naming the subsystem it is for, so an
+  allocator can keep a pool per subsystem.  Memory is released through
+  free_fn with the tag it was allocated with; free_fn is never called for
+  NULL.  realloc_fn gets NULL for a first allocation like realloc().  The
+  functions may be called from any thread that uses the library.
+
+  Memory that is handed to the caller to release with free(), like the
+  lines of evbuffer_readline() and the strings of evhttp_encode_uri(),
+  evhttp_decode_uri() and evhttp_htmlescape(), still comes from malloc().
+  So do the objects that the EVRPC_* macros allocate in the application.
+
+  This has to be called before any other function of the library, since
+  memory allocated before the change would be released with the new
+  functions.
+
+  @param malloc_fn the replacement for malloc()
+  @param realloc_fn the replacement for realloc()
+  @param free_fn the replacement for free()
+  @return 0 if successful, or -1 if only some of the functions are NULL;
+    all three NULL restores the functions of the C library
+ */
+int event_set_mem_functions(void *(*malloc_fn)(size_t sz, int tag),
+    void *(*realloc_fn)(void *ptr, size_t sz, int tag),
+    void (*free_fn)(void *ptr, int tag));
+
 /**
   Associate a different event base with an event.
 
@@ -364,6 +539,8 @@ int event_base_set(struct event_base *, struct event *);
 /*@{*/
 #define EVLOOP_ONCE	0x01	/**< Block at most once. */
 #define EVLOOP_NONBLOCK	0x02	/**< Do not block. */
+#define EVLOOP_BUSYPOLL	0x04	/**< Spin before blocking, see
+				     event_base_set_busypoll(). */
 /*@}*/
 
 /**
@@ -371,7 +548,8 @@ int event_base_set(struct event_base *, struct event *);
 
   This is a more flexible version of event_dispatch().
 
-  @param flags any combination of EVLOOP_ONCE | EVLOOP_NONBLOCK
+  @param flags any combination of EVLOOP_ONCE | EVLOOP_NONBLOCK |
+         EVLOOP_BUSYPOLL
   @return 0 if successful, -1 if an error occurred, or 1 if no events were
     registered.
   @see event_loopexit(), event_base_loop()
@@ -384,13 +562,242 @@ int event_loop(int);
   This is a more flexible version of event_base_dispatch().
 
   @param eb the event_base structure returned by event_init()
-  @param flags any combination of EVLOOP_ONCE | EVLOOP_NONBLOCK
+  @param flags any combination of EVLOOP_ONCE | EVLOOP_NONBLOCK |
+         EVLOOP_BUSYPOLL
   @return 0 if successful, -1 if an error occurred, or 1 if no events were
     registered.
   @see event_loopexit(), event_base_loop()
   */
 int event_base_loop(struct event_base *, int);
 
+/**
+  Configure the EVLOOP_BUSYPOLL mode of event_base_loop().
+
+  A loop that sleeps in the backend pays for the wakeup whenever an event
+  arrives.  With EVLOOP_BUSYPOLL the loop instead keeps polling the
+  backend without blocking for as long as it found work within the last
+  window, and only blocks once it has been idle for longer.  This trades a
+  busy CPU for lower latency.  By default the window is 50 microseconds.
+
+  While spinning at most budget callbacks run per loop iteration, so that
+  a steady stream of active events never delays the timeouts.  The smaller
+  of this budget and the one of event_base_priority_weights() applies.
+  The default is 64.
+
+  @param eb the event_base structure returned by event_init()
+  @param window how long to spin after the last activity, or NULL to never
+         spin
+  @param budget the maximum number of callbacks per spinning iteration, or
+         0 for no limit
+  @return 0 if successful, or -1 if an error occurred
+  @see event_base_loop(), event_base_get_busypoll_stats()
+ */
+int event_base_set_busypoll(struct event_base *eb,
+    const struct timeval *window, int budget);
+
+/** Counters of the EVLOOP_BUSYPOLL mode */
+struct event_busypoll_stats {
+	unsigned long spin_hits;	/**< polls without blocking that found work */
+	unsigned long spin_misses;	/**< polls without blocking that found none */
+	unsigned long sleeps;		/**< polls that were allowed to block */
+};
+
+/**
+  Get the counters of the EVLOOP_BUSYPOLL mode.
+
+  The counters accumulate over all loops that ran with EVLOOP_BUSYPOLL.
+  Polls that do not block because events are already active are not
+  counted.
+
+  @param eb the event_base structure returned by event_init()
+  @param stats filled in with the counters
+  @see event_base_set_busypoll()
+ */
+void event_base_get_busypoll_stats(struct event_base *eb,
+    struct event_busypoll_stats *stats);
+
+/**
+  Get the time of the event loop.
+
+  The loop reads its monotonic clock once after every poll of the
+  backend; timeouts, the statistics and callbacks all see that time.
+  This is much cheaper than asking the system for the time and, within
+  one iteration of the loop, always returns the same value.  Outside the
+  loop the clock is read.
+
+  @param eb the event_base structure returned by event_init()
+  @return the time of the loop in nanoseconds since some unspecified
+         starting point
+  @see event_base_gettimeofday_cached()
+ */
+ev_uint64_t event_base_now(struct event_base *eb);
+
+/**
+  Get the wall clock time of the event loop.
+
+  Like event_base_now(), but as the time of day: the offset from the clock
+  of the loop to gettimeofday() is taken at most once a second.
+
+  @param eb the event_base structure returned by event_init()
+  @param tv filled in with the time
+  @return 0 if successful, or -1 if an error occurred
+  @see event_base_now()
+ */
+int event_base_gettimeofday_cached(struct event_base *eb,
+    struct timeval *tv);
+
+/** Number of active queues event_base_get_stats() reports on */
+#define EVENT_STATS_PRIORITIES		16
+/** Buckets of the callback histogram, see event_stats_bucket_ns() */
+#define EVENT_STATS_HIST_BUCKETS	328
+/** Buckets of the callbacks per iteration histogram */
+#define EVENT_STATS_BATCH_BUCKETS	20
+
+/** Statistics on the health of an event loop */
+struct event_base_stats {
+	ev_uint64_t iterations;		/**< polls of the backend */
+	ev_uint64_t dispatch_ns;	/**< time in the backend, waiting included */
+	ev_uint64_t callback_ns;	/**< time in event callbacks */
+	ev_uint64_t callbacks;		/**< event callbacks run */
+	ev_uint64_t max_callbacks;	/**< most callbacks run by one iteration */
+
+	int npriorities;		/**< active queues of the base */
+	int active[EVENT_STATS_PRIORITIES];	/**< events waiting on each */
+	int timers;			/**< events with a pending timeout */
+	ev_uint64_t stalls;		/**< callbacks the watchdog reported */
+
+	/**
+	  Callback durations.  Bucket b counts callbacks that took from
+	  event_stats_bucket_ns(b) up to event_stats_bucket_ns(b + 1)
+	  nanoseconds.  Each power of two is split into eight buckets, so
+	  the resolution is 12.5% from 8 ns to over two hours.
+	 */
+	ev_uint64_t callback_hist[EVENT_STATS_HIST_BUCKETS];
+	/**
+	  Callbacks per iteration.  Bucket 0 counts iterations that ran
+	  none, bucket b those that ran from 2^(b-1) to 2^b - 1; the last
+	  bucket takes all larger ones.
+	 */
+	ev_uint64_t batch_hist[EVENT_STATS_BATCH_BUCKETS];
+};
+
+/**
+  Get the statistics of an event_base.
+
+  The counters accumulate over the lifetime of the base; take two
+  snapshots and subtract them to look at an interval.  The depths of the
+  active queues and the number of timers describe the base at the time of
+  the call.  Only the first EVENT_STATS_PRIORITIES active queues are
+  reported.
+
+  Collecting costs two reads of the monotonic clock per callback and one
+  per poll of the backend, which shares the read that updates the time of
+  the loop, see event_base_now().  The counters are updated by the thread
+  running the loop without taking the lock of the base, so a snapshot
+  taken from another thread may be slightly inconsistent.  Collection is
+  compiled in with USE_EVENT_STATS.
+
+  @param eb the event_base structure returned by event_init()
+  @param stats filled in with the statistics
+  @return 0 if successful, or -1 if the library was built without
+         statistics
+  @see event_stats_percentile()
+ */
+int event_base_get_stats(struct event_base *eb,
+    struct event_base_stats *stats);
+
+/**
+  Watch for callbacks that block the loop.
+
+  A watchdog thread checks on the loop of the base and reports every
+  callback that has been running for longer than threshold; it notices
+  after between one and one and a half times the threshold.  The report
+  names the callback, its file descriptor and the events it was called
+  for, followed by the stack of the loop thread, symbolized where
+  dladdr() finds the symbols and as offsets into the shared objects
+  otherwise.  Reports go to the log callback of event_set_log_callback()
+  as warnings and are counted in the stalls of event_base_get_stats().
+
+  The stack is taken by interrupting the loop thread with SIGURG, so
+  system calls of a stalled callback that cannot be restarted fail with
+  EINTR.  Every stalled callback is reported once, however long it runs.
+
+  @param eb the event_base structure returned by event_init()
+  @param threshold how long a callback may run, or NULL to stop watching
+  @return 0 if successful, or -1 if an error occurred
+  @see event_base_get_stats()
+ */
+int event_base_set_watchdog(struct event_base *eb,
+    const struct timeval *threshold);
+
+/**
+  The lower bound of a bucket of the callback histogram.
+
+  @param bucket a bucket from 0 to EVENT_STATS_HIST_BUCKETS
+  @return the shortest duration counted in the bucket, in nanoseconds
+ */
+ev_uint64_t event_stats_bucket_ns(int bucket);
+
+/**
+  Estimate a percentile of the callback durations.
+
+  @param stats statistics filled in by event_base_get_stats()
+  @param percentile the percentile, from 0 to 100
+  @return the upper bound of the bucket holding the percentile, in
+         nanoseconds, or 0 if no callback has run
+ */
+ev_uint64_t event_stats_percentile(const struct event_base_stats *stats,
+    double percentile);
+
+struct evbuffer;
+
+/**
+  Start recording a trace of the event loop.
+
+  The trace is a ring of records, of the polls of the backend with the
+  number of events they made active, of every callback with its file
+  descriptor and the events it was called for, of expired timeouts and of
+  the calls to event_add() and event_del().  Once the ring is full the
+  oldest records are overwritten, so it always holds the recent past for
+  when something has gone wrong.  Recording takes a read of the cycle
+  counter and a few stores per record.
+
+  Starting again clears the ring.
+
+  @param eb the event_base structure returned by event_init()
+  @param nrecords the size of the ring, rounded up to a power of two
+  @return 0 if successful, or -1 if an error occurred
+  @see event_base_trace_stop(), event_base_trace_dump()
+ */
+int event_base_trace_start(struct event_base *eb, int nrecords);
+
+/**
+  Stop recording the trace of the event loop.
+
+  The records are kept for event_base_trace_dump().
+
+  @param eb the event_base structure returned by event_init()
+  @see event_base_trace_start()
+ */
+void event_base_trace_stop(struct event_base *eb);
+
+/**
+  Write the trace of the event loop as JSON in the Trace Event Format,
+  which chrome://tracing and Perfetto load.
+
+  Polls of the backend and callbacks become durations, with the callbacks
+  named after their symbol where dladdr() finds it.  Expired timeouts and
+  calls to event_add() and event_del() become instant events.  Times are
+  in microseconds of the monotonic clock.  A trace can be dumped while it
+  is still being recorded.
+
+  @param eb the event_base structure returned by event_init()
+  @param buf the buffer the JSON is appended to
+  @return 0 if successful, or -1 if there is no trace or an error occurred
+  @see event_base_trace_start()
+ */
+int event_base_trace_dump(struct event_base *eb, struct evbuffer *buf);
+
 /**
   Exit the event loop after the specified time.
 
@@ -446,6 +853,9 @@ int event_loopbreak(void);
 
   Subsequent invocations of event_loop() will proceed normally.
 
+  If the base was created with EVENT_BASE_FLAG_LOCKING, this may be called
+  from another thread and wakes up the loop.
+
   @param eb the event_base structure returned by event_init()
   @return 0 if successful, or -1 if an error occurred
   @see event_base_loopexit
@@ -510,6 +920,21 @@ int event_base_loopbreak(struct event_base *);
 #define timeout_pending(ev, tv)		event_pending(ev, EV_TIMEOUT, tv)
 #define timeout_initialized(ev)		((ev)->ev_flags & EVLIST_INIT)
 
+/**
+  Signal events.
+
+  Signals are caught with a signal handler, and only one base at a time
+  can watch signals.  On Linux a base created with
+  EVENT_BASE_FLAG_SIGNALFD reads its signals from its own signalfd
+  instead, so several bases can watch signals at the same time.  A signal
+  only reaches a signalfd while it is blocked: adding the first event for
+  a signal blocks it in the calling thread, and a program with more
+  threads has to block the signals it watches in all of them, for example
+  before it starts the threads.  Otherwise the kernel delivers the signal
+  to another thread, where its default action applies.  Deleting the last
+  event unblocks the signal again if it is deleted in the thread that
+  added the first.
+ */
 #define signal_add(ev, tv)		event_add(ev, tv)
 #define signal_set(ev, x, cb, arg)	\
 	event_set(ev, x, EV_SIGNAL|EV_PERSIST, cb, arg)
@@ -532,7 +957,15 @@ int event_base_loopbreak(struct event_base *);
   The function fn will be called with the file descriptor that triggered the
   event and the type of event which will be either EV_TIMEOUT, EV_SIGNAL,
   EV_READ, or EV_WRITE.  The additional flag EV_PERSIST makes an event_add()
-  persistent until event_del() has been called.
+  persistent until event_del() has been called.  A persistent timer, one
+  without EV_READ, EV_WRITE or EV_SIGNAL, that is added with a timeout
+  becomes periodic; see event_add().
+
+  The flag EV_ET asks for edge-triggered notification: the callback only
+  runs when new data arrives or new buffer space becomes free, so it has
+  to read or write until the operation would block.  Only the epoll and
+  io_uring backends support it; with other backends, and when other events
+  on the same fd are level-triggered, event_add() fails.
 
   @param ev an event struct to be modified
   @param fd the file descriptor to be monitored
@@ -545,6 +978,40 @@ int event_base_loopbreak(struct event_base *);
  */
 void event_set(struct event *, int, short, void (*)(int, short, void *), void *);
 
+/**
+  Allocate and prepare an event.
+
+  The event is set up as by event_set() and event_base_set().  It comes
+  from a cache of the base, so creating and freeing short-lived events
+  does not go to malloc and live events sit next to each other in
+  memory.
+
+  The event has to be released with event_free(); events that are still
+  allocated when the base is freed are released with it.
+
+  @param base the event_base the event belongs to
+  @param fd the file descriptor to be monitored
+  @param events desired events to monitor, as for event_set()
+  @param callback callback function to be invoked when the event occurs
+  @param arg an argument to be passed to the callback function
+  @return the new event, or NULL if an error occurred
+  @see event_free(), event_set()
+ */
+struct event *event_new(struct event_base *base, int fd, short events,
+    void (*callback)(int, short, void *), void *arg);
+
+/**
+  Delete and release an event from event_new().
+
+  This may be called from the callback of the event itself.  Called from
+  another thread while the loop runs the callback, it waits for the
+  callback to return, see event_del().
+
+  @param ev an event returned by event_new()
+  @see event_new()
+ */
+void event_free(struct event *ev);
+
 /**
   Schedule a one-time event to occur.
 
@@ -572,7 +1039,8 @@ int event_once(int, short, void (*)(int, short, void *), void *,
 
   The function event_base_once() is similar to event_set().  However, it
   schedules a callback to be called exactly once and does not require the
-  caller to prepare an event structure.
+  caller to prepare an event structure.  The event is taken from the same
+  cache as event_new() uses.
 
   @param base an event_base returned by event_init()
   @param fd a file descriptor to monitor
@@ -590,6 +1058,32 @@ int event_base_once(struct event_base *base, int fd, short events,
     const struct timeval *timeout);
 
 
+/**
+  Run a function on the thread of an event loop.
+
+  The function is queued on a lock-free list and called by
+  event_base_loop() once per loop iteration, after the I/O backend
+  returned.  Functions run in the order they were posted.  Any number of
+  threads may post at the same time without taking a lock; only the post
+  that finds the queue empty writes to the notification fd, so a burst of
+  posts costs a single wakeup.  The loop hands the memory of functions
+  that ran back to later posts, so a steady stream of posts does not
+  allocate.
+
+  Waking up a loop blocked in the backend requires a base created with
+  EVENT_BASE_FLAG_LOCKING; on other bases posted functions only run once
+  the loop wakes up for another reason.  Functions still queued when the
+  base is freed are discarded.
+
+  @param base the event_base whose loop runs fn
+  @param fn the function to call
+  @param arg an argument to be passed to fn
+  @return 0 if successful, or -1 if an error occurred
+  @see event_base_new_with_flags()
+ */
+int event_base_post(struct event_base *base, void (*fn)(void *), void *arg);
+
+
 /**
   Add an event to the set of monitored events.
 
@@ -602,6 +1096,22 @@ int event_base_once(struct event_base *base, int fd, short events,
   event_del().  If the event in the ev argument already has a scheduled
   timeout, the old timeout will be replaced by the new one.
 
+  If the event was set with EV_PERSIST and none of EV_READ, EV_WRITE and
+  EV_SIGNAL, as with event_set(ev, -1, EV_PERSIST, ...), the timeout is
+  periodic: when it expires, the event is rescheduled at the previous
+  deadline plus tv without calling event_add() again, so the period does
+  not drift.  If the loop fell behind by more than a period, the missed
+  periods are coalesced into a single callback.  For any other event the
+  timeout removes the event, persistent or not, as if by event_del().
+
+  If the event's base was created with EVENT_BASE_FLAG_LOCKING, the event
+  may be added from any thread.
+
+  With the epoll backend any number of events may wait on the same file
+  descriptor, and all of them run when it becomes ready.  The other
+  backends keep one read and one write event per file descriptor, so a
+  second one replaces the first.
+
   @param ev an event struct initialized via event_set()
   @param timeout the maximum amount of time to wait for the event, or NULL
          to wait forever
@@ -618,12 +1128,28 @@ int event_add(struct event *ev, const struct timeval *timeout);
   event has already executed or has never been added the call will have no
   effect.
 
+  With EVENT_BASE_FLAG_LOCKING, a call from another thread while the loop
+  runs the callback of the event waits for the callback to return, so the
+  event and its argument may be released afterwards.  The callback must
+  therefore not wait for a thread that deletes its own event.
+
   @param ev an event struct to be removed from the working set
   @return 0 if successful, or -1 if an error occurred
   @see event_add()
  */
 int event_del(struct event *);
 
+/**
+  Make an event active.
+
+  The callback of ev is run by the event loop as if the events in res had
+  occurred.  If the event's base was created with EVENT_BASE_FLAG_LOCKING,
+  this may be called from any thread.
+
+  @param ev an event struct to make active
+  @param res the set of flags to pass to the callback
+  @param ncalls the number of times the callback is run
+ */
 void event_active(struct event *, int, short);
 
 
@@ -666,6 +1192,19 @@ int event_pending(struct event *ev, short event, struct timeval *tv);
 const char *event_get_version(void);
 
 
+/**
+  Get the layout of struct event the library was built with.
+
+  Building with _EVENT_COMPACT_EVENT, which is off by default, reorders
+  struct event, so an application compiled with a different setting than
+  the library would access the wrong fields.  An application can
+  check for this at startup.
+
+  @return the _EVENT_ABI_VERSION of the library
+ */
+int event_get_abi_version(void);
+
+
 /**
   Get the kernel event notification mechanism used by libevent.
 
@@ -710,6 +1249,37 @@ int	event_priority_init(int);
 int	event_base_priority_init(struct event_base *, int);
 
 
+/**
+  Share the loop between the priorities by weight.
+
+  With strict priorities a busy queue starves all queues of a lower
+  priority, and a burst of active events delays the next check for I/O.
+  With weights the active queues are serviced in deficit round robin
+  order: on its turn every queue may run as many callbacks as its weight,
+  plus what it could not use on its last turn while it stayed busy.  A
+  queue with weight 4 thus gets four times as many callbacks as one with
+  weight 1 while both are busy, and no busy queue is starved.
+
+  The budget limits the number of callbacks that run per loop iteration
+  in either mode.  Once it is used up, the loop checks for new I/O and
+  timeouts without blocking before it runs the remaining callbacks, which
+  bounds the delay for a socket of high priority.
+
+  The weights are dropped by event_base_priority_init(), so they have to
+  be set after it.
+
+  @param eb the event_base structure returned by event_init()
+  @param weights one positive weight for each priority, or NULL to go back
+         to strict priorities
+  @param budget the maximum number of callbacks per loop iteration, or 0
+         for no limit
+  @return 0 if successful, or -1 if an error occurred
+  @see event_base_priority_init(), event_priority_set()
+ */
+int	event_base_priority_weights(struct event_base *eb, const int *weights,
+    int budget);
+
+
 /**
   Assign a priority to an event.
 
@@ -733,6 +1303,13 @@ struct evbuffer {
 
 	void (*cb)(struct evbuffer *, size_t, size_t, void *);
 	void *cbarg;
+
+	/* deferred callbacks, see evbuffer_defer_callbacks() */
+	struct event_base *cb_base;
+	struct evbuffer *cb_next;	/* on the queue of cb_base */
+	struct evbuffer **cb_pprev;	/* NULL unless queued */
+	size_t cb_orig_off;		/* length before the queued changes */
+	unsigned int cb_gen;		/* loop iteration it was queued in */
 };
 
 /* Just for error reporting - use other constants otherwise */
@@ -773,6 +1350,7 @@ struct bufferevent {
 	int timeout_write;	/* in seconds */
 
 	short enabled;	/* events that are currently enabled */
+	short read_pending;	/* eof or error after data, not yet reported */
 };
 #endif
 
@@ -813,6 +1391,42 @@ struct bufferevent {
 struct bufferevent *bufferevent_new(int fd,
     evbuffercb readcb, evbuffercb writecb, everrorcb errorcb, void *cbarg);
 
+/**
+  Create a new bufferevent that does its I/O with io_uring requests.
+
+  A bufferevent from bufferevent_new() waits for the socket to become
+  readable and then calls read(), which takes two trips into the kernel
+  per chunk of data.  This one keeps a receive request in the kernel while
+  reading is enabled; the data arrives in a buffer of the base and is
+  copied to the input buffer.  Writing hands the head of the output buffer
+  to a send request, and the output buffer is drained as it completes.
+  Requests go to the kernel together with the next wait of the loop.
+
+  The bufferevent is used exactly like one from bufferevent_new(), with
+  the same callbacks, watermarks and timeouts, except that it is bound to
+  base and cannot be moved with bufferevent_base_set().  EV_ET has no
+  meaning here and is ignored.  After bufferevent_free() the memory is
+  released once the kernel is done with the requests in flight.
+
+  @param base the event base, which must use the io_uring backend; it is
+         only chosen when epoll is turned off with EVENT_NOEPOLL
+  @param fd the socket to read from and write to
+  @param readcb callback to invoke when there is data to be read, or NULL if
+         no callback is desired
+  @param writecb callback to invoke when the file descriptor is ready for
+         writing, or NULL if no callback is desired
+  @param errorcb callback to invoke when there is an error on the file
+         descriptor
+  @param cbarg an argument that will be supplied to each of the callbacks
+         (readcb, writecb, and errorcb)
+  @return a pointer to a newly allocated bufferevent struct, or NULL with
+          errno set to EOPNOTSUPP if the base does not use io_uring or the
+          kernel has no provided buffer rings (Linux 5.19)
+  @see bufferevent_new(), event_base_get_method()
+  */
+struct bufferevent *bufferevent_uring_new(struct event_base *base, int fd,
+    evbuffercb readcb, evbuffercb writecb, everrorcb errorcb, void *cbarg);
+
 
 /**
   Assign a bufferevent to a specific event_base.
@@ -912,8 +1526,13 @@ size_t bufferevent_read(struct bufferevent *bufev, void *data, size_t size);
 /**
   Enable a bufferevent.
 
+  With EV_ET the bufferevent switches to edge-triggered notification and
+  reads and writes until the socket would block each time it is woken up;
+  this needs the epoll or io_uring backend.  bufferevent_disable() with EV_ET switches
+  back to level-triggered notification.
+
   @param bufev the bufferevent to be enabled
-  @param event any combination of EV_READ | EV_WRITE.
+  @param event any combination of EV_READ | EV_WRITE | EV_ET.
   @return 0 if successful, or -1 if an error occurred
   @see bufferevent_disable()
  */
@@ -924,7 +1543,7 @@ int bufferevent_enable(struct bufferevent *bufev, short event);
   Disable a bufferevent.
 
   @param bufev the bufferevent to be disabled
-  @param event any combination of EV_READ | EV_WRITE.
+  @param event any combination of EV_READ | EV_WRITE | EV_ET.
   @return 0 if successful, or -1 if an error occurred
   @see bufferevent_enable()
  */
@@ -1154,6 +1773,32 @@ u_char *evbuffer_find(struct evbuffer *, const u_char *, size_t);
  */
 void evbuffer_setcb(struct evbuffer *, void (*)(struct evbuffer *, size_t, size_t, void *), void *);
 
+/**
+  Run the callback of an evbuffer from the event loop.
+
+  By default the callback runs inside every function that modifies the
+  buffer.  A callback that writes to another buffer can thus trigger a
+  chain of callbacks, and it may run while the code that modified the
+  buffer is still in the middle of its own work.  With deferred callbacks,
+  a modification only queues the buffer on the base.  event_base_loop()
+  runs the queued callbacks after the active events.  All modifications
+  within one loop iteration are reported by a single callback, which sees
+  the length from before the first of them.
+
+  The buffers of a bufferevent always use deferred callbacks, on the base
+  that runs its events: the current base for bufferevent_new(), or the one
+  given to bufferevent_base_set().  They are only run synchronously when
+  bufferevent_new() is called before there is a current base and the
+  bufferevent is never assigned one.
+
+  @param buffer the evbuffer whose callback is to be deferred
+  @param base the event_base whose loop runs the callback, or NULL to run
+         it right away again
+  @see evbuffer_setcb()
+ */
+void evbuffer_defer_callbacks(struct evbuffer *buffer,
+    struct event_base *base);
+
 /*
  * Marshaling tagged data - We assume that all tags are inserted in their
  * numeric order - so that unknown tags will always be higher than the
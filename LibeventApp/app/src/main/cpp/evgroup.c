@@ -0,0 +1,514 @@
+/*
+ * Copyright (c) 2026 The LibeventApp authors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#if defined(HAVE_SCHED_SETAFFINITY) && !defined(_GNU_SOURCE)
+/* cpu_set_t and sched_setaffinity() are GNU extensions */
+#define _GNU_SOURCE
+#endif
+
+#include <sys/types.h>
+#ifdef HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+#include <sys/queue.h>
+#ifdef HAVE_SYS_SOCKET_H
+#include <sys/socket.h>
+#endif
+#include <netinet/in.h>
+#include <netdb.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+#endif
+#ifdef HAVE_SCHED_SETAFFINITY
+#include <sched.h>
+#endif
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "event.h"
+#include "evgroup.h"
+#include "evutil.h"
+#include "log.h"
+#include "mm-internal.h"
+
+struct evgroup_listener {
+	TAILQ_ENTRY(evgroup_listener) next;
+
+	struct event listen_ev;
+	struct event_base *base;
+
+	evgroup_accept_cb cb;
+	void *cbarg;
+};
+
+TAILQ_HEAD(evgroup_listenerq, evgroup_listener);
+
+struct evgroup_shard {
+	struct event_base *base;
+	int cpu;			/* -1 if not pinned */
+
+	/* written by evgroup_stop() to break out of the loop */
+	int wake_pair[2];
+	struct event wake_ev;
+
+	struct evgroup_listenerq listeners;
+
+#ifdef HAVE_PTHREADS
+	pthread_t thread;
+#endif
+	int thread_started;
+};
+
+struct evgroup {
+	struct evgroup_shard *shards;
+	int nshards;
+
+	int started;
+	int joined;
+};
+
+static void evgroup_shard_free(struct evgroup_shard *);
+static void evgroup_join(struct evgroup *);
+
+/* Runs on the shard's thread when evgroup_stop() wrote to the wake pair */
+static void
+evgroup_wake_cb(int fd, short what, void *arg)
+{
+	struct evgroup_shard *shard = arg;
+	char buf[16];
+
+	while (recv(fd, buf, sizeof(buf), 0) > 0)
+		;
+
+	event_base_loopbreak(shard->base);
+}
+
+static void
+evgroup_accept_socket(int fd, short what, void *arg)
+{
+	struct evgroup_listener *listener = arg;
+	struct sockaddr_storage ss;
+	socklen_t addrlen;
+	int nfd;
+
+	/* Accept everything that is pending; it all stays on this shard */
+	for (;;) {
+		addrlen = sizeof(ss);
+		if ((nfd = accept(fd, (struct sockaddr *)&ss, &addrlen)) == -1) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				event_warn("%s: bad accept", __func__);
+			return;
+		}
+		if (evutil_make_socket_nonblocking(nfd) < 0) {
+			EVUTIL_CLOSESOCKET(nfd);
+			continue;
+		}
+
+		(*listener->cb)(listener->base, nfd,
+		    (struct sockaddr *)&ss, (int)addrlen, listener->cbarg);
+	}
+}
+
+struct evgroup *
+evgroup_new(int nbases)
+{
+	struct evgroup *group;
+	int i;
+
+	if (nbases <= 0)
+		return (NULL);
+
+	if ((group = mm_calloc(1, sizeof(struct evgroup),
+	    EVENT_MEM_EVENT)) == NULL) {
+		event_warn("%s: calloc", __func__);
+		return (NULL);
+	}
+
+	group->shards = mm_calloc(nbases, sizeof(struct evgroup_shard),
+	    EVENT_MEM_EVENT);
+	if (group->shards == NULL) {
+		event_warn("%s: calloc", __func__);
+		mm_free(group, EVENT_MEM_EVENT);
+		return (NULL);
+	}
+
+	for (i = 0; i < nbases; ++i) {
+		struct evgroup_shard *shard = &group->shards[i];
+
+		shard->cpu = -1;
+		shard->wake_pair[0] = shard->wake_pair[1] = -1;
+		TAILQ_INIT(&shard->listeners);
+
+		if ((shard->base = event_base_new()) == NULL)
+			goto error;
+		group->nshards++;
+
+		if (evutil_socketpair(
+			    AF_UNIX, SOCK_STREAM, 0, shard->wake_pair) == -1) {
+			event_warn("%s: socketpair", __func__);
+			goto error;
+		}
+		evutil_make_socket_nonblocking(shard->wake_pair[0]);
+		evutil_make_socket_nonblocking(shard->wake_pair[1]);
+
+		/*
+		 * The wake event is a regular event on purpose: it keeps
+		 * the loop of a shard without listeners alive until the
+		 * group is stopped.
+		 */
+		event_set(&shard->wake_ev, shard->wake_pair[1],
+		    EV_READ | EV_PERSIST, evgroup_wake_cb, shard);
+		event_base_set(shard->base, &shard->wake_ev);
+		if (event_add(&shard->wake_ev, NULL) == -1)
+			goto error;
+	}
+
+	return (group);
+
+ error:
+	for (i = 0; i < group->nshards; ++i)
+		evgroup_shard_free(&group->shards[i]);
+	mm_free(group->shards, EVENT_MEM_EVENT);
+	mm_free(group, EVENT_MEM_EVENT);
+	return (NULL);
+}
+
+int
+evgroup_size(struct evgroup *group)
+{
+	return (group->nshards);
+}
+
+struct event_base *
+evgroup_get_base(struct evgroup *group, int idx)
+{
+	if (idx < 0 || idx >= group->nshards)
+		return (NULL);
+
+	return (group->shards[idx].base);
+}
+
+int
+evgroup_set_cpu(struct evgroup *group, int idx, int cpu)
+{
+	if (idx < 0 || idx >= group->nshards || group->started)
+		return (-1);
+
+	group->shards[idx].cpu = cpu < 0 ? -1 : cpu;
+	return (0);
+}
+
+/*
+ * Creates a non-blocking listening socket.  *reuseport is cleared if the
+ * kernel refused SO_REUSEPORT, in which case the caller has to share the
+ * socket between the shards.
+ */
+static int
+evgroup_listen_socket(struct addrinfo *ai, int *reuseport)
+{
+	int fd, serrno;
+
+	if ((fd = socket(ai->ai_family, ai->ai_socktype,
+		    ai->ai_protocol)) == -1) {
+		event_warn("socket");
+		return (-1);
+	}
+
+	if (evutil_make_socket_nonblocking(fd) < 0)
+		goto out;
+
+	if (fcntl(fd, F_SETFD, 1) == -1) {
+		event_warn("fcntl(F_SETFD)");
+		goto out;
+	}
+
+	evutil_make_listen_socket_reuseable(fd);
+	if (*reuseport && evutil_make_listen_socket_reuseable_port(fd) == -1)
+		*reuseport = 0;
+
+	if (bind(fd, ai->ai_addr, ai->ai_addrlen) == -1)
+		goto out;
+
+	if (listen(fd, 128) == -1) {
+		event_warn("%s: listen", __func__);
+		goto out;
+	}
+
+	return (fd);
+
+ out:
+	serrno = EVUTIL_SOCKET_ERROR();
+	EVUTIL_CLOSESOCKET(fd);
+	EVUTIL_SET_SOCKET_ERROR(serrno);
+	return (-1);
+}
+
+int
+evgroup_bind_socket(struct evgroup *group, const char *address,
+    u_short port, evgroup_accept_cb cb, void *arg)
+{
+	struct evgroup_listener **listeners;
+	struct addrinfo hints, *aitop = NULL;
+	char strport[NI_MAXSERV];
+	int i, ai_result, reuseport = 1;
+
+	if (cb == NULL)
+		return (-1);
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;  /* turn NULL host name into INADDR_ANY */
+	evutil_snprintf(strport, sizeof(strport), "%d", port);
+	if ((ai_result = getaddrinfo(address, strport, &hints, &aitop)) != 0) {
+		if (ai_result == EAI_SYSTEM)
+			event_warn("getaddrinfo");
+		else
+			event_warnx("getaddrinfo: %s", gai_strerror(ai_result));
+		return (-1);
+	}
+
+	listeners = mm_calloc(group->nshards, sizeof(struct evgroup_listener *),
+	    EVENT_MEM_EVENT);
+	if (listeners == NULL) {
+		event_warn("%s: calloc", __func__);
+		freeaddrinfo(aitop);
+		return (-1);
+	}
+
+	for (i = 0; i < group->nshards; ++i) {
+		struct evgroup_shard *shard = &group->shards[i];
+		struct evgroup_listener *listener;
+		int fd;
+
+		if (i == 0 || reuseport) {
+			fd = evgroup_listen_socket(aitop, &reuseport);
+		} else {
+			/* no SO_REUSEPORT: every shard polls the same socket */
+			fd = dup(listeners[0]->listen_ev.ev_fd);
+		}
+		if (fd == -1)
+			goto error;
+
+		if ((listener = mm_calloc(1, sizeof(*listener),
+		    EVENT_MEM_EVENT)) == NULL) {
+			event_warn("%s: calloc", __func__);
+			EVUTIL_CLOSESOCKET(fd);
+			goto error;
+		}
+		listener->base = shard->base;
+		listener->cb = cb;
+		listener->cbarg = arg;
+		event_set(&listener->listen_ev, fd, EV_READ | EV_PERSIST,
+		    evgroup_accept_socket, listener);
+		event_base_set(shard->base, &listener->listen_ev);
+		listeners[i] = listener;
+	}
+
+	if (!reuseport)
+		event_debug(("%s: SO_REUSEPORT not available, sharing socket",
+			__func__));
+
+	/* Only start accepting once every shard could get its socket */
+	for (i = 0; i < group->nshards; ++i) {
+		if (event_add(&listeners[i]->listen_ev, NULL) == -1)
+			goto error;
+		TAILQ_INSERT_TAIL(&group->shards[i].listeners, listeners[i],
+		    next);
+	}
+
+	mm_free(listeners, EVENT_MEM_EVENT);
+	freeaddrinfo(aitop);
+	return (0);
+
+ error:
+	for (i = 0; i < group->nshards; ++i) {
+		struct evgroup_listener *listener = listeners[i];
+		if (listener == NULL)
+			continue;
+		if (listener->listen_ev.ev_flags & EVLIST_INSERTED) {
+			TAILQ_REMOVE(&group->shards[i].listeners, listener,
+			    next);
+			event_del(&listener->listen_ev);
+		}
+		EVUTIL_CLOSESOCKET(listener->listen_ev.ev_fd);
+		mm_free(listener, EVENT_MEM_EVENT);
+	}
+	mm_free(listeners, EVENT_MEM_EVENT);
+	freeaddrinfo(aitop);
+	return (-1);
+}
+
+#ifdef HAVE_PTHREADS
+static void *
+evgroup_shard_loop(void *arg)
+{
+	struct evgroup_shard *shard = arg;
+
+#ifdef HAVE_SCHED_SETAFFINITY
+	if (shard->cpu >= 0) {
+		cpu_set_t set;
+
+		CPU_ZERO(&set);
+		CPU_SET(shard->cpu, &set);
+		/* pid 0 is the calling thread */
+		if (sched_setaffinity(0, sizeof(set), &set) == -1)
+			event_warn("%s: sched_setaffinity(%d)",
+			    __func__, shard->cpu);
+	}
+#endif
+
+	if (event_base_dispatch(shard->base) == -1)
+		event_warnx("%s: event_base_dispatch failed", __func__);
+
+	return (NULL);
+}
+#endif
+
+int
+evgroup_start(struct evgroup *group)
+{
+#ifdef HAVE_PTHREADS
+	int i, res;
+
+	if (group->started)
+		return (-1);
+
+	for (i = 0; i < group->nshards; ++i) {
+		struct evgroup_shard *shard = &group->shards[i];
+
+		res = pthread_create(&shard->thread, NULL,
+		    evgroup_shard_loop, shard);
+		if (res != 0) {
+			event_warnx("%s: pthread_create: %s",
+			    __func__, strerror(res));
+			group->started = 1;
+			evgroup_stop(group);
+			evgroup_join(group);
+			return (-1);
+		}
+		shard->thread_started = 1;
+	}
+
+	group->started = 1;
+	return (0);
+#else
+	event_warnx("%s: no thread support", __func__);
+	return (-1);
+#endif
+}
+
+static void
+evgroup_join(struct evgroup *group)
+{
+#ifdef HAVE_PTHREADS
+	int i;
+
+	for (i = 0; i < group->nshards; ++i) {
+		struct evgroup_shard *shard = &group->shards[i];
+
+		if (!shard->thread_started)
+			continue;
+		pthread_join(shard->thread, NULL);
+		shard->thread_started = 0;
+	}
+#endif
+	group->joined = 1;
+}
+
+int
+evgroup_dispatch(struct evgroup *group)
+{
+	if (!group->started && evgroup_start(group) == -1)
+		return (-1);
+
+	evgroup_join(group);
+	return (0);
+}
+
+void
+evgroup_stop(struct evgroup *group)
+{
+	int i;
+
+	/* Wake up every shard; the byte is consumed on its own thread */
+	for (i = 0; i < group->nshards; ++i)
+		send(group->shards[i].wake_pair[0], "a", 1, 0);
+}
+
+static void
+evgroup_shard_free(struct evgroup_shard *shard)
+{
+	struct evgroup_listener *listener;
+
+	while ((listener = TAILQ_FIRST(&shard->listeners)) != NULL) {
+		TAILQ_REMOVE(&shard->listeners, listener, next);
+		event_del(&listener->listen_ev);
+		EVUTIL_CLOSESOCKET(listener->listen_ev.ev_fd);
+		mm_free(listener, EVENT_MEM_EVENT);
+	}
+
+	if (shard->wake_ev.ev_flags & EVLIST_INSERTED)
+		event_del(&shard->wake_ev);
+	if (shard->wake_pair[0] != -1)
+		EVUTIL_CLOSESOCKET(shard->wake_pair[0]);
+	if (shard->wake_pair[1] != -1)
+		EVUTIL_CLOSESOCKET(shard->wake_pair[1]);
+
+	if (shard->base != NULL)
+		event_base_free(shard->base);
+}
+
+void
+evgroup_free(struct evgroup *group)
+{
+	int i;
+
+	if (group->started && !group->joined) {
+		evgroup_stop(group);
+		evgroup_join(group);
+	}
+
+	for (i = 0; i < group->nshards; ++i)
+		evgroup_shard_free(&group->shards[i]);
+
+	mm_free(group->shards, EVENT_MEM_EVENT);
+	mm_free(group, EVENT_MEM_EVENT);
+}
@@ -0,0 +1,168 @@
+/*
+ * Copyright (c) 2026 The LibeventApp authors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _EVGROUP_H_
+#define _EVGROUP_H_
+
+#include "event.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @file evgroup.h
+ *
+ * A group of event bases, each dispatched by its own thread.
+ *
+ * A single event_base is driven by a single thread, so a server built on
+ * one base can use at most one core.  An evgroup runs one event_base per
+ * thread ("shard") and gives every shard its own listening socket bound
+ * with SO_REUSEPORT, letting the kernel spread incoming connections over
+ * the shards.  A connection accepted by a shard is handed to the accept
+ * callback together with that shard's base and should stay there; no
+ * events are ever moved between threads.
+ *
+ * Shards must only be touched from their own thread once the group has
+ * been started, with the exception of evgroup_stop().
+ */
+
+struct evgroup;
+struct sockaddr;
+
+/**
+ * Called on the accepting shard's thread for every new connection.
+ *
+ * @param base the event base of the shard that accepted the connection
+ * @param fd the non-blocking connected socket, owned by the callback
+ * @param addr the address of the peer
+ * @param socklen the length of addr
+ * @param arg the argument passed to evgroup_bind_socket()
+ */
+typedef void (*evgroup_accept_cb)(struct event_base *base, int fd,
+    struct sockaddr *addr, int socklen, void *arg);
+
+/**
+ * Create a new group of event bases.
+ *
+ * The bases are created right away so that events can be assigned to them
+ * with evgroup_get_base() before the group is started.
+ *
+ * @param nbases the number of shards; each gets its own thread
+ * @return a new evgroup, or NULL if an error occurred
+ */
+struct evgroup *evgroup_new(int nbases);
+
+/**
+ * Get the number of shards in a group.
+ */
+int evgroup_size(struct evgroup *group);
+
+/**
+ * Get the event base of a shard.
+ *
+ * @param group the group returned by evgroup_new()
+ * @param idx the shard index, between 0 and evgroup_size() - 1
+ * @return the event base of the shard, or NULL if idx is out of range
+ */
+struct event_base *evgroup_get_base(struct evgroup *group, int idx);
+
+/**
+ * Pin the thread of a shard to a CPU.
+ *
+ * Must be called before evgroup_start().  Shards are not pinned by default.
+ *
+ * @param group the group returned by evgroup_new()
+ * @param idx the shard index
+ * @param cpu the CPU number, or -1 to let the scheduler decide
+ * @return 0 if successful, or -1 if an error occurred
+ */
+int evgroup_set_cpu(struct evgroup *group, int idx, int cpu);
+
+/**
+ * Listen on the specified address and port on every shard.
+ *
+ * Every shard gets its own listening socket bound with SO_REUSEPORT.  If
+ * the kernel does not support SO_REUSEPORT, all shards share a single
+ * listening socket instead, which still keeps accepted connections on the
+ * accepting shard.
+ *
+ * Can be called multiple times to listen on several ports.
+ *
+ * @param group the group returned by evgroup_new()
+ * @param address the address to bind to, or NULL for any address
+ * @param port the port to bind to
+ * @param cb the callback invoked for every accepted connection
+ * @param arg an argument passed to cb
+ * @return 0 if successful, or -1 if an error occurred
+ */
+int evgroup_bind_socket(struct evgroup *group, const char *address,
+    u_short port, evgroup_accept_cb cb, void *arg);
+
+/**
+ * Start one thread per shard and dispatch its event base.
+ *
+ * @param group the group returned by evgroup_new()
+ * @return 0 if successful, or -1 if an error occurred
+ */
+int evgroup_start(struct evgroup *group);
+
+/**
+ * Start the group if needed and wait until every shard left its loop.
+ *
+ * This is the group counterpart of event_base_dispatch().
+ *
+ * @param group the group returned by evgroup_new()
+ * @return 0 if successful, or -1 if an error occurred
+ */
+int evgroup_dispatch(struct evgroup *group);
+
+/**
+ * Ask every shard to leave its event loop.
+ *
+ * Safe to call from any thread, including from callbacks running on one
+ * of the shards.  Does not wait for the shards; see evgroup_dispatch() and
+ * evgroup_free().
+ *
+ * @param group the group returned by evgroup_new()
+ */
+void evgroup_stop(struct evgroup *group);
+
+/**
+ * Stop all shards, wait for their threads and free the group.
+ *
+ * The listening sockets are closed and the event bases are freed.  Like
+ * event_base_free(), this does not close fds or free memory of events
+ * that were added by the callbacks.
+ *
+ * @param group the group to be freed
+ */
+void evgroup_free(struct evgroup *group);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _EVGROUP_H_ */
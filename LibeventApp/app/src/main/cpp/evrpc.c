@@ -59,11 +59,13 @@
 #include "evhttp.h"
 #include "evutil.h"
 #include "log.h"
+#include "mm-internal.h"
 
 struct evrpc_base *
 evrpc_init(struct evhttp *http_server)
 {
-	struct evrpc_base* base = calloc(1, sizeof(struct evrpc_base));
+	struct evrpc_base* base = mm_calloc(1, sizeof(struct evrpc_base),
+	    EVENT_MEM_RPC);
 	if (base == NULL)
 		return (NULL);
 
@@ -93,7 +95,7 @@ evrpc_free(struct evrpc_base *base)
 	while ((hook = TAILQ_FIRST(&base->output_hooks)) != NULL) {
 		assert(evrpc_remove_hook(base, EVRPC_OUTPUT, hook));
 	}
-	free(base);
+	mm_free(base, EVENT_MEM_RPC);
 }
 
 void *
@@ -116,7 +118,7 @@ evrpc_add_hook(void *vbase,
 		assert(hook_type == EVRPC_INPUT || hook_type == EVRPC_OUTPUT);
 	}
 
-	hook = calloc(1, sizeof(struct evrpc_hook));
+	hook = mm_calloc(1, sizeof(struct evrpc_hook), EVENT_MEM_RPC);
 	assert(hook != NULL);
 	
 	hook->process = cb;
@@ -133,7 +135,7 @@ evrpc_remove_hook_internal(struct evrpc_hook_list *head, void *handle)
 	TAILQ_FOREACH(hook, head, next) {
 		if (hook == handle) {
 			TAILQ_REMOVE(head, hook, next);
-			free(hook);
+			mm_free(hook, EVENT_MEM_RPC);
 			return (1);
 		}
 	}
@@ -194,7 +196,8 @@ evrpc_construct_uri(const char *uri)
 	int constructed_uri_len;
 
 	constructed_uri_len = strlen(EVRPC_URI_PREFIX) + strlen(uri) + 1;
-	if ((constructed_uri = malloc(constructed_uri_len)) == NULL)
+	if ((constructed_uri = mm_malloc(constructed_uri_len,
+	    EVENT_MEM_RPC)) == NULL)
 		event_err(1, "%s: failed to register rpc at %s",
 		    __func__, uri);
 	memcpy(constructed_uri, EVRPC_URI_PREFIX, strlen(EVRPC_URI_PREFIX));
@@ -221,7 +224,7 @@ evrpc_register_rpc(struct evrpc_base *base, struct evrpc *rpc,
 	    evrpc_request_cb,
 	    rpc);
 	
-	free(constructed_uri);
+	mm_free(constructed_uri, EVENT_MEM_RPC);
 
 	return (0);
 }
@@ -243,6 +246,7 @@ evrpc_unregister_rpc(struct evrpc_base *base, const char *name)
 	}
 	TAILQ_REMOVE(&base->registered_rpcs, rpc, next);
 	
+	/* EVRPC_REGISTER() allocates these with malloc() */
 	free((char *)rpc->uri);
 	free(rpc);
 
@@ -251,7 +255,7 @@ evrpc_unregister_rpc(struct evrpc_base *base, const char *name)
 	/* remove the http server callback */
 	assert(evhttp_del_cb(base->http_server, registered_uri) == 0);
 
-	free(registered_uri);
+	mm_free(registered_uri, EVENT_MEM_RPC);
 	return (0);
 }
 
@@ -275,7 +279,8 @@ evrpc_request_cb(struct evhttp_request *req, void *arg)
 		req, req->input_buffer) == -1)
 		goto error;
 
-	rpc_state = calloc(1, sizeof(struct evrpc_req_generic));
+	rpc_state = mm_calloc(1, sizeof(struct evrpc_req_generic),
+	    EVENT_MEM_RPC);
 	if (rpc_state == NULL)
 		goto error;
 
@@ -323,7 +328,7 @@ evrpc_reqstate_free(struct evrpc_req_generic* rpc_state)
 			rpc->request_free(rpc_state->request);
 		if (rpc_state->reply != NULL)
 			rpc->reply_free(rpc_state->reply);
-		free(rpc_state);
+		mm_free(rpc_state, EVENT_MEM_RPC);
 	}
 }
 
@@ -382,7 +387,8 @@ static int evrpc_schedule_request(struct evhttp_connection *connection,
 struct evrpc_pool *
 evrpc_pool_new(struct event_base *base)
 {
-	struct evrpc_pool *pool = calloc(1, sizeof(struct evrpc_pool));
+	struct evrpc_pool *pool = mm_calloc(1, sizeof(struct evrpc_pool),
+	    EVENT_MEM_RPC);
 	if (pool == NULL)
 		return (NULL);
 
@@ -401,6 +407,7 @@ evrpc_pool_new(struct event_base *base)
 static void
 evrpc_request_wrapper_free(struct evrpc_request_wrapper *request)
 {
+	/* EVRPC_GENERATE() allocates these with malloc() */
 	free(request->name);
 	free(request);
 }
@@ -431,7 +438,7 @@ evrpc_pool_free(struct evrpc_pool *pool)
 		assert(evrpc_remove_hook(pool, EVRPC_OUTPUT, hook));
 	}
 
-	free(pool);
+	mm_free(pool, EVENT_MEM_RPC);
 }
 
 /*
@@ -544,7 +551,7 @@ evrpc_schedule_request(struct evhttp_connection *connection,
 
 	/* start the request over the connection */
 	res = evhttp_make_request(connection, req, EVHTTP_REQ_POST, uri);
-	free(uri);
+	mm_free(uri, EVENT_MEM_RPC);
 
 	if (res == -1)
 		goto error;
@@ -32,6 +32,14 @@ typedef void (*ev_sighandler_t)(int);
 struct evsignal_info {
 	struct event ev_signal;
 	int ev_signal_pair[2];
+	int ev_signalfd;	/* -1 unless signals are read from a signalfd */
+#ifdef HAVE_SYS_SIGNALFD_H
+	sigset_t ev_signalfd_mask;	/* the signals ev_signalfd reads */
+	sigset_t ev_signalfd_blocked;	/* the signals we had to block */
+#ifdef HAVE_PTHREADS
+	pthread_t ev_signalfd_blocker[NSIG];	/* the thread that did */
+#endif
+#endif
 	int ev_signal_added;
 	volatile sig_atomic_t evsignal_caught;
 	struct event_list evsigevents[NSIG];
@@ -186,6 +186,41 @@ evutil_make_socket_nonblocking(int fd)
 	return 0;
 }
 
+int
+evutil_make_listen_socket_reuseable(int sock)
+{
+#if defined(SO_REUSEADDR) && !defined(WIN32)
+	int one = 1;
+	/* REUSEADDR on Unix means, "don't hang on to this address after the
+	 * listener is closed."  On Windows, though, it means "don't keep other
+	 * processes from binding to this address while we're using it. */
+	return setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (void*) &one,
+	    (socklen_t)sizeof(one));
+#else
+	return 0;
+#endif
+}
+
+int
+evutil_make_listen_socket_reuseable_port(int sock)
+{
+#if defined(__linux__) && defined(SO_REUSEPORT)
+	int one = 1;
+	/* REUSEPORT on Linux 3.9+ means, "Multiple servers (processes or
+	 * threads) can bind to the same port if they each set the option. */
+	return setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, (void*) &one,
+	    (socklen_t)sizeof(one));
+#else
+	/* callers fall back to sharing one socket */
+#ifdef WIN32
+	EVUTIL_SET_SOCKET_ERROR(WSAENOPROTOOPT);
+#else
+	errno = ENOPROTOOPT;
+#endif
+	return -1;
+#endif
+}
+
 ev_int64_t
 evutil_strtoll(const char *s, char **endptr, int base)
 {
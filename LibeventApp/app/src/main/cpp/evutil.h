@@ -100,6 +100,8 @@ extern "C" {
 
 int evutil_socketpair(int d, int type, int protocol, int sv[2]);
 int evutil_make_socket_nonblocking(int sock);
+int evutil_make_listen_socket_reuseable(int sock);
+int evutil_make_listen_socket_reuseable_port(int sock);
 #ifdef WIN32
 #define EVUTIL_CLOSESOCKET(s) closesocket(s)
 #else
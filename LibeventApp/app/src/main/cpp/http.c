@@ -86,6 +86,7 @@
 #include "evhttp.h"
 #include "evutil.h"
 #include "log.h"
+#include "mm-internal.h"
 #include "http-internal.h"
 
 #ifdef WIN32
@@ -171,7 +172,7 @@ fake_getaddrinfo(const char *hostname, struct addrinfo *ai)
 	ai->ai_socktype = SOCK_STREAM;
 	ai->ai_protocol = 0;
 	ai->ai_addrlen = sizeof(struct sockaddr_in);
-	if (NULL == (ai->ai_addr = malloc(ai->ai_addrlen)))
+	if (NULL == (ai->ai_addr = mm_malloc(ai->ai_addrlen, EVENT_MEM_HTTP)))
 		return (-1);
 	sa = (struct sockaddr_in*)ai->ai_addr;
 	memset(sa, 0, ai->ai_addrlen);
@@ -188,7 +189,7 @@ fake_getaddrinfo(const char *hostname, struct addrinfo *ai)
 static void
 fake_freeaddrinfo(struct addrinfo *ai)
 {
-	free(ai->ai_addr);
+	mm_free(ai->ai_addr, EVENT_MEM_HTTP);
 }
 #endif
 
@@ -272,15 +273,22 @@ html_replace(char ch, char *buf)
 	return buf;
 }
 
+static void *
+evhttp_libc_malloc(size_t sz, int tag)
+{
+	return (malloc(sz));
+}
+
 /*
  * Replaces <, >, ", ' and & with &lt;, &gt;, &quot;,
  * &#039; and &amp; correspondingly.
  *
- * The returned string needs to be freed by the caller.
+ * The escaped string is allocated with alloc and tag.
  */
 
-char *
-evhttp_htmlescape(const char *html)
+static char *
+evhttp_htmlescape_alloc(const char *html, void *(*alloc)(size_t, int),
+    int tag)
 {
 	int i, new_size = 0, old_size = strlen(html);
 	char *escaped_html, *p;
@@ -289,7 +297,7 @@ evhttp_htmlescape(const char *html)
 	for (i = 0; i < old_size; ++i)
           new_size += strlen(html_replace(html[i], scratch_space));
 
-	p = escaped_html = malloc(new_size + 1);
+	p = escaped_html = (*alloc)(new_size + 1, tag);
 	if (escaped_html == NULL)
 		event_err(1, "%s: malloc(%d)", __func__, new_size + 1);
 	for (i = 0; i < old_size; ++i) {
@@ -304,6 +312,21 @@ evhttp_htmlescape(const char *html)
 	return (escaped_html);
 }
 
+/* The returned string needs to be freed by the caller with free() */
+char *
+evhttp_htmlescape(const char *html)
+{
+	return (evhttp_htmlescape_alloc(html, evhttp_libc_malloc, 0));
+}
+
+/* The string comes from mm_malloc() instead, for the library itself */
+static char *
+evhttp_htmlescape_mm(const char *html)
+{
+	return (evhttp_htmlescape_alloc(html, event_mm_malloc_,
+	    EVENT_MEM_HTTP));
+}
+
 static const char *
 evhttp_method(enum evhttp_cmd_type type)
 {
@@ -426,7 +449,8 @@ evhttp_is_connection_keepalive(struct evkeyvalq* headers)
 }
 
 static void
-evhttp_maybe_add_date_header(struct evkeyvalq *headers)
+evhttp_maybe_add_date_header(struct event_base *base,
+    struct evkeyvalq *headers)
 {
 	if (evhttp_find_header(headers, "Date") == NULL) {
 		char date[50];
@@ -434,7 +458,14 @@ evhttp_maybe_add_date_header(struct evkeyvalq *headers)
 		struct tm cur;
 #endif
 		struct tm *cur_p;
-		time_t t = time(NULL);
+		struct timeval tv;
+		time_t t;
+
+		/* the time of the loop is good enough for a date in seconds */
+		if (base != NULL && event_base_gettimeofday_cached(base, &tv) == 0)
+			t = tv.tv_sec;
+		else
+			t = time(NULL);
 #ifdef WIN32
 		cur_p = gmtime(&t);
 #else
@@ -475,7 +506,8 @@ evhttp_make_header_response(struct evhttp_connection *evcon,
 
 	if (req->major == 1) {
 		if (req->minor == 1)
-			evhttp_maybe_add_date_header(req->output_headers);
+			evhttp_maybe_add_date_header(evcon->base,
+			    req->output_headers);
 
 		/*
 		 * if the protocol is 1.0; and the connection was keep-alive
@@ -630,7 +662,7 @@ evhttp_connection_incoming_fail(struct evhttp_request *req,
 	default:	/* xxx: probably should just error on default */
 		/* the callback looks at the uri to determine errors */
 		if (req->uri) {
-			free(req->uri);
+			mm_free(req->uri, EVENT_MEM_HTTP);
 			req->uri = NULL;
 		}
 
@@ -808,21 +840,21 @@ evhttp_handle_chunked_read(struct evhttp_request *req, struct evbuffer *buf)
 		if (req->ntoread < 0) {
 			/* Read chunk size */
 			ev_int64_t ntoread;
-			char *p = evbuffer_readline(buf);
+			char *p = evbuffer_readline_mm(buf, EVENT_MEM_HTTP);
 			char *endp;
 			int error;
 			if (p == NULL)
 				break;
 			/* the last chunk is on a new line? */
 			if (strlen(p) == 0) {
-				free(p);
+				mm_free(p, EVENT_MEM_HTTP);
 				continue;
 			}
 			ntoread = evutil_strtoll(p, &endp, 16);
 			error = (*p == '\0' ||
 			    (*endp != '\0' && *endp != ' ') ||
 			    ntoread < 0);
-			free(p);
+			mm_free(p, EVENT_MEM_HTTP);
 			if (error) {
 				/* could not get chunk size */
 				return (DATA_CORRUPTED);
@@ -1035,10 +1067,10 @@ evhttp_connection_free(struct evhttp_connection *evcon)
 		EVUTIL_CLOSESOCKET(evcon->fd);
 
 	if (evcon->bind_address != NULL)
-		free(evcon->bind_address);
+		mm_free(evcon->bind_address, EVENT_MEM_HTTP);
 
 	if (evcon->address != NULL)
-		free(evcon->address);
+		mm_free(evcon->address, EVENT_MEM_HTTP);
 
 	if (evcon->input_buffer != NULL)
 		evbuffer_free(evcon->input_buffer);
@@ -1046,7 +1078,7 @@ evhttp_connection_free(struct evhttp_connection *evcon)
 	if (evcon->output_buffer != NULL)
 		evbuffer_free(evcon->output_buffer);
 
-	free(evcon);
+	mm_free(evcon, EVENT_MEM_HTTP);
 }
 
 void
@@ -1055,8 +1087,8 @@ evhttp_connection_set_local_address(struct evhttp_connection *evcon,
 {
 	assert(evcon->state == EVCON_DISCONNECTED);
 	if (evcon->bind_address)
-		free(evcon->bind_address);
-	if ((evcon->bind_address = strdup(address)) == NULL)
+		mm_free(evcon->bind_address, EVENT_MEM_HTTP);
+	if ((evcon->bind_address = mm_strdup(address, EVENT_MEM_HTTP)) == NULL)
 		event_err(1, "%s: strdup", __func__);
 }
 
@@ -1265,7 +1297,8 @@ evhttp_parse_response_line(struct evhttp_request *req, char *line)
 		return (-1);
 	}
 
-	if ((req->response_code_line = strdup(readable)) == NULL)
+	if ((req->response_code_line = mm_strdup(readable,
+	    EVENT_MEM_HTTP)) == NULL)
 		event_err(1, "%s: strdup", __func__);
 
 	return (0);
@@ -1316,7 +1349,7 @@ evhttp_parse_request_line(struct evhttp_request *req, char *line)
 		return (-1);
 	}
 
-	if ((req->uri = strdup(uri)) == NULL) {
+	if ((req->uri = mm_strdup(uri, EVENT_MEM_HTTP)) == NULL) {
 		event_debug(("%s: strdup", __func__));
 		return (-1);
 	}
@@ -1350,9 +1383,9 @@ evhttp_clear_headers(struct evkeyvalq *headers)
 	    header != NULL;
 	    header = TAILQ_FIRST(headers)) {
 		TAILQ_REMOVE(headers, header, next);
-		free(header->key);
-		free(header->value);
-		free(header);
+		mm_free(header->key, EVENT_MEM_HTTP);
+		mm_free(header->value, EVENT_MEM_HTTP);
+		mm_free(header, EVENT_MEM_HTTP);
 	}
 }
 
@@ -1376,9 +1409,9 @@ evhttp_remove_header(struct evkeyvalq *headers, const char *key)
 
 	/* Free and remove the header that we found */
 	TAILQ_REMOVE(headers, header, next);
-	free(header->key);
-	free(header->value);
-	free(header);
+	mm_free(header->key, EVENT_MEM_HTTP);
+	mm_free(header->value, EVENT_MEM_HTTP);
+	mm_free(header, EVENT_MEM_HTTP);
 
 	return (0);
 }
@@ -1422,19 +1455,20 @@ static int
 evhttp_add_header_internal(struct evkeyvalq *headers,
     const char *key, const char *value)
 {
-	struct evkeyval *header = calloc(1, sizeof(struct evkeyval));
+	struct evkeyval *header = mm_calloc(1, sizeof(struct evkeyval),
+	    EVENT_MEM_HTTP);
 	if (header == NULL) {
 		event_warn("%s: calloc", __func__);
 		return (-1);
 	}
-	if ((header->key = strdup(key)) == NULL) {
-		free(header);
+	if ((header->key = mm_strdup(key, EVENT_MEM_HTTP)) == NULL) {
+		mm_free(header, EVENT_MEM_HTTP);
 		event_warn("%s: strdup", __func__);
 		return (-1);
 	}
-	if ((header->value = strdup(value)) == NULL) {
-		free(header->key);
-		free(header);
+	if ((header->value = mm_strdup(value, EVENT_MEM_HTTP)) == NULL) {
+		mm_free(header->key, EVENT_MEM_HTTP);
+		mm_free(header, EVENT_MEM_HTTP);
 		event_warn("%s: strdup", __func__);
 		return (-1);
 	}
@@ -1460,7 +1494,7 @@ evhttp_parse_firstline(struct evhttp_request *req, struct evbuffer *buffer)
 	char *line;
 	enum message_read_status status = ALL_DATA_READ;
 
-	line = evbuffer_readline(buffer);
+	line = evbuffer_readline_mm(buffer, EVENT_MEM_HTTP);
 	if (line == NULL)
 		return (MORE_DATA_EXPECTED);
 
@@ -1477,7 +1511,7 @@ evhttp_parse_firstline(struct evhttp_request *req, struct evbuffer *buffer)
 		status = DATA_CORRUPTED;
 	}
 
-	free(line);
+	mm_free(line, EVENT_MEM_HTTP);
 	return (status);
 }
 
@@ -1494,7 +1528,8 @@ evhttp_append_to_last_header(struct evkeyvalq *headers, const char *line)
 	old_len = strlen(header->value);
 	line_len = strlen(line);
 
-	newval = realloc(header->value, old_len + line_len + 1);
+	newval = mm_realloc(header->value, old_len + line_len + 1,
+	    EVENT_MEM_HTTP);
 	if (newval == NULL)
 		return (-1);
 
@@ -1511,13 +1546,13 @@ evhttp_parse_headers(struct evhttp_request *req, struct evbuffer* buffer)
 	enum message_read_status status = MORE_DATA_EXPECTED;
 
 	struct evkeyvalq* headers = req->input_headers;
-	while ((line = evbuffer_readline(buffer))
+	while ((line = evbuffer_readline_mm(buffer, EVENT_MEM_HTTP))
 	       != NULL) {
 		char *skey, *svalue;
 
 		if (*line == '\0') { /* Last header - Done */
 			status = ALL_DATA_READ;
-			free(line);
+			mm_free(line, EVENT_MEM_HTTP);
 			break;
 		}
 
@@ -1525,7 +1560,7 @@ evhttp_parse_headers(struct evhttp_request *req, struct evbuffer* buffer)
 		if (*line == ' ' || *line == '\t') {
 			if (evhttp_append_to_last_header(headers, line) == -1)
 				goto error;
-			free(line);
+			mm_free(line, EVENT_MEM_HTTP);
 			continue;
 		}
 
@@ -1540,13 +1575,13 @@ evhttp_parse_headers(struct evhttp_request *req, struct evbuffer* buffer)
 		if (evhttp_add_header(headers, skey, svalue) == -1)
 			goto error;
 
-		free(line);
+		mm_free(line, EVENT_MEM_HTTP);
 	}
 
 	return (status);
 
  error:
-	free(line);
+	mm_free(line, EVENT_MEM_HTTP);
 	return (DATA_CORRUPTED);
 }
 
@@ -1703,7 +1738,8 @@ evhttp_connection_new(const char *address, unsigned short port)
 	
 	event_debug(("Attempting connection to %s:%d\n", address, port));
 
-	if ((evcon = calloc(1, sizeof(struct evhttp_connection))) == NULL) {
+	if ((evcon = mm_calloc(1, sizeof(struct evhttp_connection),
+	    EVENT_MEM_HTTP)) == NULL) {
 		event_warn("%s: calloc failed", __func__);
 		goto error;
 	}
@@ -1714,7 +1750,7 @@ evhttp_connection_new(const char *address, unsigned short port)
 	evcon->timeout = -1;
 	evcon->retry_cnt = evcon->retry_max = 0;
 
-	if ((evcon->address = strdup(address)) == NULL) {
+	if ((evcon->address = mm_strdup(address, EVENT_MEM_HTTP)) == NULL) {
 		event_warn("%s: strdup failed", __func__);
 		goto error;
 	}
@@ -1827,8 +1863,8 @@ evhttp_make_request(struct evhttp_connection *evcon,
 	req->kind = EVHTTP_REQUEST;
 	req->type = type;
 	if (req->uri != NULL)
-		free(req->uri);
-	if ((req->uri = strdup(uri)) == NULL)
+		mm_free(req->uri, EVENT_MEM_HTTP);
+	if ((req->uri = mm_strdup(uri, EVENT_MEM_HTTP)) == NULL)
 		event_err(1, "%s: strdup", __func__);
 
 	/* Set the protocol version if it is not supplied */
@@ -2037,8 +2073,8 @@ evhttp_response_code(struct evhttp_request *req, int code, const char *reason)
 	req->kind = EVHTTP_RESPONSE;
 	req->response_code = code;
 	if (req->response_code_line != NULL)
-		free(req->response_code_line);
-	req->response_code_line = strdup(reason);
+		mm_free(req->response_code_line, EVENT_MEM_HTTP);
+	req->response_code_line = mm_strdup(reason, EVENT_MEM_HTTP);
 }
 
 void
@@ -2168,7 +2204,7 @@ evhttp_parse_query(const char *uri, struct evkeyvalq *headers)
 	if (strchr(uri, '?') == NULL)
 		return;
 
-	if ((line = strdup(uri)) == NULL)
+	if ((line = mm_strdup(uri, EVENT_MEM_HTTP)) == NULL)
 		event_err(1, "%s: strdup", __func__);
 
 
@@ -2187,18 +2223,19 @@ evhttp_parse_query(const char *uri, struct evkeyvalq *headers)
 		if (value == NULL)
 			goto error;
 
-		if ((decoded_value = malloc(strlen(value) + 1)) == NULL)
+		if ((decoded_value = mm_malloc(strlen(value) + 1,
+		    EVENT_MEM_HTTP)) == NULL)
 			event_err(1, "%s: malloc", __func__);
 
 		evhttp_decode_uri_internal(value, strlen(value),
 		    decoded_value, 1 /*always_decode_plus*/);
 		event_debug(("Query Param: %s -> %s\n", key, decoded_value));
 		evhttp_add_header_internal(headers, key, decoded_value);
-		free(decoded_value);
+		mm_free(decoded_value, EVENT_MEM_HTTP);
 	}
 
  error:
-	free(line);
+	mm_free(line, EVENT_MEM_HTTP);
 }
 
 static struct evhttp_cb *
@@ -2264,14 +2301,14 @@ evhttp_handle_request(struct evhttp_request *req, void *arg)
 		    "<p>The requested URL %s was not found on this server.</p>"\
 		    "</body></html>\n"
 
-		char *escaped_html = evhttp_htmlescape(req->uri);
+		char *escaped_html = evhttp_htmlescape_mm(req->uri);
 		struct evbuffer *buf = evbuffer_new();
 
 		evhttp_response_code(req, HTTP_NOTFOUND, "Not Found");
 
 		evbuffer_add_printf(buf, ERR_FORMAT, escaped_html);
 
-		free(escaped_html);
+		mm_free(escaped_html, EVENT_MEM_HTTP);
 
 		evhttp_send_page(req, buf);
 
@@ -2330,7 +2367,7 @@ evhttp_accept_socket(struct evhttp *http, int fd)
 	struct event *ev;
 	int res;
 
-	bound = malloc(sizeof(struct evhttp_bound_socket));
+	bound = mm_malloc(sizeof(struct evhttp_bound_socket), EVENT_MEM_HTTP);
 	if (bound == NULL)
 		return (-1);
 
@@ -2343,7 +2380,7 @@ evhttp_accept_socket(struct evhttp *http, int fd)
 	res = event_add(ev, NULL);
 
 	if (res == -1) {
-		free(bound);
+		mm_free(bound, EVENT_MEM_HTTP);
 		return (-1);
 	}
 
@@ -2357,7 +2394,8 @@ evhttp_new_object(void)
 {
 	struct evhttp *http = NULL;
 
-	if ((http = calloc(1, sizeof(struct evhttp))) == NULL) {
+	if ((http = mm_calloc(1, sizeof(struct evhttp),
+	    EVENT_MEM_HTTP)) == NULL) {
 		event_warn("%s: calloc", __func__);
 		return (NULL);
 	}
@@ -2391,7 +2429,7 @@ evhttp_start(const char *address, u_short port)
 	struct evhttp *http = evhttp_new_object();
 
 	if (evhttp_bind_socket(http, address, port) == -1) {
-		free(http);
+		mm_free(http, EVENT_MEM_HTTP);
 		return (NULL);
 	}
 
@@ -2414,7 +2452,7 @@ evhttp_free(struct evhttp* http)
 		event_del(&bound->bind_ev);
 		EVUTIL_CLOSESOCKET(fd);
 
-		free(bound);
+		mm_free(bound, EVENT_MEM_HTTP);
 	}
 
 	while ((evcon = TAILQ_FIRST(&http->connections)) != NULL) {
@@ -2424,11 +2462,11 @@ evhttp_free(struct evhttp* http)
 
 	while ((http_cb = TAILQ_FIRST(&http->callbacks)) != NULL) {
 		TAILQ_REMOVE(&http->callbacks, http_cb, next);
-		free(http_cb->what);
-		free(http_cb);
+		mm_free(http_cb->what, EVENT_MEM_HTTP);
+		mm_free(http_cb, EVENT_MEM_HTTP);
 	}
 	
-	free(http);
+	mm_free(http, EVENT_MEM_HTTP);
 }
 
 void
@@ -2443,10 +2481,11 @@ evhttp_set_cb(struct evhttp *http, const char *uri,
 {
 	struct evhttp_cb *http_cb;
 
-	if ((http_cb = calloc(1, sizeof(struct evhttp_cb))) == NULL)
+	if ((http_cb = mm_calloc(1, sizeof(struct evhttp_cb),
+	    EVENT_MEM_HTTP)) == NULL)
 		event_err(1, "%s: calloc", __func__);
 
-	http_cb->what = strdup(uri);
+	http_cb->what = mm_strdup(uri, EVENT_MEM_HTTP);
 	http_cb->cb = cb;
 	http_cb->cbarg = cbarg;
 
@@ -2466,8 +2505,8 @@ evhttp_del_cb(struct evhttp *http, const char *uri)
 		return (-1);
 
 	TAILQ_REMOVE(&http->callbacks, http_cb, next);
-	free(http_cb->what);
-	free(http_cb);
+	mm_free(http_cb->what, EVENT_MEM_HTTP);
+	mm_free(http_cb, EVENT_MEM_HTTP);
 
 	return (0);
 }
@@ -2490,20 +2529,23 @@ evhttp_request_new(void (*cb)(struct evhttp_request *, void *), void *arg)
 	struct evhttp_request *req = NULL;
 
 	/* Allocate request structure */
-	if ((req = calloc(1, sizeof(struct evhttp_request))) == NULL) {
+	if ((req = mm_calloc(1, sizeof(struct evhttp_request),
+	    EVENT_MEM_HTTP)) == NULL) {
 		event_warn("%s: calloc", __func__);
 		goto error;
 	}
 
 	req->kind = EVHTTP_RESPONSE;
-	req->input_headers = calloc(1, sizeof(struct evkeyvalq));
+	req->input_headers = mm_calloc(1, sizeof(struct evkeyvalq),
+	    EVENT_MEM_HTTP);
 	if (req->input_headers == NULL) {
 		event_warn("%s: calloc", __func__);
 		goto error;
 	}
 	TAILQ_INIT(req->input_headers);
 
-	req->output_headers = calloc(1, sizeof(struct evkeyvalq));
+	req->output_headers = mm_calloc(1, sizeof(struct evkeyvalq),
+	    EVENT_MEM_HTTP);
 	if (req->output_headers == NULL) {
 		event_warn("%s: calloc", __func__);
 		goto error;
@@ -2535,17 +2577,17 @@ void
 evhttp_request_free(struct evhttp_request *req)
 {
 	if (req->remote_host != NULL)
-		free(req->remote_host);
+		mm_free(req->remote_host, EVENT_MEM_HTTP);
 	if (req->uri != NULL)
-		free(req->uri);
+		mm_free(req->uri, EVENT_MEM_HTTP);
 	if (req->response_code_line != NULL)
-		free(req->response_code_line);
+		mm_free(req->response_code_line, EVENT_MEM_HTTP);
 
 	evhttp_clear_headers(req->input_headers);
-	free(req->input_headers);
+	mm_free(req->input_headers, EVENT_MEM_HTTP);
 
 	evhttp_clear_headers(req->output_headers);
-	free(req->output_headers);
+	mm_free(req->output_headers, EVENT_MEM_HTTP);
 
 	if (req->input_buffer != NULL)
 		evbuffer_free(req->input_buffer);
@@ -2553,7 +2595,7 @@ evhttp_request_free(struct evhttp_request *req)
 	if (req->output_buffer != NULL)
 		evbuffer_free(req->output_buffer);
 
-	free(req);
+	mm_free(req, EVENT_MEM_HTTP);
 }
 
 struct evhttp_connection *
@@ -2596,8 +2638,8 @@ evhttp_get_request_connection(
 
 	name_from_addr(sa, salen, &hostname, &portname);
 	if (hostname == NULL || portname == NULL) {
-		if (hostname) free(hostname);
-		if (portname) free(portname);
+		if (hostname) mm_free(hostname, EVENT_MEM_HTTP);
+		if (portname) mm_free(portname, EVENT_MEM_HTTP);
 		return (NULL);
 	}
 
@@ -2606,8 +2648,8 @@ evhttp_get_request_connection(
 
 	/* we need a connection object to put the http request on */
 	evcon = evhttp_connection_new(hostname, atoi(portname));
-	free(hostname);
-	free(portname);
+	mm_free(hostname, EVENT_MEM_HTTP);
+	mm_free(portname, EVENT_MEM_HTTP);
 	if (evcon == NULL)
 		return (NULL);
 
@@ -2637,7 +2679,8 @@ evhttp_associate_new_request_with_connection(struct evhttp_connection *evcon)
 	
 	req->kind = EVHTTP_REQUEST;
 	
-	if ((req->remote_host = strdup(evcon->address)) == NULL)
+	if ((req->remote_host = mm_strdup(evcon->address,
+	    EVENT_MEM_HTTP)) == NULL)
 		event_err(1, "%s: strdup", __func__);
 	req->remote_port = evcon->port;
 
@@ -2730,8 +2773,8 @@ name_from_addr(struct sockaddr *sa, socklen_t salen,
 	if (ni_result != 0)
 			return;
 #endif
-	*phost = strdup(ntop);
-	*pport = strdup(strport);
+	*phost = mm_strdup(ntop, EVENT_MEM_HTTP);
+	*pport = mm_strdup(strport, EVENT_MEM_HTTP);
 }
 
 /* Create a non-blocking socket and bind it */
@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2026 The LibeventApp authors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _IOURING_INTERNAL_H_
+#define _IOURING_INTERNAL_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Completion-based requests on the ring of a base that uses the io_uring
+ * backend.  Requests are queued on the submission queue and go to the
+ * kernel with the next wait of the loop.  Their completions are handed to
+ * the request callback from within the dispatch, with the base lock held;
+ * the callback must not run user code but activate an event instead.
+ */
+
+struct uringop;
+
+struct evuring_req {
+	/*
+	 * res is the result of the request, or -ECANCELED for requests that
+	 * are still in flight when the base is freed, in which case flags
+	 * has EVURING_F_GONE set and no events may be touched.
+	 */
+	void (*cb)(struct evuring_req *req, int res, unsigned flags);
+	void *arg;
+	int inflight;
+	TAILQ_ENTRY(evuring_req) next;
+};
+
+#define EVURING_F_GONE	0x80000000
+
+/* the ring of base, or NULL if base does not use io_uring */
+struct uringop *evuring_get(struct event_base *base);
+
+/* Sets up the provided buffers for receives, -1 if the kernel cannot */
+int evuring_buffers_init(struct uringop *uringop);
+
+/*
+ * Receives from a socket into one of the provided buffers of the base,
+ * which are set up on the first call if needed.
+ */
+int evuring_recv(struct uringop *uringop, struct evuring_req *req, int fd);
+
+/* Sends len bytes at buf, which must stay untouched until completion */
+int evuring_send(struct uringop *uringop, struct evuring_req *req, int fd,
+    const void *buf, size_t len);
+
+/* Asks the kernel to cancel a request; its completion still arrives */
+int evuring_cancel(struct uringop *uringop, struct evuring_req *req);
+
+/* The provided buffer a receive completed into, and giving it back */
+const void *evuring_buffer(struct uringop *uringop, unsigned flags);
+void evuring_buffer_release(struct uringop *uringop, unsigned flags);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _IOURING_INTERNAL_H_ */
@@ -0,0 +1,925 @@
+/*
+ * Copyright (c) 2026 The LibeventApp authors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef HAVE_IO_URING
+
+#include <stdint.h>
+#include <sys/types.h>
+#ifdef HAVE_SYS_TIME_H
+#include <sys/time.h>
+#else
+#include "sys/_libevent_time.h"
+#endif
+#include <sys/queue.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+
+#include "event.h"
+#include "event-internal.h"
+#include "evsignal.h"
+#include "iouring-internal.h"
+#include "log.h"
+#include "mm-internal.h"
+
+/*
+ * The backend needs the uapi of Linux 5.19: IORING_FEAT_EXT_ARG of 5.11,
+ * multishot polls and IORING_FEAT_RSRC_TAGS of 5.13 and the provided
+ * buffer rings of 5.19.  IORING_REGISTER_PBUF_RING is an enum, so the last
+ * is checked with IORING_SETUP_SQE128 of the same release.  With older
+ * headers the backend is left out and never chosen.
+ */
+#if defined(IORING_FEAT_EXT_ARG) && defined(IORING_POLL_ADD_MULTI) && \
+    defined(IORING_FEAT_RSRC_TAGS) && defined(IORING_SETUP_SQE128)
+
+/*
+ * A readiness backend on top of io_uring.  Every watched fd has one
+ * IORING_OP_POLL_ADD request in the kernel.  Changes to the set of watched
+ * fds are collected and written to the submission queue right before the
+ * loop waits, so that submitting them and waiting for completions is a
+ * single io_uring_enter() call.
+ *
+ * Level-triggered events use one-shot polls that are armed again on the
+ * next wait while the fd is still watched; EV_ET events use multishot
+ * polls, which stay armed and only complete when the fd becomes ready
+ * again, just like EPOLLET.  Any number of events may wait on an fd; the
+ * poll asks for the union of their interest.
+ *
+ * The user_data of a poll holds the fd and a generation number, so that
+ * completions of polls that were removed in the meantime are recognized
+ * and dropped.  Other requests, see iouring-internal.h, have the top bit
+ * of their user_data set and carry a pointer to a struct evuring_req.
+ */
+
+struct evuring {
+	struct event_list events;
+	int nread;		/* events with EV_READ */
+	int nwrite;		/* events with EV_WRITE */
+	int kernel_events;	/* poll mask of the armed poll, 0 if none */
+	ev_uint32_t gen;	/* generation of the armed poll */
+	short changed;		/* fd is on the changelist */
+	short was_deleted;	/* interest dropped to nothing meanwhile */
+};
+
+struct uringop {
+	struct event_base *base;
+	int ringfd;
+	void *ring;		/* the submission and completion rings */
+	size_t ring_size;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_flags;
+	unsigned sq_mask;
+	unsigned sq_entries;
+	unsigned *sq_array;
+	unsigned sq_local_tail;	/* sqes filled in but not yet published */
+
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned cq_mask;
+	struct io_uring_cqe *cqes;
+
+	int multishot;		/* the kernel supports multishot polls */
+	ev_uint32_t gen;
+
+	/* requests in flight */
+	TAILQ_HEAD(evuring_reqq, evuring_req) reqs;
+
+	/* the provided buffer ring for receives, set up on first use */
+	int bufring_state;	/* 0 not yet, 1 registered, -1 unsupported */
+	struct io_uring_buf_ring *bufring;
+	char *bufmem;
+	unsigned buf_tail;
+
+	struct evuring **pages;	/* by fd, as with epoll */
+	int npages;
+	int *changes;
+	int nchanges;
+	int changes_size;
+};
+
+/* user_data of requests whose completion is of no interest */
+#define URING_UDATA_IGNORE	((ev_uint64_t)-1)
+#define URING_UDATA_REQ		((ev_uint64_t)1 << 63)
+#define URING_UDATA(fd, gen)	(((ev_uint64_t)(gen) << 32) | (ev_uint32_t)(fd))
+#define URING_GEN_MASK		0x7fffffff
+
+#define URING_ENTRIES	256
+
+#define URING_PAGE_SHIFT	10
+#define URING_PAGE_SIZE		(1 << URING_PAGE_SHIFT)
+#define URING_PAGE_MASK		(URING_PAGE_SIZE - 1)
+
+/* the provided buffers; a power of two of them */
+#define URING_BGID	0
+#define URING_NBUFS	64
+#define URING_BUFSIZE	4096
+
+static void *uring_init	(struct event_base *);
+static int uring_add	(void *, struct event *);
+static int uring_del	(void *, struct event *);
+static int uring_dispatch	(struct event_base *, void *, struct timeval *);
+static void uring_dealloc	(struct event_base *, void *);
+
+const struct eventop uringops = {
+	"io_uring",
+	uring_init,
+	uring_add,
+	uring_del,
+	uring_dispatch,
+	uring_dealloc,
+	1 /* need reinit */
+};
+
+#ifdef HAVE_SETFD
+#define FD_CLOSEONEXEC(x) do { \
+        if (fcntl(x, F_SETFD, 1) == -1) \
+                event_warn("fcntl(%d, F_SETFD)", x); \
+} while (0)
+#else
+#define FD_CLOSEONEXEC(x)
+#endif
+
+static int
+uring_enter(struct uringop *uringop, unsigned to_submit,
+    unsigned min_complete, unsigned flags, const struct timeval *tv)
+{
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+
+	memset(&arg, 0, sizeof(arg));
+	if (tv != NULL) {
+		ts.tv_sec = tv->tv_sec;
+		ts.tv_nsec = (long long)tv->tv_usec * 1000;
+		arg.ts = (ev_uint64_t)(uintptr_t)&ts;
+	}
+	flags |= IORING_ENTER_EXT_ARG;
+	return (syscall(__NR_io_uring_enter, uringop->ringfd, to_submit,
+		min_complete, flags, &arg, sizeof(arg)));
+}
+
+/* Hands the filled in sqes to the kernel, and optionally waits */
+static int
+uring_submit(struct uringop *uringop, int wait, const struct timeval *tv)
+{
+	unsigned to_submit;
+	int res;
+
+	__atomic_store_n(uringop->sq_tail, uringop->sq_local_tail,
+	    __ATOMIC_RELEASE);
+	to_submit = uringop->sq_local_tail -
+	    __atomic_load_n(uringop->sq_head, __ATOMIC_ACQUIRE);
+	if (!wait && to_submit == 0 &&
+	    !(__atomic_load_n(uringop->sq_flags, __ATOMIC_RELAXED) &
+		IORING_SQ_CQ_OVERFLOW))
+		return (0);
+
+	/* GETEVENTS also moves completions that overflowed into the ring */
+	res = uring_enter(uringop, to_submit, wait ? 1 : 0,
+	    IORING_ENTER_GETEVENTS, tv);
+	return (res);
+}
+
+static struct io_uring_sqe *
+uring_get_sqe(struct uringop *uringop)
+{
+	struct io_uring_sqe *sqe;
+	unsigned idx;
+
+	if (uringop->sq_local_tail -
+	    __atomic_load_n(uringop->sq_head, __ATOMIC_ACQUIRE) ==
+	    uringop->sq_entries) {
+		/* the queue is full; submit what we have so far */
+		if (uring_submit(uringop, 0, NULL) == -1 &&
+		    errno != EINTR && errno != EBUSY && errno != EAGAIN)
+			event_warn("io_uring_enter");
+		if (uringop->sq_local_tail -
+		    __atomic_load_n(uringop->sq_head, __ATOMIC_ACQUIRE) ==
+		    uringop->sq_entries)
+			return (NULL);
+	}
+
+	idx = uringop->sq_local_tail & uringop->sq_mask;
+	sqe = &uringop->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	uringop->sq_array[idx] = idx;
+	uringop->sq_local_tail++;
+
+	return (sqe);
+}
+
+static void *
+uring_init(struct event_base *base)
+{
+	struct io_uring_params p;
+	struct uringop *uringop;
+	size_t sq_size, cq_size;
+	char *ring;
+	int ringfd;
+
+	/* Disable io_uring when this environment variable is set */
+	if (evutil_getenv("EVENT_NOIOURING"))
+		return (NULL);
+
+	memset(&p, 0, sizeof(p));
+	if ((ringfd = syscall(__NR_io_uring_setup, URING_ENTRIES, &p)) == -1) {
+		if (errno != ENOSYS && errno != EPERM)
+			event_warn("io_uring_setup");
+		return (NULL);
+	}
+
+	/* We need timeouts on io_uring_enter() and no lost completions */
+	if (!(p.features & IORING_FEAT_EXT_ARG) ||
+	    !(p.features & IORING_FEAT_NODROP) ||
+	    !(p.features & IORING_FEAT_SINGLE_MMAP)) {
+		close(ringfd);
+		return (NULL);
+	}
+
+	FD_CLOSEONEXEC(ringfd);
+
+	if (!(uringop = mm_calloc(1, sizeof(struct uringop),
+	    EVENT_MEM_EVENT))) {
+		close(ringfd);
+		return (NULL);
+	}
+	uringop->base = base;
+	uringop->ringfd = ringfd;
+
+	sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	uringop->ring_size = sq_size > cq_size ? sq_size : cq_size;
+	uringop->ring = mmap(NULL, uringop->ring_size,
+	    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringfd,
+	    IORING_OFF_SQ_RING);
+	if (uringop->ring == MAP_FAILED) {
+		event_warn("mmap");
+		goto error;
+	}
+	uringop->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	uringop->sqes = mmap(NULL, uringop->sqes_size,
+	    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringfd,
+	    IORING_OFF_SQES);
+	if (uringop->sqes == MAP_FAILED) {
+		event_warn("mmap");
+		uringop->sqes = NULL;
+		goto error;
+	}
+
+	ring = uringop->ring;
+	uringop->sq_head = (unsigned *)(ring + p.sq_off.head);
+	uringop->sq_tail = (unsigned *)(ring + p.sq_off.tail);
+	uringop->sq_flags = (unsigned *)(ring + p.sq_off.flags);
+	uringop->sq_mask = *(unsigned *)(ring + p.sq_off.ring_mask);
+	uringop->sq_entries = *(unsigned *)(ring + p.sq_off.ring_entries);
+	uringop->sq_array = (unsigned *)(ring + p.sq_off.array);
+	uringop->sq_local_tail = *uringop->sq_tail;
+	uringop->cq_head = (unsigned *)(ring + p.cq_off.head);
+	uringop->cq_tail = (unsigned *)(ring + p.cq_off.tail);
+	uringop->cq_mask = *(unsigned *)(ring + p.cq_off.ring_mask);
+	uringop->cqes = (struct io_uring_cqe *)(ring + p.cq_off.cqes);
+
+	/* resource tags came with multishot polls in Linux 5.13 */
+	uringop->multishot = (p.features & IORING_FEAT_RSRC_TAGS) != 0;
+
+	TAILQ_INIT(&uringop->reqs);
+
+	evsignal_init(base);
+
+	return (uringop);
+
+ error:
+	if (uringop->sqes != NULL)
+		munmap(uringop->sqes, uringop->sqes_size);
+	if (uringop->ring != NULL && uringop->ring != MAP_FAILED)
+		munmap(uringop->ring, uringop->ring_size);
+	close(ringfd);
+	mm_free(uringop, EVENT_MEM_EVENT);
+	return (NULL);
+}
+
+/* Returns the evuring of fd, or NULL if its page was never allocated */
+static struct evuring *
+uring_fd_lookup(struct uringop *uringop, int fd)
+{
+	struct evuring *page;
+
+	if (fd < 0 || (fd >> URING_PAGE_SHIFT) >= uringop->npages)
+		return (NULL);
+	page = uringop->pages[fd >> URING_PAGE_SHIFT];
+	if (page == NULL)
+		return (NULL);
+	return (&page[fd & URING_PAGE_MASK]);
+}
+
+/* Returns the evuring of fd, allocating its page as necessary */
+static struct evuring *
+uring_fd_get(struct uringop *uringop, int fd)
+{
+	struct evuring **pages;
+	int idx = fd >> URING_PAGE_SHIFT, npages;
+
+	if (idx >= uringop->npages) {
+		/* only the page pointers are copied */
+		npages = uringop->npages ? uringop->npages : 1;
+		while (npages <= idx)
+			npages <<= 1;
+
+		pages = mm_realloc(uringop->pages,
+		    npages * sizeof(struct evuring *), EVENT_MEM_EVENT);
+		if (pages == NULL) {
+			event_warn("realloc");
+			return (NULL);
+		}
+		memset(pages + uringop->npages, 0,
+		    (npages - uringop->npages) * sizeof(struct evuring *));
+		uringop->pages = pages;
+		uringop->npages = npages;
+	}
+
+	if (uringop->pages[idx] == NULL) {
+		struct evuring *page = mm_calloc(URING_PAGE_SIZE,
+		    sizeof(struct evuring), EVENT_MEM_EVENT);
+		int i;
+
+		if (page == NULL) {
+			event_warn("calloc");
+			return (NULL);
+		}
+		for (i = 0; i < URING_PAGE_SIZE; ++i)
+			TAILQ_INIT(&page[i].events);
+		uringop->pages[idx] = page;
+	}
+
+	return (&uringop->pages[idx][fd & URING_PAGE_MASK]);
+}
+
+/* All events on an fd are either edge- or level-triggered */
+static int
+uring_fd_is_et(struct evuring *evu)
+{
+	struct event *ev = TAILQ_FIRST(&evu->events);
+
+	return (ev != NULL && (ev->ev_events & EV_ET));
+}
+
+/* Remembers that fd needs a new poll, for uring_apply_changes() */
+static int
+uring_note_change(struct uringop *uringop, int fd)
+{
+	struct evuring *evu = uring_fd_lookup(uringop, fd);
+
+	if (evu->changed)
+		return (0);
+
+	if (uringop->nchanges == uringop->changes_size) {
+		int size = uringop->changes_size ? uringop->changes_size * 2 : 64;
+		int *changes = mm_realloc(uringop->changes, size * sizeof(int),
+		    EVENT_MEM_EVENT);
+		if (changes == NULL) {
+			event_warn("realloc");
+			return (-1);
+		}
+		uringop->changes = changes;
+		uringop->changes_size = size;
+	}
+	uringop->changes[uringop->nchanges++] = fd;
+	evu->changed = 1;
+	return (0);
+}
+
+/*
+ * Queues the poll requests for the net changes on the changelist; they
+ * are submitted together with the next wait.  A poll whose mask changed
+ * is removed and added again.
+ */
+static void
+uring_apply_changes(struct uringop *uringop)
+{
+	struct io_uring_sqe *sqe;
+	struct evuring *evu;
+	int i, fd, events, et;
+
+	for (i = 0; i < uringop->nchanges; ++i) {
+		fd = uringop->changes[i];
+		evu = uring_fd_lookup(uringop, fd);
+
+		events = 0;
+		if (evu->nread)
+			events |= POLLIN;
+		if (evu->nwrite)
+			events |= POLLOUT;
+		et = events && uring_fd_is_et(evu);
+
+		/*
+		 * A poll holds on to the file it was armed for, so after all
+		 * interest was dropped the fd may refer to a different file
+		 * and an unchanged mask still needs a new poll.
+		 */
+		if (events == evu->kernel_events && !evu->was_deleted)
+			goto next;
+
+		if (evu->kernel_events != 0) {
+			if ((sqe = uring_get_sqe(uringop)) == NULL) {
+				event_warnx("%s: submission queue full",
+				    __func__);
+				goto next;
+			}
+			sqe->opcode = IORING_OP_POLL_REMOVE;
+			sqe->fd = -1;
+			sqe->addr = URING_UDATA(fd, evu->gen);
+			sqe->user_data = URING_UDATA_IGNORE;
+			evu->kernel_events = 0;
+		}
+
+		if (events != 0) {
+			if ((sqe = uring_get_sqe(uringop)) == NULL) {
+				event_warnx("%s: submission queue full",
+				    __func__);
+				goto next;
+			}
+			evu->gen = ++uringop->gen & URING_GEN_MASK;
+			sqe->opcode = IORING_OP_POLL_ADD;
+			sqe->fd = fd;
+			sqe->poll32_events = events;
+			if (et)
+				sqe->len = IORING_POLL_ADD_MULTI;
+			sqe->user_data = URING_UDATA(fd, evu->gen);
+			evu->kernel_events = events;
+		}
+	next:
+		evu->changed = 0;
+		evu->was_deleted = 0;
+	}
+	uringop->nchanges = 0;
+}
+
+static void
+uring_complete(struct uringop *uringop, struct evuring_req *req,
+    struct io_uring_cqe *cqe)
+{
+	if (!(cqe->flags & IORING_CQE_F_MORE)) {
+		TAILQ_REMOVE(&uringop->reqs, req, next);
+		req->inflight = 0;
+		event_base_del_virtual(uringop->base);
+	}
+	(*req->cb)(req, cqe->res, cqe->flags);
+}
+
+static int
+uring_dispatch(struct event_base *base, void *arg, struct timeval *tv)
+{
+	struct uringop *uringop = arg;
+	struct io_uring_cqe *cqe;
+	struct evuring *evu;
+	struct event *ev;
+	unsigned head, tail;
+	int res, fd, what, nevents = 0;
+	ev_uint64_t udata;
+
+	if (uringop->nchanges)
+		uring_apply_changes(uringop);
+
+	EVBASE_RELEASE_LOCK(base);
+
+	if (tv != NULL && !evutil_timerisset(tv))
+		res = uring_submit(uringop, 0, NULL);
+	else
+		res = uring_submit(uringop, 1, tv);
+
+	EVBASE_ACQUIRE_LOCK(base);
+
+	if (res == -1) {
+		if (errno == EINTR) {
+			evsignal_process(base);
+		} else if (errno != ETIME && errno != EBUSY &&
+		    errno != EAGAIN) {
+			event_warn("io_uring_enter");
+			return (-1);
+		}
+	} else if (base->sig.evsignal_caught) {
+		evsignal_process(base);
+	}
+
+	head = *uringop->cq_head;
+	tail = __atomic_load_n(uringop->cq_tail, __ATOMIC_ACQUIRE);
+	for (; head != tail; head++) {
+		cqe = &uringop->cqes[head & uringop->cq_mask];
+		udata = cqe->user_data;
+		if (udata == URING_UDATA_IGNORE)
+			continue;
+		if (udata & URING_UDATA_REQ) {
+			uring_complete(uringop, (struct evuring_req *)
+			    (uintptr_t)(udata & ~URING_UDATA_REQ), cqe);
+			continue;
+		}
+
+		fd = (int)(ev_uint32_t)udata;
+		if ((evu = uring_fd_lookup(uringop, fd)) == NULL)
+			continue;
+		if (evu->kernel_events == 0 ||
+		    evu->gen != (ev_uint32_t)(udata >> 32))
+			continue;	/* a poll we have removed */
+
+		if (!(cqe->flags & IORING_CQE_F_MORE)) {
+			/* the poll is done; arm a new one on the next wait */
+			evu->kernel_events = 0;
+			if (!TAILQ_EMPTY(&evu->events))
+				uring_note_change(uringop, fd);
+		}
+
+		if (cqe->res < 0) {
+			if (cqe->res != -ECANCELED) {
+				errno = -cqe->res;
+				event_warn("%s: poll on fd %d", __func__, fd);
+			}
+			continue;
+		}
+
+		what = cqe->res;
+		if (what & (POLLHUP|POLLERR|POLLNVAL)) {
+			what = EV_READ|EV_WRITE;
+		} else {
+			what = ((what & POLLIN) ? EV_READ : 0) |
+			    ((what & POLLOUT) ? EV_WRITE : 0);
+		}
+
+		TAILQ_FOREACH(ev, &evu->events, ev_io_next) {
+			if (ev->ev_events & what)
+				event_active_nolock(base, ev,
+				    ev->ev_events & what, 1);
+		}
+		nevents++;
+	}
+	__atomic_store_n(uringop->cq_head, head, __ATOMIC_RELEASE);
+
+	event_debug(("%s: io_uring reports %d", __func__, nevents));
+
+	return (0);
+}
+
+static int
+uring_add(void *arg, struct event *ev)
+{
+	struct uringop *uringop = arg;
+	struct evuring *evu;
+	int fd;
+
+	if (ev->ev_events & EV_SIGNAL) {
+		if (ev->ev_events & EV_ET) {
+			errno = EINVAL;
+			return (-1);
+		}
+		return (evsignal_add(ev));
+	}
+
+	if ((ev->ev_events & EV_ET) && !uringop->multishot) {
+		errno = EINVAL;
+		return (-1);
+	}
+
+	fd = ev->ev_fd;
+	if ((evu = uring_fd_get(uringop, fd)) == NULL)
+		return (-1);
+
+	/* one poll watches the fd, so the events must agree */
+	if (!TAILQ_EMPTY(&evu->events) &&
+	    uring_fd_is_et(evu) != ((ev->ev_events & EV_ET) != 0)) {
+		event_warnx("%s: mixing edge- and level-triggered events "
+		    "on fd %d", __func__, fd);
+		errno = EINVAL;
+		return (-1);
+	}
+
+	if (uring_note_change(uringop, fd) == -1)
+		return (-1);
+
+	TAILQ_INSERT_TAIL(&evu->events, ev, ev_io_next);
+	if (ev->ev_events & EV_READ)
+		evu->nread++;
+	if (ev->ev_events & EV_WRITE)
+		evu->nwrite++;
+
+	return (0);
+}
+
+static int
+uring_del(void *arg, struct event *ev)
+{
+	struct uringop *uringop = arg;
+	struct evuring *evu;
+	int fd;
+
+	if (ev->ev_events & EV_SIGNAL)
+		return (evsignal_del(ev));
+
+	fd = ev->ev_fd;
+	if ((evu = uring_fd_lookup(uringop, fd)) == NULL)
+		return (0);
+
+	TAILQ_REMOVE(&evu->events, ev, ev_io_next);
+	if (ev->ev_events & EV_READ)
+		evu->nread--;
+	if (ev->ev_events & EV_WRITE)
+		evu->nwrite--;
+
+	if (TAILQ_EMPTY(&evu->events))
+		evu->was_deleted = 1;
+	return (uring_note_change(uringop, fd));
+}
+
+static void
+uring_dealloc(struct event_base *base, void *arg)
+{
+	struct uringop *uringop = arg;
+	struct evuring_req *req;
+	int i;
+
+	/* requests whose owners went away wait for this to be freed */
+	while ((req = TAILQ_FIRST(&uringop->reqs)) != NULL) {
+		TAILQ_REMOVE(&uringop->reqs, req, next);
+		req->inflight = 0;
+		event_base_del_virtual(base);
+		(*req->cb)(req, -ECANCELED, EVURING_F_GONE);
+	}
+
+	evsignal_dealloc(base);
+	if (uringop->bufring)
+		munmap(uringop->bufring,
+		    URING_NBUFS * sizeof(struct io_uring_buf));
+	if (uringop->bufmem)
+		mm_free(uringop->bufmem, EVENT_MEM_EVENT);
+	for (i = 0; i < uringop->npages; ++i)
+		mm_free(uringop->pages[i], EVENT_MEM_EVENT);
+	if (uringop->pages)
+		mm_free(uringop->pages, EVENT_MEM_EVENT);
+	if (uringop->changes)
+		mm_free(uringop->changes, EVENT_MEM_EVENT);
+	if (uringop->sqes)
+		munmap(uringop->sqes, uringop->sqes_size);
+	if (uringop->ring)
+		munmap(uringop->ring, uringop->ring_size);
+	if (uringop->ringfd >= 0)
+		close(uringop->ringfd);
+
+	memset(uringop, 0, sizeof(struct uringop));
+	mm_free(uringop, EVENT_MEM_EVENT);
+}
+
+struct uringop *
+evuring_get(struct event_base *base)
+{
+	if (base == NULL || base->evsel != &uringops)
+		return (NULL);
+	return (base->evbase);
+}
+
+static void
+uring_buffer_add(struct uringop *uringop, unsigned bid)
+{
+	struct io_uring_buf *buf;
+
+	buf = &uringop->bufring->bufs[uringop->buf_tail & (URING_NBUFS - 1)];
+	buf->addr = (ev_uint64_t)(uintptr_t)
+	    (uringop->bufmem + (size_t)bid * URING_BUFSIZE);
+	buf->len = URING_BUFSIZE;
+	buf->bid = bid;
+	uringop->buf_tail++;
+	__atomic_store_n(&uringop->bufring->tail,
+	    (ev_uint16_t)uringop->buf_tail, __ATOMIC_RELEASE);
+}
+
+/* Registers the provided buffer ring; needs Linux 5.19 */
+int
+evuring_buffers_init(struct uringop *uringop)
+{
+	struct io_uring_buf_reg reg;
+	void *ring;
+	unsigned i;
+
+	if (uringop->bufring_state != 0)
+		return (uringop->bufring_state == 1 ? 0 : -1);
+	uringop->bufring_state = -1;
+
+	/* the ring must be page aligned */
+	ring = mmap(NULL, URING_NBUFS * sizeof(struct io_uring_buf),
+	    PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (ring == MAP_FAILED) {
+		event_warn("mmap");
+		return (-1);
+	}
+	if ((uringop->bufmem = mm_malloc(URING_NBUFS * URING_BUFSIZE,
+	    EVENT_MEM_EVENT)) == NULL) {
+		munmap(ring, URING_NBUFS * sizeof(struct io_uring_buf));
+		return (-1);
+	}
+
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (ev_uint64_t)(uintptr_t)ring;
+	reg.ring_entries = URING_NBUFS;
+	reg.bgid = URING_BGID;
+	if (syscall(__NR_io_uring_register, uringop->ringfd,
+		IORING_REGISTER_PBUF_RING, &reg, 1) == -1) {
+		munmap(ring, URING_NBUFS * sizeof(struct io_uring_buf));
+		mm_free(uringop->bufmem, EVENT_MEM_EVENT);
+		uringop->bufmem = NULL;
+		return (-1);
+	}
+
+	uringop->bufring = ring;
+	for (i = 0; i < URING_NBUFS; ++i)
+		uring_buffer_add(uringop, i);
+	uringop->bufring_state = 1;
+	return (0);
+}
+
+static struct io_uring_sqe *
+uring_req_sqe(struct uringop *uringop, struct evuring_req *req)
+{
+	struct io_uring_sqe *sqe;
+
+	if (req->inflight) {
+		errno = EBUSY;
+		return (NULL);
+	}
+	if ((sqe = uring_get_sqe(uringop)) == NULL) {
+		errno = EAGAIN;
+		return (NULL);
+	}
+	sqe->user_data = URING_UDATA_REQ | (ev_uint64_t)(uintptr_t)req;
+	TAILQ_INSERT_TAIL(&uringop->reqs, req, next);
+	req->inflight = 1;
+	event_base_add_virtual(uringop->base);
+	return (sqe);
+}
+
+int
+evuring_recv(struct uringop *uringop, struct evuring_req *req, int fd)
+{
+	struct io_uring_sqe *sqe;
+
+	if (evuring_buffers_init(uringop) == -1) {
+		errno = EOPNOTSUPP;
+		return (-1);
+	}
+	if ((sqe = uring_req_sqe(uringop, req)) == NULL)
+		return (-1);
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = fd;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = URING_BGID;
+	return (0);
+}
+
+int
+evuring_send(struct uringop *uringop, struct evuring_req *req, int fd,
+    const void *buf, size_t len)
+{
+	struct io_uring_sqe *sqe;
+
+	if ((sqe = uring_req_sqe(uringop, req)) == NULL)
+		return (-1);
+	sqe->opcode = IORING_OP_SEND;
+	sqe->fd = fd;
+	sqe->addr = (ev_uint64_t)(uintptr_t)buf;
+	sqe->len = len;
+	return (0);
+}
+
+int
+evuring_cancel(struct uringop *uringop, struct evuring_req *req)
+{
+	struct io_uring_sqe *sqe;
+
+	if (!req->inflight)
+		return (0);
+	if ((sqe = uring_get_sqe(uringop)) == NULL)
+		return (-1);
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = -1;
+	sqe->addr = URING_UDATA_REQ | (ev_uint64_t)(uintptr_t)req;
+	sqe->user_data = URING_UDATA_IGNORE;
+	return (0);
+}
+
+const void *
+evuring_buffer(struct uringop *uringop, unsigned flags)
+{
+	unsigned bid = flags >> IORING_CQE_BUFFER_SHIFT;
+
+	if (!(flags & IORING_CQE_F_BUFFER) || bid >= URING_NBUFS)
+		return (NULL);
+	return (uringop->bufmem + (size_t)bid * URING_BUFSIZE);
+}
+
+void
+evuring_buffer_release(struct uringop *uringop, unsigned flags)
+{
+	unsigned bid = flags >> IORING_CQE_BUFFER_SHIFT;
+
+	if ((flags & IORING_CQE_F_BUFFER) && bid < URING_NBUFS)
+		uring_buffer_add(uringop, bid);
+}
+
+#else /* the headers are too old for the backend */
+
+static void *
+uring_init(struct event_base *base)
+{
+	return (NULL);
+}
+
+const struct eventop uringops = {
+	"io_uring",
+	uring_init,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	0
+};
+
+struct uringop *
+evuring_get(struct event_base *base)
+{
+	return (NULL);
+}
+
+int
+evuring_buffers_init(struct uringop *uringop)
+{
+	return (-1);
+}
+
+int
+evuring_recv(struct uringop *uringop, struct evuring_req *req, int fd)
+{
+	return (-1);
+}
+
+int
+evuring_send(struct uringop *uringop, struct evuring_req *req, int fd,
+    const void *buf, size_t len)
+{
+	return (-1);
+}
+
+int
+evuring_cancel(struct uringop *uringop, struct evuring_req *req)
+{
+	return (-1);
+}
+
+const void *
+evuring_buffer(struct uringop *uringop, unsigned flags)
+{
+	return (NULL);
+}
+
+void
+evuring_buffer_release(struct uringop *uringop, unsigned flags)
+{
+}
+
+#endif /* IORING_SETUP_SQE128 */
+#endif /* HAVE_IO_URING */
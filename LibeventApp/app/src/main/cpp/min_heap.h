@@ -29,6 +29,7 @@
 
 #include "event.h"
 #include "evutil.h"
+#include "mm-internal.h"
 
 typedef struct min_heap
 {
@@ -56,7 +57,7 @@ int min_heap_elem_greater(struct event *a, struct event *b)
 }
 
 void min_heap_ctor(min_heap_t* s) { s->p = 0; s->n = 0; s->a = 0; }
-void min_heap_dtor(min_heap_t* s) { if(s->p) free(s->p); }
+void min_heap_dtor(min_heap_t* s) { if(s->p) mm_free(s->p, EVENT_MEM_EVENT); }
 void min_heap_elem_init(struct event* e) { e->min_heap_idx = -1; }
 int min_heap_empty(min_heap_t* s) { return 0u == s->n; }
 unsigned min_heap_size(min_heap_t* s) { return s->n; }
@@ -111,7 +112,7 @@ int min_heap_reserve(min_heap_t* s, unsigned n)
         unsigned a = s->a ? s->a * 2 : 8;
         if(a < n)
             a = n;
-        if(!(p = (struct event**)realloc(s->p, a * sizeof *p)))
+        if(!(p = (struct event**)mm_realloc(s->p, a * sizeof *p, EVENT_MEM_EVENT)))
             return -1;
         s->p = p;
         s->a = a;
@@ -0,0 +1,181 @@
+/*
+ * Copyright (c) 2026 The LibeventApp authors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _MIN_HEAP4_H_
+#define _MIN_HEAP4_H_
+
+#include "event.h"
+#include "evutil.h"
+#include "mm-internal.h"
+
+#include <string.h>
+
+/*
+ * A 4-ary min-heap that stores the deadline of every event as a 64-bit
+ * nanosecond key next to the event pointer.  Sifting compares keys in the
+ * array itself instead of reading ev_timeout through every pointer.  The
+ * children of node i are 4i+1..4i+4; the array is aligned to a cache line
+ * and the root is put into the last entry of the line before it, so with
+ * 16-byte entries each group of four siblings fills exactly one line and
+ * one level of the heap costs a single one.  The position of an event is
+ * kept in ev->min_heap_idx exactly like with min_heap.h.
+ */
+
+#define MIN_HEAP4_ALIGN	64
+
+typedef struct min_heap4_entry
+{
+    ev_uint64_t key;
+    struct event* ev;
+} min_heap4_entry_t;
+
+typedef struct min_heap4
+{
+    min_heap4_entry_t* p;
+    char* mem;          /* as allocated, before aligning */
+    unsigned n, a;
+} min_heap4_t;
+
+static inline void           min_heap4_ctor(min_heap4_t* s);
+static inline void           min_heap4_dtor(min_heap4_t* s);
+static inline ev_uint64_t    min_heap4_key(const struct timeval* tv);
+static inline int            min_heap4_empty(min_heap4_t* s);
+static inline unsigned       min_heap4_size(min_heap4_t* s);
+static inline struct event*  min_heap4_top(min_heap4_t* s);
+static inline int            min_heap4_reserve(min_heap4_t* s, unsigned n);
+static inline int            min_heap4_push(min_heap4_t* s, struct event* e);
+static inline struct event*  min_heap4_pop(min_heap4_t* s);
+static inline int            min_heap4_erase(min_heap4_t* s, struct event* e);
+static inline void           min_heap4_shift_up_(min_heap4_t* s, unsigned hole_index, min_heap4_entry_t x);
+static inline void           min_heap4_shift_down_(min_heap4_t* s, unsigned hole_index, min_heap4_entry_t x);
+
+ev_uint64_t min_heap4_key(const struct timeval* tv)
+{
+    return (ev_uint64_t)tv->tv_sec * 1000000000 + (ev_uint64_t)tv->tv_usec * 1000;
+}
+
+void min_heap4_ctor(min_heap4_t* s) { s->p = 0; s->mem = 0; s->n = 0; s->a = 0; }
+void min_heap4_dtor(min_heap4_t* s) { if(s->mem) mm_free(s->mem, EVENT_MEM_EVENT); }
+int min_heap4_empty(min_heap4_t* s) { return 0u == s->n; }
+unsigned min_heap4_size(min_heap4_t* s) { return s->n; }
+struct event* min_heap4_top(min_heap4_t* s) { return s->n ? s->p->ev : 0; }
+
+int min_heap4_push(min_heap4_t* s, struct event* e)
+{
+    min_heap4_entry_t x;
+    if(min_heap4_reserve(s, s->n + 1))
+        return -1;
+    x.key = min_heap4_key(&e->ev_timeout);
+    x.ev = e;
+    min_heap4_shift_up_(s, s->n++, x);
+    return 0;
+}
+
+struct event* min_heap4_pop(min_heap4_t* s)
+{
+    if(s->n)
+    {
+        struct event* e = s->p->ev;
+        min_heap4_shift_down_(s, 0u, s->p[--s->n]);
+        e->min_heap_idx = -1;
+        return e;
+    }
+    return 0;
+}
+
+int min_heap4_erase(min_heap4_t* s, struct event* e)
+{
+    if(((unsigned int)-1) != e->min_heap_idx)
+    {
+        min_heap4_entry_t last = s->p[--s->n];
+        unsigned parent = (e->min_heap_idx - 1) / 4;
+        /* as in min_heap_erase(), last moves either up or down */
+        if (e->min_heap_idx > 0 && s->p[parent].key > last.key)
+             min_heap4_shift_up_(s, e->min_heap_idx, last);
+        else
+             min_heap4_shift_down_(s, e->min_heap_idx, last);
+        e->min_heap_idx = -1;
+        return 0;
+    }
+    return -1;
+}
+
+int min_heap4_reserve(min_heap4_t* s, unsigned n)
+{
+    if(s->a < n)
+    {
+        min_heap4_entry_t* p;
+        char* mem;
+        unsigned a = s->a ? s->a * 2 : 8;
+        if(a < n)
+            a = n;
+        /* realloc() could move the array off the alignment */
+        if(!(mem = (char*)mm_malloc(a * sizeof *p + 2 * MIN_HEAP4_ALIGN - 1, EVENT_MEM_EVENT)))
+            return -1;
+        p = (min_heap4_entry_t*)(mem + (MIN_HEAP4_ALIGN -
+            (size_t)mem % MIN_HEAP4_ALIGN) % MIN_HEAP4_ALIGN +
+            MIN_HEAP4_ALIGN - sizeof *p);
+        if(s->n)
+            memcpy(p, s->p, s->n * sizeof *p);
+        if(s->mem)
+            mm_free(s->mem, EVENT_MEM_EVENT);
+        s->p = p;
+        s->mem = mem;
+        s->a = a;
+    }
+    return 0;
+}
+
+void min_heap4_shift_up_(min_heap4_t* s, unsigned hole_index, min_heap4_entry_t x)
+{
+    unsigned parent = (hole_index - 1) / 4;
+    while(hole_index && s->p[parent].key > x.key)
+    {
+        (s->p[hole_index] = s->p[parent]).ev->min_heap_idx = hole_index;
+        hole_index = parent;
+        parent = (hole_index - 1) / 4;
+    }
+    (s->p[hole_index] = x).ev->min_heap_idx = hole_index;
+}
+
+void min_heap4_shift_down_(min_heap4_t* s, unsigned hole_index, min_heap4_entry_t x)
+{
+    unsigned child, min_child, end;
+    while((child = 4 * hole_index + 1) < s->n)
+    {
+        end = child + 4 < s->n ? child + 4 : s->n;
+        for(min_child = child++; child < end; ++child)
+            if(s->p[child].key < s->p[min_child].key)
+                min_child = child;
+        if(s->p[min_child].key >= x.key)
+            break;
+        (s->p[hole_index] = s->p[min_child]).ev->min_heap_idx = hole_index;
+        hole_index = min_child;
+    }
+    (s->p[hole_index] = x).ev->min_heap_idx = hole_index;
+}
+
+#endif /* _MIN_HEAP4_H_ */
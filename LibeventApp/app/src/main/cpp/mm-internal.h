@@ -0,0 +1,35 @@
+#ifndef _MM_INTERNAL_H_
+#define _MM_INTERNAL_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <sys/types.h>
+
+/*
+ * Allocation for the library, see event_set_mem_functions().  Each takes
+ * the EVENT_MEM_* tag of the subsystem as its last argument, and memory
+ * has to be released with the tag it was allocated with.
+ */
+void *event_mm_malloc_(size_t sz, int tag);
+void *event_mm_calloc_(size_t count, size_t size, int tag);
+char *event_mm_strdup_(const char *str, int tag);
+void *event_mm_realloc_(void *ptr, size_t sz, int tag);
+void event_mm_free_(void *ptr, int tag);
+
+#define mm_malloc(sz, tag)		event_mm_malloc_(sz, tag)
+#define mm_calloc(count, size, tag)	event_mm_calloc_(count, size, tag)
+#define mm_strdup(str, tag)		event_mm_strdup_(str, tag)
+#define mm_realloc(ptr, sz, tag)	event_mm_realloc_(ptr, sz, tag)
+#define mm_free(ptr, tag)		event_mm_free_(ptr, tag)
+
+struct evbuffer;
+/* evbuffer_readline() with the line from mm_malloc(), defined in buffer.c */
+char *evbuffer_readline_mm(struct evbuffer *buffer, int tag);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
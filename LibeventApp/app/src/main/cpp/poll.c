@@ -52,12 +52,15 @@
 #include "event-internal.h"
 #include "evsignal.h"
 #include "log.h"
+#include "mm-internal.h"
 
 struct pollop {
 	int event_count;		/* Highest number alloc */
 	int nfds;                       /* Size of event_* */
 	int fd_count;                   /* Size of idxplus1_by_fd */
 	struct pollfd *event_set;
+	struct pollfd *event_set_copy;	/* What poll() sees when locked */
+	int event_copy_count;		/* Size of event_set_copy */
 	struct event **event_r_back;
 	struct event **event_w_back;
 	int *idxplus1_by_fd; /* Index into event_set by fd; we add 1 so
@@ -90,7 +93,7 @@ poll_init(struct event_base *base)
 	if (evutil_getenv("EVENT_NOPOLL"))
 		return (NULL);
 
-	if (!(pollop = calloc(1, sizeof(struct pollop))))
+	if (!(pollop = mm_calloc(1, sizeof(struct pollop), EVENT_MEM_EVENT)))
 		return (NULL);
 
 	evsignal_init(base);
@@ -137,6 +140,7 @@ poll_dispatch(struct event_base *base, void *arg, struct timeval *tv)
 {
 	int res, i, j, msec = -1, nfds;
 	struct pollop *pop = arg;
+	struct pollfd *event_set;
 
 	poll_check_ok(pop);
 
@@ -144,7 +148,34 @@ poll_dispatch(struct event_base *base, void *arg, struct timeval *tv)
 		msec = tv->tv_sec * 1000 + (tv->tv_usec + 999) / 1000;
 
 	nfds = pop->nfds;
-	res = poll(pop->event_set, nfds, msec);
+
+	if (base->th_base_lock != NULL) {
+		/*
+		 * Other threads may change event_set while we are in poll(),
+		 * so wait on a private copy and map the results back by fd.
+		 */
+		if (pop->event_copy_count < pop->event_count) {
+			struct pollfd *tmp = mm_realloc(pop->event_set_copy,
+			    pop->event_count * sizeof(struct pollfd),
+			    EVENT_MEM_EVENT);
+			if (tmp == NULL) {
+				event_warn("realloc");
+				return (-1);
+			}
+			pop->event_set_copy = tmp;
+			pop->event_copy_count = pop->event_count;
+		}
+		event_set = pop->event_set_copy;
+		memcpy(event_set, pop->event_set,
+		    nfds * sizeof(struct pollfd));
+	} else
+		event_set = pop->event_set;
+
+	EVBASE_RELEASE_LOCK(base);
+
+	res = poll(event_set, nfds, msec);
+
+	EVBASE_ACQUIRE_LOCK(base);
 
 	if (res == -1) {
 		if (errno != EINTR) {
@@ -166,14 +197,23 @@ poll_dispatch(struct event_base *base, void *arg, struct timeval *tv)
 	i = random() % nfds;
 	for (j = 0; j < nfds; j++) {
 		struct event *r_ev = NULL, *w_ev = NULL;
-		int what;
+		int what, idx;
 		if (++i == nfds)
 			i = 0;
-		what = pop->event_set[i].revents;
+		what = event_set[i].revents;
 
 		if (!what)
 			continue;
 
+		if (event_set != pop->event_set) {
+			/* the fd may have moved or gone away meanwhile */
+			int fd = event_set[i].fd;
+			if (fd >= pop->fd_count ||
+			    (idx = pop->idxplus1_by_fd[fd] - 1) < 0)
+				continue;
+		} else
+			idx = i;
+
 		res = 0;
 
 		/* If the file gets closed notify */
@@ -181,20 +221,22 @@ poll_dispatch(struct event_base *base, void *arg, struct timeval *tv)
 			what |= POLLIN|POLLOUT;
 		if (what & POLLIN) {
 			res |= EV_READ;
-			r_ev = pop->event_r_back[i];
+			r_ev = pop->event_r_back[idx];
 		}
 		if (what & POLLOUT) {
 			res |= EV_WRITE;
-			w_ev = pop->event_w_back[i];
+			w_ev = pop->event_w_back[idx];
 		}
 		if (res == 0)
 			continue;
 
 		if (r_ev && (res & r_ev->ev_events)) {
-			event_active(r_ev, res & r_ev->ev_events, 1);
+			event_active_nolock(base, r_ev,
+			    res & r_ev->ev_events, 1);
 		}
 		if (w_ev && w_ev != r_ev && (res & w_ev->ev_events)) {
-			event_active(w_ev, res & w_ev->ev_events, 1);
+			event_active_nolock(base, w_ev,
+			    res & w_ev->ev_events, 1);
 		}
 	}
 
@@ -208,6 +250,11 @@ poll_add(void *arg, struct event *ev)
 	struct pollfd *pfd = NULL;
 	int i;
 
+	/* poll(2) has no notion of edges */
+	if (ev->ev_events & EV_ET) {
+		errno = EINVAL;
+		return (-1);
+	}
 	if (ev->ev_events & EV_SIGNAL)
 		return (evsignal_add(ev));
 	if (!(ev->ev_events & (EV_READ|EV_WRITE)))
@@ -226,16 +273,18 @@ poll_add(void *arg, struct event *ev)
 			tmp_event_count = pop->event_count * 2;
 
 		/* We need more file descriptors */
-		tmp_event_set = realloc(pop->event_set,
-				 tmp_event_count * sizeof(struct pollfd));
+		tmp_event_set = mm_realloc(pop->event_set,
+				 tmp_event_count * sizeof(struct pollfd),
+				 EVENT_MEM_EVENT);
 		if (tmp_event_set == NULL) {
 			event_warn("realloc");
 			return (-1);
 		}
 		pop->event_set = tmp_event_set;
 
-		tmp_event_r_back = realloc(pop->event_r_back,
-			    tmp_event_count * sizeof(struct event *));
+		tmp_event_r_back = mm_realloc(pop->event_r_back,
+			    tmp_event_count * sizeof(struct event *),
+			    EVENT_MEM_EVENT);
 		if (tmp_event_r_back == NULL) {
 			/* event_set overallocated; that's okay. */
 			event_warn("realloc");
@@ -243,8 +292,9 @@ poll_add(void *arg, struct event *ev)
 		}
 		pop->event_r_back = tmp_event_r_back;
 
-		tmp_event_w_back = realloc(pop->event_w_back,
-			    tmp_event_count * sizeof(struct event *));
+		tmp_event_w_back = mm_realloc(pop->event_w_back,
+			    tmp_event_count * sizeof(struct event *),
+			    EVENT_MEM_EVENT);
 		if (tmp_event_w_back == NULL) {
 			/* event_set and event_r_back overallocated; that's
 			 * okay. */
@@ -265,7 +315,8 @@ poll_add(void *arg, struct event *ev)
 		while (new_count <= ev->ev_fd)
 			new_count *= 2;
 		tmp_idxplus1_by_fd =
-			realloc(pop->idxplus1_by_fd, new_count * sizeof(int));
+			mm_realloc(pop->idxplus1_by_fd, new_count * sizeof(int),
+			    EVENT_MEM_EVENT);
 		if (tmp_idxplus1_by_fd == NULL) {
 			event_warn("realloc");
 			return (-1);
@@ -366,14 +417,16 @@ poll_dealloc(struct event_base *base, void *arg)
 
 	evsignal_dealloc(base);
 	if (pop->event_set)
-		free(pop->event_set);
+		mm_free(pop->event_set, EVENT_MEM_EVENT);
+	if (pop->event_set_copy)
+		mm_free(pop->event_set_copy, EVENT_MEM_EVENT);
 	if (pop->event_r_back)
-		free(pop->event_r_back);
+		mm_free(pop->event_r_back, EVENT_MEM_EVENT);
 	if (pop->event_w_back)
-		free(pop->event_w_back);
+		mm_free(pop->event_w_back, EVENT_MEM_EVENT);
 	if (pop->idxplus1_by_fd)
-		free(pop->idxplus1_by_fd);
+		mm_free(pop->idxplus1_by_fd, EVENT_MEM_EVENT);
 
 	memset(pop, 0, sizeof(struct pollop));
-	free(pop);
+	mm_free(pop, EVENT_MEM_EVENT);
 }
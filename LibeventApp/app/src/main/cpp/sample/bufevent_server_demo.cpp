@@ -21,6 +21,7 @@
 #endif
 
 #include "demo.h"
+#include "evgroup.h"
 
 typedef int ev_socklen_t;
 typedef int evutil_socket_t;
@@ -55,6 +56,39 @@ int main_server(int argc, char** argv)
     return 0;
 }
 
+//每个线程一个event_base, 每个线程各自监听(SO_REUSEPORT), 连接留在accept它的线程上
+static void group_accept_cb(struct event_base *base, int fd,
+                            struct sockaddr *addr, int socklen, void *arg)
+{
+    printf("shard %p accept a client %d\n", base, fd);
+
+    bufferevent* bev = bufferevent_new(fd, socket_read_cb, NULL, event_cb, arg);
+    bufferevent_base_set(base, bev);
+    bufferevent_enable(bev, EV_READ | EV_PERSIST);
+}
+
+int main_server_group(int nthreads)
+{
+    struct evgroup* group = evgroup_new(nthreads);
+    if( group == NULL )
+        return -1;
+
+    for(int i = 0 ; i < nthreads ; ++i)
+        evgroup_set_cpu(group, i, i);
+
+    if( evgroup_bind_socket(group, NULL, 9999, group_accept_cb, NULL) == -1 )
+    {
+        perror(" evgroup_bind_socket error ");
+        evgroup_free(group);
+        return -1;
+    }
+
+    evgroup_dispatch(group);
+    evgroup_free(group);
+
+    return 0;
+}
+
 void accept_cb(int fd, short events, void* arg)
 {
     int sockfd;
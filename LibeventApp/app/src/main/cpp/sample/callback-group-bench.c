@@ -0,0 +1,220 @@
+/*
+ * Measures callbacks per second when the active queue mixes many kinds of
+ * handlers, with and without EVENT_BASE_FLAG_GROUP_CALLBACKS.  Each of
+ * the -k handlers has a lot of code of its own, like the read callbacks
+ * of different protocols, and the n events are spread over them
+ * and made active in random order, like ready sockets come in.
+ *
+ * Where the hardware counters are accessible with perf_event_open() the
+ * instruction cache misses per callback are reported as well.
+ *
+ * Compile with:
+ * cc -I/usr/local/include -o callback-group-bench callback-group-bench.c -L/usr/local/lib -levent
+ */
+
+#include <sys/types.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/time.h>
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <event.h>
+#include <evutil.h>
+
+#define ROUNDS		20
+#define MAX_HANDLERS	16
+
+static long ncallbacks;
+
+/*
+ * About 15k of code per handler, with branches and constants of its own,
+ * so that the handlers compete for the instruction cache and the branch
+ * predictor.
+ */
+#define STEP(k)		if ((x >> ((k) & 63)) & 1)			\
+				x = (x >> 1) + (k);			\
+			else						\
+				x = (x << 1) ^ (k) * 0x9e3779b97f4a7c15ULL;
+#define STEP4(k)	STEP(k) STEP((k) + 1) STEP((k) + 2) STEP((k) + 3)
+#define STEP16(k)	STEP4(k) STEP4((k) + 4) STEP4((k) + 8) STEP4((k) + 12)
+#define STEP64(k)	STEP16(k) STEP16((k) + 16) STEP16((k) + 32) \
+			STEP16((k) + 48)
+#define STEP256(k)	STEP64(k) STEP64((k) + 64) STEP64((k) + 128) \
+			STEP64((k) + 192)
+
+#define HANDLER(n)							\
+static void								\
+handler_##n(int fd, short event, void *arg)				\
+{									\
+	ev_uint64_t *state = arg;					\
+	ev_uint64_t x = *state;						\
+									\
+	STEP256((n) * 1000)						\
+	*state = x;							\
+	ncallbacks++;							\
+}
+
+HANDLER(0) HANDLER(1) HANDLER(2) HANDLER(3)
+HANDLER(4) HANDLER(5) HANDLER(6) HANDLER(7)
+HANDLER(8) HANDLER(9) HANDLER(10) HANDLER(11)
+HANDLER(12) HANDLER(13) HANDLER(14) HANDLER(15)
+
+static void (*handlers[MAX_HANDLERS])(int, short, void *) = {
+	handler_0, handler_1, handler_2, handler_3,
+	handler_4, handler_5, handler_6, handler_7,
+	handler_8, handler_9, handler_10, handler_11,
+	handler_12, handler_13, handler_14, handler_15
+};
+
+static int
+counter_open(void)
+{
+#ifdef __linux__
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HW_CACHE;
+	attr.config = PERF_COUNT_HW_CACHE_L1I |
+	    (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+	    (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	return ((int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+#else
+	return (-1);
+#endif
+}
+
+static void
+counter_enable(int fd, int on)
+{
+#ifdef __linux__
+	if (fd != -1)
+		ioctl(fd, on ? PERF_EVENT_IOC_ENABLE : PERF_EVENT_IOC_DISABLE, 0);
+#endif
+}
+
+static long long
+counter_read(int fd)
+{
+	long long value;
+
+	if (fd == -1 || read(fd, &value, sizeof(value)) != sizeof(value))
+		return (-1);
+	return (value);
+}
+
+static void
+run(int flags, int n, int nhandlers, const int *order, ev_uint64_t *state)
+{
+	struct event_base *base;
+	struct event **events;
+	struct timeval start, end;
+	long long misses;
+	double usec;
+	int i, j, misses_fd;
+
+	base = event_base_new_with_flags(flags);
+	events = calloc(n, sizeof(struct event *));
+	for (i = 0; i < n; i++)
+		events[i] = event_new(base, -1, 0,
+		    handlers[i % nhandlers], &state[i]);
+
+	misses_fd = counter_open();
+
+	/* warm up the queue */
+	for (j = 0; j < n; j++)
+		event_active(events[order[j]], EV_READ, 1);
+	event_base_loop(base, EVLOOP_ONCE|EVLOOP_NONBLOCK);
+	ncallbacks = 0;
+
+	gettimeofday(&start, NULL);
+	counter_enable(misses_fd, 1);
+	for (i = 0; i < ROUNDS; i++) {
+		for (j = 0; j < n; j++)
+			event_active(events[order[j]], EV_READ, 1);
+		event_base_loop(base, EVLOOP_ONCE|EVLOOP_NONBLOCK);
+	}
+	counter_enable(misses_fd, 0);
+	gettimeofday(&end, NULL);
+
+	evutil_timersub(&end, &start, &end);
+	usec = end.tv_sec * 1000000.0 + end.tv_usec;
+	misses = counter_read(misses_fd);
+
+	printf("%-8s %.0f callbacks/s, %.1f ns per callback",
+	    flags ? "grouped" : "plain", ncallbacks / usec * 1000000,
+	    usec * 1000 / ncallbacks);
+	if (misses != -1)
+		printf(", %.2f i-cache misses per callback",
+		    (double)misses / ncallbacks);
+	printf("\n");
+
+	if (misses_fd != -1)
+		close(misses_fd);
+	for (i = 0; i < n; i++)
+		event_free(events[i]);
+	event_base_free(base);
+	free(events);
+}
+
+int
+main(int argc, char **argv)
+{
+	ev_uint64_t *state;
+	int *order;
+	int c, i, j, tmp, n = 10000, nhandlers = MAX_HANDLERS;
+
+	while ((c = getopt(argc, argv, "k:n:")) != -1) {
+		switch (c) {
+		case 'k':
+			nhandlers = atoi(optarg);
+			break;
+		case 'n':
+			n = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-k handlers] [-n events]\n",
+			    argv[0]);
+			exit(1);
+		}
+	}
+	if (nhandlers < 1 || nhandlers > MAX_HANDLERS || n < 1) {
+		fprintf(stderr, "%s: 1 to %d handlers\n", argv[0],
+		    MAX_HANDLERS);
+		exit(1);
+	}
+
+	state = calloc(n, sizeof(ev_uint64_t));
+	order = calloc(n, sizeof(int));
+	for (i = 0; i < n; i++)
+		order[i] = i;
+	for (i = n - 1; i > 0; i--) {
+		j = random() % (i + 1);
+		tmp = order[i];
+		order[i] = order[j];
+		order[j] = tmp;
+	}
+
+	printf("%d events over %d handlers\n", n, nhandlers);
+	run(0, n, nhandlers, order, state);
+	run(EVENT_BASE_FLAG_GROUP_CALLBACKS, n, nhandlers, order, state);
+
+	free(state);
+	free(order);
+
+	return (0);
+}
@@ -43,16 +43,8 @@ extern "C" {
 typedef int ev_socklen_t;
 typedef int evutil_socket_t;
 
- struct event * event_new(struct event_base *pBase, int fd, int event, void (*cb)(int, short, void *), void *ctx);
-
 struct bufferevent *bufferevent_socket_new(struct event_base *pBase, int sockfd, int flag);
 
-int
-evutil_make_listen_socket_reuseable(int sock);
-
-int
-evutil_make_listen_socket_reuseable_port(evutil_socket_t sock);
-
 int
 evutil_closesocket(evutil_socket_t sock);
 
@@ -0,0 +1,188 @@
+/*
+ * Counts the cache misses per dispatched event.  n events are made
+ * active in random order and run by one loop iteration, which touches
+ * every event on the way into the active queue and again when its
+ * callback runs.  With -f the events wait for writable pipes instead, so
+ * they come out of the backend's dispatch.
+ *
+ * The misses are read from the hardware counters with perf_event_open();
+ * where those are not accessible only the time is reported.  To compare
+ * the layouts of struct event, build the library and this program once
+ * with and once without -D_EVENT_COMPACT_EVENT=1.
+ *
+ * Compile with:
+ * cc -I/usr/local/include -o event-cache-bench event-cache-bench.c -L/usr/local/lib -levent
+ */
+
+#include <sys/types.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/time.h>
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <event.h>
+#include <evutil.h>
+
+#define ROUNDS	20
+
+static long ncallbacks;
+
+static void
+count_cb(int fd, short event, void *arg)
+{
+	ncallbacks++;
+}
+
+static int
+counter_open(ev_uint64_t config)
+{
+#ifdef __linux__
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = config;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	return ((int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+#else
+	return (-1);
+#endif
+}
+
+static void
+counter_enable(int fd, int on)
+{
+#ifdef __linux__
+	if (fd != -1)
+		ioctl(fd, on ? PERF_EVENT_IOC_ENABLE : PERF_EVENT_IOC_DISABLE, 0);
+#endif
+}
+
+static long long
+counter_read(int fd)
+{
+	long long value;
+
+	if (fd == -1 || read(fd, &value, sizeof(value)) != sizeof(value))
+		return (-1);
+	return (value);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct event_base *base;
+	struct event **events;
+	struct timeval start, end;
+	int *order, (*pipes)[2] = NULL;
+	int c, i, j, tmp, n = 100000, use_fds = 0;
+	int misses_fd, refs_fd;
+	long long misses, refs;
+	double usec;
+
+	while ((c = getopt(argc, argv, "fn:")) != -1) {
+		switch (c) {
+		case 'f':
+			use_fds = 1;
+			break;
+		case 'n':
+			n = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-f] [-n events]\n",
+			    argv[0]);
+			exit(1);
+		}
+	}
+
+	base = event_base_new();
+	events = calloc(n, sizeof(struct event *));
+	order = calloc(n, sizeof(int));
+	if (use_fds)
+		pipes = calloc(n, sizeof(*pipes));
+
+	for (i = 0; i < n; i++) {
+		if (use_fds) {
+			if (pipe(pipes[i]) == -1) {
+				perror("pipe");
+				exit(1);
+			}
+			events[i] = event_new(base, pipes[i][1],
+			    EV_WRITE|EV_PERSIST, count_cb, NULL);
+			event_add(events[i], NULL);
+		} else
+			events[i] = event_new(base, -1, 0, count_cb, NULL);
+		order[i] = i;
+	}
+
+	/* activate in random order, like ready sockets come in */
+	for (i = n - 1; i > 0; i--) {
+		j = random() % (i + 1);
+		tmp = order[i];
+		order[i] = order[j];
+		order[j] = tmp;
+	}
+
+	misses_fd = counter_open(PERF_COUNT_HW_CACHE_MISSES);
+	refs_fd = counter_open(PERF_COUNT_HW_CACHE_REFERENCES);
+
+	/* warm up the queues and the backend */
+	event_base_loop(base, EVLOOP_ONCE|EVLOOP_NONBLOCK);
+	ncallbacks = 0;
+
+	gettimeofday(&start, NULL);
+	counter_enable(misses_fd, 1);
+	counter_enable(refs_fd, 1);
+	for (i = 0; i < ROUNDS; i++) {
+		if (!use_fds)
+			for (j = 0; j < n; j++)
+				event_active(events[order[j]], EV_TIMEOUT, 1);
+		event_base_loop(base, EVLOOP_ONCE|EVLOOP_NONBLOCK);
+	}
+	counter_enable(misses_fd, 0);
+	counter_enable(refs_fd, 0);
+	gettimeofday(&end, NULL);
+
+	evutil_timersub(&end, &start, &end);
+	usec = end.tv_sec * 1000000.0 + end.tv_usec;
+	misses = counter_read(misses_fd);
+	refs = counter_read(refs_fd);
+
+	printf("%s, struct event of %d bytes, abi %d, %ld callbacks\n",
+	    use_fds ? "fds" : "active", (int)sizeof(struct event),
+	    event_get_abi_version(), ncallbacks);
+	printf("%.1f ns per event\n", usec * 1000 / ncallbacks);
+	if (misses != -1)
+		printf("%.2f cache misses, %.2f references per event\n",
+		    (double)misses / ncallbacks, (double)refs / ncallbacks);
+	else
+		printf("cache counters not available\n");
+
+	for (i = 0; i < n; i++) {
+		event_free(events[i]);
+		if (use_fds) {
+			close(pipes[i][0]);
+			close(pipes[i][1]);
+		}
+	}
+	event_base_free(base);
+	free(events);
+	free(order);
+	free(pipes);
+
+	return (0);
+}
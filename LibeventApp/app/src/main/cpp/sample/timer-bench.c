@@ -0,0 +1,107 @@
+/*
+ * Compares the timer stores of an event base: the min-heap, the 4-ary
+ * heap and the timing wheel.  n timers with timeouts between 10 and 60 seconds are
+ * pending, like idle timeouts on n connections, and are rescheduled at
+ * random while the loop keeps running.
+ *
+ * Compile with:
+ * cc -I/usr/local/include -o timer-bench timer-bench.c -L/usr/local/lib -levent
+ */
+
+#include <sys/types.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifndef WIN32
+#include <sys/queue.h>
+#include <unistd.h>
+#endif
+#include <sys/time.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <event.h>
+#include <evutil.h>
+
+#define RESCHEDULES	1000000
+#define NRANDOM		4096
+/* loop iterations happen this often, in reschedules */
+#define LOOP_EVERY	64
+
+static struct timeval timeouts[NRANDOM];
+static int targets[NRANDOM];
+
+static void
+timeout_cb(int fd, short event, void *arg)
+{
+}
+
+static double
+run(int method, int n)
+{
+	struct event_base *base;
+	struct event *events;
+	struct timeval tv, start, end;
+	int i;
+
+	base = event_base_new();
+	if (event_base_set_timer_method(base, method, NULL) == -1) {
+		fprintf(stderr, "event_base_set_timer_method failed\n");
+		exit(1);
+	}
+
+	events = calloc(n, sizeof(struct event));
+	for (i = 0; i < n; i++) {
+		evtimer_set(&events[i], timeout_cb, NULL);
+		event_base_set(base, &events[i]);
+		tv.tv_sec = 10 + random() % 50;
+		tv.tv_usec = random() % 1000000;
+		event_add(&events[i], &tv);
+	}
+
+	/* keep random() out of the measured loop */
+	for (i = 0; i < NRANDOM; i++) {
+		timeouts[i].tv_sec = 10 + random() % 50;
+		timeouts[i].tv_usec = random() % 1000000;
+		targets[i] = random() % n;
+	}
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < RESCHEDULES; i++) {
+		event_add(&events[targets[i % NRANDOM]],
+		    &timeouts[(i + i / NRANDOM) % NRANDOM]);
+		if (i % LOOP_EVERY == 0)
+			event_base_loop(base, EVLOOP_NONBLOCK);
+	}
+	gettimeofday(&end, NULL);
+
+	for (i = 0; i < n; i++)
+		event_del(&events[i]);
+	free(events);
+	event_base_free(base);
+
+	evutil_timersub(&end, &start, &end);
+	return ((end.tv_sec * 1e9 + end.tv_usec * 1e3) / RESCHEDULES);
+}
+
+int
+main(int argc, char **argv)
+{
+	int n;
+
+	printf("%10s %14s %14s %14s\n", "timers", "heap ns/op",
+	    "heap4 ns/op", "wheel ns/op");
+	for (n = 16; n <= 1 << 20; n *= 4) {
+		double heap = run(EVENT_TIMER_HEAP, n);
+		double heap4 = run(EVENT_TIMER_HEAP4, n);
+		double wheel = run(EVENT_TIMER_WHEEL, n);
+		/* mark the sizes at which the wheel beats both heaps */
+		printf("%10d %14.1f %14.1f %14.1f%s\n", n, heap, heap4,
+		    wheel, wheel < heap && wheel < heap4 ? "  *" : "");
+	}
+
+	return (0);
+}
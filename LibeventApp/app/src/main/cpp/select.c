@@ -55,6 +55,7 @@
 #include "event-internal.h"
 #include "evsignal.h"
 #include "log.h"
+#include "mm-internal.h"
 
 #ifndef howmany
 #define        howmany(x, y)   (((x)+((y)-1))/(y))
@@ -70,6 +71,7 @@ typedef unsigned long fd_mask;
 struct selectop {
 	int event_fds;		/* Highest fd in fd set */
 	int event_fdsz;
+	int event_fdsz_out;	/* Size of the out sets, grown on dispatch */
 	fd_set *event_readset_in;
 	fd_set *event_writeset_in;
 	fd_set *event_readset_out;
@@ -105,7 +107,7 @@ select_init(struct event_base *base)
 	if (evutil_getenv("EVENT_NOSELECT"))
 		return (NULL);
 
-	if (!(sop = calloc(1, sizeof(struct selectop))))
+	if (!(sop = mm_calloc(1, sizeof(struct selectop), EVENT_MEM_EVENT)))
 		return (NULL);
 
 	select_resize(sop, howmany(32 + 1, NFDBITS)*sizeof(fd_mask));
@@ -145,19 +147,46 @@ check_selectop(struct selectop *sop)
 static int
 select_dispatch(struct event_base *base, void *arg, struct timeval *tv)
 {
-	int res, i, j;
+	int res, i, j, nfds;
 	struct selectop *sop = arg;
 
 	check_selectop(sop);
 
+	/*
+	 * The out sets are only touched here, so that select_add() from
+	 * another thread cannot move them while we wait in select().
+	 */
+	if (sop->event_fdsz_out < sop->event_fdsz) {
+		fd_set *readset_out, *writeset_out;
+
+		if ((readset_out = mm_realloc(sop->event_readset_out,
+			 sop->event_fdsz, EVENT_MEM_EVENT)) == NULL) {
+			event_warn("malloc");
+			return (-1);
+		}
+		sop->event_readset_out = readset_out;
+		if ((writeset_out = mm_realloc(sop->event_writeset_out,
+			 sop->event_fdsz, EVENT_MEM_EVENT)) == NULL) {
+			event_warn("malloc");
+			return (-1);
+		}
+		sop->event_writeset_out = writeset_out;
+		sop->event_fdsz_out = sop->event_fdsz;
+	}
+
 	memcpy(sop->event_readset_out, sop->event_readset_in,
 	       sop->event_fdsz);
 	memcpy(sop->event_writeset_out, sop->event_writeset_in,
 	       sop->event_fdsz);
+	nfds = sop->event_fds + 1;
 
-	res = select(sop->event_fds + 1, sop->event_readset_out,
+	EVBASE_RELEASE_LOCK(base);
+
+	res = select(nfds, sop->event_readset_out,
 	    sop->event_writeset_out, NULL, tv);
 
+	EVBASE_ACQUIRE_LOCK(base);
+
 	check_selectop(sop);
 
 	if (res == -1) {
@@ -175,10 +204,10 @@ select_dispatch(struct event_base *base, void *arg, struct timeval *tv)
 	event_debug(("%s: select reports %d", __func__, res));
 
 	check_selectop(sop);
-	i = random() % (sop->event_fds+1);
-	for (j = 0; j <= sop->event_fds; ++j) {
+	i = random() % nfds;
+	for (j = 0; j < nfds; ++j) {
 		struct event *r_ev = NULL, *w_ev = NULL;
-		if (++i >= sop->event_fds+1)
+		if (++i >= nfds)
 			i = 0;
 
 		res = 0;
@@ -191,10 +220,12 @@ select_dispatch(struct event_base *base, void *arg, struct timeval *tv)
 			res |= EV_WRITE;
 		}
 		if (r_ev && (res & r_ev->ev_events)) {
-			event_active(r_ev, res & r_ev->ev_events, 1);
+			event_active_nolock(base, r_ev,
+			    res & r_ev->ev_events, 1);
 		}
 		if (w_ev && w_ev != r_ev && (res & w_ev->ev_events)) {
-			event_active(w_ev, res & w_ev->ev_events, 1);
+			event_active_nolock(base, w_ev,
+			    res & w_ev->ev_events, 1);
 		}
 	}
 	check_selectop(sop);
@@ -210,8 +241,6 @@ select_resize(struct selectop *sop, int fdsz)
 
 	fd_set *readset_in = NULL;
 	fd_set *writeset_in = NULL;
-	fd_set *readset_out = NULL;
-	fd_set *writeset_out = NULL;
 	struct event **r_by_fd = NULL;
 	struct event **w_by_fd = NULL;
 
@@ -221,24 +250,20 @@ select_resize(struct selectop *sop, int fdsz)
 	if (sop->event_readset_in)
 		check_selectop(sop);
 
-	if ((readset_in = realloc(sop->event_readset_in, fdsz)) == NULL)
+	if ((readset_in = mm_realloc(sop->event_readset_in, fdsz,
+	    EVENT_MEM_EVENT)) == NULL)
 		goto error;
 	sop->event_readset_in = readset_in;
-	if ((readset_out = realloc(sop->event_readset_out, fdsz)) == NULL)
-		goto error;
-	sop->event_readset_out = readset_out;
-	if ((writeset_in = realloc(sop->event_writeset_in, fdsz)) == NULL)
+	if ((writeset_in = mm_realloc(sop->event_writeset_in, fdsz,
+	    EVENT_MEM_EVENT)) == NULL)
 		goto error;
 	sop->event_writeset_in = writeset_in;
-	if ((writeset_out = realloc(sop->event_writeset_out, fdsz)) == NULL)
-		goto error;
-	sop->event_writeset_out = writeset_out;
-	if ((r_by_fd = realloc(sop->event_r_by_fd,
-		 n_events*sizeof(struct event*))) == NULL)
+	if ((r_by_fd = mm_realloc(sop->event_r_by_fd,
+		 n_events*sizeof(struct event*), EVENT_MEM_EVENT)) == NULL)
 		goto error;
 	sop->event_r_by_fd = r_by_fd;
-	if ((w_by_fd = realloc(sop->event_w_by_fd,
-		 n_events * sizeof(struct event*))) == NULL)
+	if ((w_by_fd = mm_realloc(sop->event_w_by_fd,
+		 n_events * sizeof(struct event*), EVENT_MEM_EVENT)) == NULL)
 		goto error;
 	sop->event_w_by_fd = w_by_fd;
 
@@ -267,6 +292,11 @@ select_add(void *arg, struct event *ev)
 {
 	struct selectop *sop = arg;
 
+	/* select(2) has no notion of edges */
+	if (ev->ev_events & EV_ET) {
+		errno = EINVAL;
+		return (-1);
+	}
 	if (ev->ev_events & EV_SIGNAL)
 		return (evsignal_add(ev));
 
@@ -347,18 +377,18 @@ select_dealloc(struct event_base *base, void *arg)
 
 	evsignal_dealloc(base);
 	if (sop->event_readset_in)
-		free(sop->event_readset_in);
+		mm_free(sop->event_readset_in, EVENT_MEM_EVENT);
 	if (sop->event_writeset_in)
-		free(sop->event_writeset_in);
+		mm_free(sop->event_writeset_in, EVENT_MEM_EVENT);
 	if (sop->event_readset_out)
-		free(sop->event_readset_out);
+		mm_free(sop->event_readset_out, EVENT_MEM_EVENT);
 	if (sop->event_writeset_out)
-		free(sop->event_writeset_out);
+		mm_free(sop->event_writeset_out, EVENT_MEM_EVENT);
 	if (sop->event_r_by_fd)
-		free(sop->event_r_by_fd);
+		mm_free(sop->event_r_by_fd, EVENT_MEM_EVENT);
 	if (sop->event_w_by_fd)
-		free(sop->event_w_by_fd);
+		mm_free(sop->event_w_by_fd, EVENT_MEM_EVENT);
 
 	memset(sop, 0, sizeof(struct selectop));
-	free(sop);
+	mm_free(sop, EVENT_MEM_EVENT);
 }
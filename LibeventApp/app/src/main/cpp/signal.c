@@ -55,6 +55,12 @@
 #ifdef HAVE_FCNTL_H
 #include <fcntl.h>
 #endif
+#ifdef HAVE_SYS_SIGNALFD_H
+#include <sys/signalfd.h>
+#endif
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+#endif
 #include <assert.h>
 
 #include "event.h"
@@ -62,6 +68,7 @@
 #include "evsignal.h"
 #include "evutil.h"
 #include "log.h"
+#include "mm-internal.h"
 
 struct event_base *evsignal_base = NULL;
 
@@ -102,11 +109,152 @@ evsignal_cb(int fd, short what, void *arg)
 #define FD_CLOSEONEXEC(x)
 #endif
 
+#ifdef HAVE_SYS_SIGNALFD_H
+/*
+ * With EVENT_BASE_FLAG_SIGNALFD every base reads its own signals from an
+ * fd that is watched like any other, so there is no signal handler, no
+ * global base and no socketpair.  A signal has to be blocked to end up in
+ * a signalfd; evsignal_add() blocks it in the calling thread, and programs
+ * with more threads must block watched signals in all of them.  Otherwise
+ * a process-directed signal goes to a thread that does not block it, so
+ * this is not the default.
+ */
+#ifdef HAVE_PTHREADS
+#define evsignal_sigmask(how, set, old)	pthread_sigmask(how, set, old)
+#else
+#define evsignal_sigmask(how, set, old)	sigprocmask(how, set, old)
+#endif
+
+/* Callback for when the signalfd has signals for us */
+static void
+evsignal_signalfd_cb(int fd, short what, void *arg)
+{
+	struct event_base *base = arg;
+	struct signalfd_siginfo info[16];
+	ssize_t n;
+	int i;
+
+	EVBASE_ACQUIRE_LOCK(base);
+	while ((n = read(fd, info, sizeof(info))) > 0) {
+		for (i = 0; i < n / (ssize_t)sizeof(info[0]); ++i) {
+			if (info[i].ssi_signo > 0 && info[i].ssi_signo < NSIG)
+				base->sig.evsigcaught[info[i].ssi_signo]++;
+		}
+		base->sig.evsignal_caught = 1;
+		if (n < (ssize_t)sizeof(info))
+			break;
+	}
+	if (n == -1 && errno != EAGAIN && errno != EINTR)
+		event_warn("%s: read", __func__);
+	if (base->sig.evsignal_caught)
+		evsignal_process(base);
+	EVBASE_RELEASE_LOCK(base);
+}
+
+static int
+evsignal_init_signalfd(struct event_base *base)
+{
+	struct evsignal_info *sig = &base->sig;
+
+	if (!(base->flags & EVENT_BASE_FLAG_SIGNALFD) &&
+	    !evutil_getenv("EVENT_SIGNALFD"))
+		return (-1);
+
+	sigemptyset(&sig->ev_signalfd_mask);
+	sigemptyset(&sig->ev_signalfd_blocked);
+	sig->ev_signalfd = signalfd(-1, &sig->ev_signalfd_mask,
+	    SFD_NONBLOCK | SFD_CLOEXEC);
+	if (sig->ev_signalfd == -1)
+		return (-1);
+
+	event_set(&sig->ev_signal, sig->ev_signalfd, EV_READ | EV_PERSIST,
+	    evsignal_signalfd_cb, base);
+	sig->ev_signal.ev_base = base;
+	sig->ev_signal.ev_flags |= EVLIST_INTERNAL;
+
+	return (0);
+}
+
+/*
+ * Unblocks evsignal if we blocked it.  The signal mask belongs to a
+ * thread, so this is only possible in the thread that blocked it; in
+ * others the signal stays blocked where it was.
+ */
+static void
+evsignal_signalfd_unblock(struct evsignal_info *sig, int evsignal)
+{
+	sigset_t set;
+
+	if (!sigismember(&sig->ev_signalfd_blocked, evsignal))
+		return;
+	sigdelset(&sig->ev_signalfd_blocked, evsignal);
+#ifdef HAVE_PTHREADS
+	if (!pthread_equal(sig->ev_signalfd_blocker[evsignal], pthread_self()))
+		return;
+#endif
+	sigemptyset(&set);
+	sigaddset(&set, evsignal);
+	evsignal_sigmask(SIG_UNBLOCK, &set, NULL);
+}
+
+/* Adds or removes evsignal from the signals that the signalfd reads */
+static int
+evsignal_signalfd_update(struct event_base *base, int evsignal, int add)
+{
+	struct evsignal_info *sig = &base->sig;
+	sigset_t set, old;
+
+	sigemptyset(&set);
+	sigaddset(&set, evsignal);
+
+	if (add) {
+		sigaddset(&sig->ev_signalfd_mask, evsignal);
+		if (evsignal_sigmask(SIG_BLOCK, &set, &old) == -1) {
+			event_warn("%s: sigmask", __func__);
+			return (-1);
+		}
+		if (!sigismember(&old, evsignal)) {
+			sigaddset(&sig->ev_signalfd_blocked, evsignal);
+#ifdef HAVE_PTHREADS
+			sig->ev_signalfd_blocker[evsignal] = pthread_self();
+#endif
+		}
+	} else {
+		sigdelset(&sig->ev_signalfd_mask, evsignal);
+	}
+
+	if (signalfd(sig->ev_signalfd, &sig->ev_signalfd_mask, 0) == -1) {
+		event_warn("%s: signalfd", __func__);
+		return (-1);
+	}
+
+	/* signals still pending are delivered as usual from now on */
+	if (!add)
+		evsignal_signalfd_unblock(sig, evsignal);
+
+	return (0);
+}
+#endif
+
 int
 evsignal_init(struct event_base *base)
 {
 	int i;
 
+	base->sig.sh_old = NULL;
+	base->sig.sh_old_max = 0;
+	base->sig.evsignal_caught = 0;
+	memset(&base->sig.evsigcaught, 0, sizeof(sig_atomic_t)*NSIG);
+	/* initialize the queues for all events */
+	for (i = 0; i < NSIG; ++i)
+		TAILQ_INIT(&base->sig.evsigevents[i]);
+
+	base->sig.ev_signalfd = -1;
+#ifdef HAVE_SYS_SIGNALFD_H
+	if (evsignal_init_signalfd(base) == 0)
+		return (0);
+#endif
+
 	/* 
 	 * Our signal handler is going to write to one end of the socket
 	 * pair to wake up our event loop.  The event loop then scans for
@@ -126,13 +274,6 @@ evsignal_init(struct event_base *base)
 
 	FD_CLOSEONEXEC(base->sig.ev_signal_pair[0]);
 	FD_CLOSEONEXEC(base->sig.ev_signal_pair[1]);
-	base->sig.sh_old = NULL;
-	base->sig.sh_old_max = 0;
-	base->sig.evsignal_caught = 0;
-	memset(&base->sig.evsigcaught, 0, sizeof(sig_atomic_t)*NSIG);
-	/* initialize the queues for all events */
-	for (i = 0; i < NSIG; ++i)
-		TAILQ_INIT(&base->sig.evsigevents[i]);
 
         evutil_make_socket_nonblocking(base->sig.ev_signal_pair[0]);
         evutil_make_socket_nonblocking(base->sig.ev_signal_pair[1]);
@@ -167,7 +308,8 @@ _evsignal_set_handler(struct event_base *base,
 		int new_max = evsignal + 1;
 		event_debug(("%s: evsignal (%d) >= sh_old_max (%d), resizing",
 			    __func__, evsignal, sig->sh_old_max));
-		p = realloc(sig->sh_old, new_max * sizeof(*sig->sh_old));
+		p = mm_realloc(sig->sh_old, new_max * sizeof(*sig->sh_old),
+		    EVENT_MEM_EVENT);
 		if (p == NULL) {
 			event_warn("realloc");
 			return (-1);
@@ -181,7 +323,8 @@ _evsignal_set_handler(struct event_base *base,
 	}
 
 	/* allocate space for previous handler out of dynamic array */
-	sig->sh_old[evsignal] = malloc(sizeof *sig->sh_old[evsignal]);
+	sig->sh_old[evsignal] = mm_malloc(sizeof *sig->sh_old[evsignal],
+	    EVENT_MEM_EVENT);
 	if (sig->sh_old[evsignal] == NULL) {
 		event_warn("malloc");
 		return (-1);
@@ -196,14 +339,14 @@ _evsignal_set_handler(struct event_base *base,
 
 	if (sigaction(evsignal, &sa, sig->sh_old[evsignal]) == -1) {
 		event_warn("sigaction");
-		free(sig->sh_old[evsignal]);
+		mm_free(sig->sh_old[evsignal], EVENT_MEM_EVENT);
 		sig->sh_old[evsignal] = NULL;
 		return (-1);
 	}
 #else
 	if ((sh = signal(evsignal, handler)) == SIG_ERR) {
 		event_warn("signal");
-		free(sig->sh_old[evsignal]);
+		mm_free(sig->sh_old[evsignal], EVENT_MEM_EVENT);
 		sig->sh_old[evsignal] = NULL;
 		return (-1);
 	}
@@ -225,16 +368,25 @@ evsignal_add(struct event *ev)
 	evsignal = EVENT_SIGNAL(ev);
 	assert(evsignal >= 0 && evsignal < NSIG);
 	if (TAILQ_EMPTY(&sig->evsigevents[evsignal])) {
-		event_debug(("%s: %p: changing signal handler", __func__, ev));
-		if (_evsignal_set_handler(
-			    base, evsignal, evsignal_handler) == -1)
-			return (-1);
+#ifdef HAVE_SYS_SIGNALFD_H
+		if (sig->ev_signalfd != -1) {
+			if (evsignal_signalfd_update(base, evsignal, 1) == -1)
+				return (-1);
+		} else
+#endif
+		{
+			event_debug(("%s: %p: changing signal handler",
+			    __func__, ev));
+			if (_evsignal_set_handler(
+				    base, evsignal, evsignal_handler) == -1)
+				return (-1);
 
-		/* catch signals if they happen quickly */
-		evsignal_base = base;
+			/* catch signals if they happen quickly */
+			evsignal_base = base;
+		}
 
 		if (!sig->ev_signal_added) {
-			if (event_add(&sig->ev_signal, NULL))
+			if (event_add_nolock(&sig->ev_signal, NULL))
 				return (-1);
 			sig->ev_signal_added = 1;
 		}
@@ -271,7 +423,7 @@ _evsignal_restore_handler(struct event_base *base, int evsignal)
 		ret = -1;
 	}
 #endif
-	free(sh);
+	mm_free(sh, EVENT_MEM_EVENT);
 
 	return ret;
 }
@@ -291,6 +443,11 @@ evsignal_del(struct event *ev)
 	if (!TAILQ_EMPTY(&sig->evsigevents[evsignal]))
 		return (0);
 
+#ifdef HAVE_SYS_SIGNALFD_H
+	if (sig->ev_signalfd != -1)
+		return (evsignal_signalfd_update(base, evsignal, 0));
+#endif
+
 	event_debug(("%s: %p: restoring signal handler", __func__, ev));
 
 	return (_evsignal_restore_handler(ev->ev_base, EVENT_SIGNAL(ev)));
@@ -339,8 +496,8 @@ evsignal_process(struct event_base *base)
 		    ev != NULL; ev = next_ev) {
 			next_ev = TAILQ_NEXT(ev, ev_signal_next);
 			if (!(ev->ev_events & EV_PERSIST))
-				event_del(ev);
-			event_active(ev, EV_SIGNAL, ncalls);
+				event_del_nolock(ev);
+			event_active_nolock(base, ev, EV_SIGNAL, ncalls);
 		}
 
 	}
@@ -351,7 +508,7 @@ evsignal_dealloc(struct event_base *base)
 {
 	int i = 0;
 	if (base->sig.ev_signal_added) {
-		event_del(&base->sig.ev_signal);
+		event_del_nolock(&base->sig.ev_signal);
 		base->sig.ev_signal_added = 0;
 	}
 	for (i = 0; i < NSIG; ++i) {
@@ -359,6 +516,15 @@ evsignal_dealloc(struct event_base *base)
 			_evsignal_restore_handler(base, i);
 	}
 
+#ifdef HAVE_SYS_SIGNALFD_H
+	if (base->sig.ev_signalfd != -1) {
+		for (i = 1; i < NSIG; ++i)
+			evsignal_signalfd_unblock(&base->sig, i);
+		close(base->sig.ev_signalfd);
+		base->sig.ev_signalfd = -1;
+	}
+#endif
+
 	if (base->sig.ev_signal_pair[0] != -1) {
 		EVUTIL_CLOSESOCKET(base->sig.ev_signal_pair[0]);
 		base->sig.ev_signal_pair[0] = -1;
@@ -371,7 +537,7 @@ evsignal_dealloc(struct event_base *base)
 
 	/* per index frees are handled in evsig_del() */
 	if (base->sig.sh_old) {
-		free(base->sig.sh_old);
+		mm_free(base->sig.sh_old, EVENT_MEM_EVENT);
 		base->sig.sh_old = NULL;
 	}
 }
@@ -0,0 +1,330 @@
+/*
+ * Copyright (c) 2026 The LibeventApp authors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _TIMER_WHEEL_H_
+#define _TIMER_WHEEL_H_
+
+#include <string.h>
+
+#include "event.h"
+#include "evutil.h"
+#include "mm-internal.h"
+
+/*
+ * A hierarchical timing wheel: TW_LEVELS wheels of TW_SLOTS slots each,
+ * where a slot of level l spans TW_SLOTS^l ticks.  A timer goes into the
+ * lowest level that reaches its deadline; when the wheel gets to the start
+ * of a higher-level slot, that slot is cascaded into the lower levels.
+ * Insertion and removal are O(1).  Timers are rounded up to the next
+ * tick, so they never fire early and at most one tick late.
+ *
+ * Timers live in a pool of nodes linked by index; like with the min-heap,
+ * ev->min_heap_idx holds the position of the event, here its node.  The
+ * first TW_NHEADS nodes of the pool are the list heads of the slots and of
+ * the list of expired timers.
+ */
+
+#define TW_LEVEL_BITS	8
+#define TW_SLOTS	(1u << TW_LEVEL_BITS)
+#define TW_SLOT_MASK	(TW_SLOTS - 1)
+#define TW_LEVELS	4
+#define TW_WORDS	(TW_SLOTS / 64)
+#define TW_DUE		(TW_LEVELS * TW_SLOTS)
+#define TW_NHEADS	(TW_DUE + 1)
+#define TW_NONE		((unsigned)-1)
+
+typedef struct timer_wheel_node
+{
+    struct event* ev;
+    ev_uint64_t tick;
+    unsigned next, prev;
+} timer_wheel_node_t;
+
+typedef struct timer_wheel
+{
+    timer_wheel_node_t* nodes;
+    unsigned n, a;
+    unsigned free_node;
+    ev_uint64_t tick_usec;
+    ev_uint64_t last;       /* last tick that has been processed */
+    ev_uint64_t occupied[TW_LEVELS][TW_WORDS];
+} timer_wheel_t;
+
+static inline int            timer_wheel_ctor(timer_wheel_t* w, ev_uint64_t tick_usec, const struct timeval* now);
+static inline void           timer_wheel_dtor(timer_wheel_t* w);
+static inline int            timer_wheel_empty(timer_wheel_t* w);
+static inline unsigned       timer_wheel_size(timer_wheel_t* w);
+static inline int            timer_wheel_reserve(timer_wheel_t* w, unsigned n);
+static inline int            timer_wheel_push(timer_wheel_t* w, struct event* e);
+static inline int            timer_wheel_erase(timer_wheel_t* w, struct event* e);
+static inline void           timer_wheel_expire(timer_wheel_t* w, const struct timeval* now);
+static inline struct event*  timer_wheel_first_due(timer_wheel_t* w);
+static inline int            timer_wheel_next(timer_wheel_t* w, struct timeval* deadline);
+static inline struct event*  timer_wheel_any(timer_wheel_t* w);
+static inline void           timer_wheel_rebuild(timer_wheel_t* w, const struct timeval* now);
+
+static inline ev_uint64_t tw_usec_(const struct timeval* tv)
+{
+    return (ev_uint64_t)tv->tv_sec * 1000000 + tv->tv_usec;
+}
+
+static inline void tw_link_(timer_wheel_t* w, unsigned i, unsigned head)
+{
+    timer_wheel_node_t* h = &w->nodes[head];
+    w->nodes[i].next = head;
+    w->nodes[i].prev = h->prev;
+    w->nodes[h->prev].next = i;
+    h->prev = i;
+    if(head < TW_DUE)
+        w->occupied[head / TW_SLOTS][(head % TW_SLOTS) / 64] |= (ev_uint64_t)1 << (head % 64);
+}
+
+static inline void tw_unlink_(timer_wheel_t* w, unsigned i)
+{
+    unsigned prev = w->nodes[i].prev, next = w->nodes[i].next;
+    w->nodes[prev].next = next;
+    w->nodes[next].prev = prev;
+    /* the slot became empty if only its head is left */
+    if(prev == next && prev < TW_DUE)
+        w->occupied[prev / TW_SLOTS][(prev % TW_SLOTS) / 64] &= ~((ev_uint64_t)1 << (prev % 64));
+}
+
+/* Puts node i into the slot matching its tick, relative to w->last */
+static inline void tw_place_(timer_wheel_t* w, unsigned i)
+{
+    ev_uint64_t tick = w->nodes[i].tick, delta;
+    unsigned level;
+    if(tick <= w->last)
+    {
+        tw_link_(w, i, TW_DUE);
+        return;
+    }
+    delta = tick - w->last;
+    for(level = 0; level < TW_LEVELS - 1; ++level)
+        if(delta < (ev_uint64_t)1 << ((level + 1) * TW_LEVEL_BITS))
+            break;
+    /* too far away for the top level; it gets cascaded again later */
+    if(level == TW_LEVELS - 1 && delta >> (TW_LEVELS * TW_LEVEL_BITS))
+        tick = w->last + ((ev_uint64_t)1 << (TW_LEVELS * TW_LEVEL_BITS)) - 1;
+    tw_link_(w, i, level * TW_SLOTS + ((tick >> (level * TW_LEVEL_BITS)) & TW_SLOT_MASK));
+}
+
+/* Finds the first occupied slot at or after start, wrapping around */
+static inline int tw_find_slot_(const ev_uint64_t* bits, unsigned start)
+{
+    unsigned i, word = start / 64;
+    ev_uint64_t m = bits[word] & (~(ev_uint64_t)0 << (start % 64));
+    for(i = 0; i <= TW_WORDS; ++i)
+    {
+        if(m)
+            return word * 64 + __builtin_ctzll(m);
+        word = (word + 1) % TW_WORDS;
+        m = bits[word];
+        if(i == TW_WORDS - 1)
+            m &= ~(~(ev_uint64_t)0 << (start % 64));
+    }
+    return -1;
+}
+
+/* The first tick after w->last at which a timer expires or a slot cascades */
+static inline int tw_next_tick_(timer_wheel_t* w, ev_uint64_t* next)
+{
+    unsigned level, idx, k;
+    int slot, found = 0;
+    ev_uint64_t best = 0;
+    for(level = 0; level < TW_LEVELS; ++level)
+    {
+        ev_uint64_t base = w->last >> (level * TW_LEVEL_BITS), tick;
+        idx = base & TW_SLOT_MASK;
+        if((slot = tw_find_slot_(w->occupied[level], (idx + 1) & TW_SLOT_MASK)) < 0)
+            continue;
+        k = ((slot - idx - 1) & TW_SLOT_MASK) + 1;
+        tick = (base + k) << (level * TW_LEVEL_BITS);
+        if(!found || tick < best)
+            best = tick;
+        found = 1;
+    }
+    *next = best;
+    return found ? 0 : -1;
+}
+
+static inline void tw_move_slot_(timer_wheel_t* w, unsigned head)
+{
+    unsigned i;
+    while((i = w->nodes[head].next) != head)
+    {
+        tw_unlink_(w, i);
+        tw_place_(w, i);
+    }
+}
+
+int timer_wheel_ctor(timer_wheel_t* w, ev_uint64_t tick_usec, const struct timeval* now)
+{
+    unsigned i;
+    memset(w, 0, sizeof(*w));
+    if(!(w->nodes = (timer_wheel_node_t*)mm_malloc(TW_NHEADS * sizeof *w->nodes, EVENT_MEM_EVENT)))
+        return -1;
+    w->a = TW_NHEADS;
+    for(i = 0; i < TW_NHEADS; ++i)
+    {
+        w->nodes[i].ev = 0;
+        w->nodes[i].next = w->nodes[i].prev = i;
+    }
+    w->free_node = TW_NONE;
+    w->tick_usec = tick_usec ? tick_usec : 1;
+    w->last = tw_usec_(now) / w->tick_usec;
+    return 0;
+}
+
+void timer_wheel_dtor(timer_wheel_t* w) { if(w->nodes) mm_free(w->nodes, EVENT_MEM_EVENT); }
+int timer_wheel_empty(timer_wheel_t* w) { return 0u == w->n; }
+unsigned timer_wheel_size(timer_wheel_t* w) { return w->n; }
+
+int timer_wheel_reserve(timer_wheel_t* w, unsigned n)
+{
+    if(w->a - TW_NHEADS < n)
+    {
+        timer_wheel_node_t* nodes;
+        unsigned i, a = w->a - TW_NHEADS ? (w->a - TW_NHEADS) * 2 : 8;
+        if(a < n)
+            a = n;
+        a += TW_NHEADS;
+        if(!(nodes = (timer_wheel_node_t*)mm_realloc(w->nodes, a * sizeof *nodes, EVENT_MEM_EVENT)))
+            return -1;
+        w->nodes = nodes;
+        for(i = a; i-- > w->a; )
+        {
+            nodes[i].ev = 0;
+            nodes[i].next = w->free_node;
+            w->free_node = i;
+        }
+        w->a = a;
+    }
+    return 0;
+}
+
+int timer_wheel_push(timer_wheel_t* w, struct event* e)
+{
+    unsigned i;
+    if(timer_wheel_reserve(w, w->n + 1))
+        return -1;
+    i = w->free_node;
+    w->free_node = w->nodes[i].next;
+    w->nodes[i].ev = e;
+    w->nodes[i].tick = (tw_usec_(&e->ev_timeout) + w->tick_usec - 1) / w->tick_usec;
+    tw_place_(w, i);
+    e->min_heap_idx = i;
+    ++w->n;
+    return 0;
+}
+
+int timer_wheel_erase(timer_wheel_t* w, struct event* e)
+{
+    unsigned i = e->min_heap_idx;
+    if(TW_NONE == i)
+        return -1;
+    tw_unlink_(w, i);
+    w->nodes[i].ev = 0;
+    w->nodes[i].next = w->free_node;
+    w->free_node = i;
+    e->min_heap_idx = -1;
+    --w->n;
+    return 0;
+}
+
+/* Moves every timer whose deadline is at or before now to the due list */
+void timer_wheel_expire(timer_wheel_t* w, const struct timeval* now)
+{
+    ev_uint64_t target = tw_usec_(now) / w->tick_usec, next;
+    unsigned level;
+    while(w->n && !tw_next_tick_(w, &next) && next <= target)
+    {
+        /* nothing happens before next, skip straight to it */
+        w->last = next;
+        for(level = TW_LEVELS - 1; level > 0; --level)
+            if(!(next & (((ev_uint64_t)1 << (level * TW_LEVEL_BITS)) - 1)))
+                tw_move_slot_(w, level * TW_SLOTS + ((next >> (level * TW_LEVEL_BITS)) & TW_SLOT_MASK));
+        tw_move_slot_(w, next & TW_SLOT_MASK);
+    }
+    if(w->last < target)
+        w->last = target;
+}
+
+struct event* timer_wheel_first_due(timer_wheel_t* w)
+{
+    unsigned i = w->nodes[TW_DUE].next;
+    return i != TW_DUE ? w->nodes[i].ev : 0;
+}
+
+/* The earliest time at which the wheel may have something to do */
+int timer_wheel_next(timer_wheel_t* w, struct timeval* deadline)
+{
+    ev_uint64_t next, usec;
+    if(!w->n)
+        return -1;
+    if(timer_wheel_first_due(w) || tw_next_tick_(w, &next))
+    {
+        evutil_timerclear(deadline);
+        return 0;
+    }
+    usec = next * w->tick_usec;
+    deadline->tv_sec = (long)(usec / 1000000);
+    deadline->tv_usec = (long)(usec % 1000000);
+    return 0;
+}
+
+struct event* timer_wheel_any(timer_wheel_t* w)
+{
+    unsigned level, word;
+    if(timer_wheel_first_due(w))
+        return timer_wheel_first_due(w);
+    for(level = 0; level < TW_LEVELS; ++level)
+        for(word = 0; word < TW_WORDS; ++word)
+            if(w->occupied[level][word])
+            {
+                unsigned head = level * TW_SLOTS + word * 64 + __builtin_ctzll(w->occupied[level][word]);
+                return w->nodes[w->nodes[head].next].ev;
+            }
+    return 0;
+}
+
+/* Re-sorts all timers after their deadlines were changed */
+void timer_wheel_rebuild(timer_wheel_t* w, const struct timeval* now)
+{
+    unsigned i;
+    for(i = 0; i < TW_NHEADS; ++i)
+        w->nodes[i].next = w->nodes[i].prev = i;
+    memset(w->occupied, 0, sizeof(w->occupied));
+    w->last = tw_usec_(now) / w->tick_usec;
+    for(i = TW_NHEADS; i < w->a; ++i)
+        if(w->nodes[i].ev)
+        {
+            w->nodes[i].tick = (tw_usec_(&w->nodes[i].ev->ev_timeout) + w->tick_usec - 1) / w->tick_usec;
+            tw_place_(w, i);
+        }
+}
+
+#endif /* _TIMER_WHEEL_H_ */
@@ -0,0 +1,262 @@
+/*
+ * Copyright (c) 2026 The LibeventApp authors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/types.h>
+#ifdef HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+#include <sys/queue.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "event.h"
+#include "event-internal.h"
+#include "evutil.h"
+#include "log.h"
+#include "mm-internal.h"
+
+static int trace_next_id;
+
+/*
+ * The cycle counter where we can read it directly, converted to the
+ * monotonic clock only when the trace is dumped.
+ */
+static ev_uint64_t
+trace_ticks(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return (__builtin_ia32_rdtsc());
+#elif defined(__aarch64__)
+	ev_uint64_t ticks;
+
+	__asm__ __volatile__("mrs %0, cntvct_el0" : "=r" (ticks));
+	return (ticks);
+#else
+	return (event_monotonic_ns());
+#endif
+}
+
+void
+event_trace_record(struct event_trace *trace, int type, void *ptr, int fd,
+    int res)
+{
+	struct event_trace_rec *rec = &trace->recs[trace->head++ & trace->mask];
+
+	rec->ticks = trace_ticks();
+	rec->ptr = ptr;
+	rec->fd = fd;
+	rec->type = type;
+	rec->res = res;
+}
+
+void
+event_trace_free(struct event_trace *trace)
+{
+	mm_free(trace->recs, EVENT_MEM_EVENT);
+	mm_free(trace, EVENT_MEM_EVENT);
+}
+
+int
+event_base_trace_start(struct event_base *base, int nrecords)
+{
+	struct event_trace *trace;
+	ev_uint64_t size = 1;
+
+	if (nrecords <= 0)
+		return (-1);
+	while (size < (ev_uint64_t)nrecords)
+		size <<= 1;
+
+	EVBASE_ACQUIRE_LOCK(base);
+	trace = base->trace;
+	if (trace != NULL && trace->mask + 1 != size) {
+		base->trace_on = 0;
+		base->trace = NULL;
+		event_trace_free(trace);
+		trace = NULL;
+	}
+	if (trace == NULL) {
+		if ((trace = mm_calloc(1, sizeof(struct event_trace),
+		    EVENT_MEM_EVENT)) == NULL ||
+		    (trace->recs = mm_calloc(size,
+			sizeof(struct event_trace_rec),
+			EVENT_MEM_EVENT)) == NULL) {
+			event_warn("%s: calloc", __func__);
+			mm_free(trace, EVENT_MEM_EVENT);
+			EVBASE_RELEASE_LOCK(base);
+			return (-1);
+		}
+		trace->mask = size - 1;
+		trace->id = __sync_add_and_fetch(&trace_next_id, 1);
+		base->trace = trace;
+	}
+	trace->head = 0;
+	trace->start_ticks = trace_ticks();
+	trace->start_ns = event_monotonic_ns();
+	base->trace_on = 1;
+	EVBASE_RELEASE_LOCK(base);
+	return (0);
+}
+
+void
+event_base_trace_stop(struct event_base *base)
+{
+	EVBASE_ACQUIRE_LOCK(base);
+	base->trace_on = 0;
+	EVBASE_RELEASE_LOCK(base);
+}
+
+static const char *
+trace_events(short res)
+{
+	static const char *names[] = {
+		"", "timeout", "read", "timeout|read", "write",
+		"timeout|write", "read|write", "timeout|read|write"
+	};
+
+	if (res & EV_SIGNAL)
+		return ("signal");
+	return (names[res & (EV_TIMEOUT|EV_READ|EV_WRITE)]);
+}
+
+/* event_symbol() of addr escaped for a JSON string, truncated to fit */
+static void
+trace_symbol(void *addr, char *buf, size_t len)
+{
+	char sym[256];
+	unsigned char c;
+	size_t i, j = 0;
+
+	event_symbol(addr, sym, sizeof(sym));
+	for (i = 0; sym[i] != '\0' && j + 7 <= len; ++i) {
+		c = (unsigned char)sym[i];
+		if (c == '"' || c == '\\') {
+			buf[j++] = '\\';
+			buf[j++] = c;
+		} else if (c < 0x20) {
+			j += snprintf(buf + j, len - j, "\\u%04x", c);
+		} else
+			buf[j++] = c;
+	}
+	buf[j] = '\0';
+}
+
+int
+event_base_trace_dump(struct event_base *base, struct evbuffer *buf)
+{
+	struct event_trace *trace;
+	struct event_trace_rec *rec;
+	ev_uint64_t i, first, now_ticks, now_ns, ns;
+	double ns_per_tick = 1.0;
+	int in_dispatch = 0, in_callback = 0, pid = (int)getpid();
+	const char *name;
+	char sym[512];
+
+	EVBASE_ACQUIRE_LOCK(base);
+	if ((trace = base->trace) == NULL) {
+		EVBASE_RELEASE_LOCK(base);
+		return (-1);
+	}
+
+	now_ticks = trace_ticks();
+	now_ns = event_monotonic_ns();
+	if (now_ticks > trace->start_ticks)
+		ns_per_tick = (double)(now_ns - trace->start_ns) /
+		    (now_ticks - trace->start_ticks);
+
+	evbuffer_add_printf(buf, "{\"traceEvents\":[\n"
+	    "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+	    "\"args\":{\"name\":\"event_base %d (%s)\"}}",
+	    pid, trace->id, trace->id, base->evsel->name);
+
+	first = trace->head > trace->mask ? trace->head - trace->mask - 1 : 0;
+	for (i = first; i < trace->head; ++i) {
+		rec = &trace->recs[i & trace->mask];
+		ns = trace->start_ns + (ev_uint64_t)
+		    ((double)(ev_int64_t)(rec->ticks - trace->start_ticks) *
+		     ns_per_tick);
+
+		switch (rec->type) {
+		case EVENT_TRACE_DISPATCH_BEGIN:
+			in_dispatch = 1;
+			evbuffer_add_printf(buf, ",\n{\"name\":\"dispatch\","
+			    "\"ph\":\"B\"");
+			break;
+		case EVENT_TRACE_DISPATCH_END:
+			/* its beginning has been overwritten */
+			if (!in_dispatch)
+				continue;
+			in_dispatch = 0;
+			evbuffer_add_printf(buf, ",\n{\"name\":\"dispatch\","
+			    "\"ph\":\"E\",\"args\":{\"active\":%d}",
+			    rec->res);
+			break;
+		case EVENT_TRACE_CALLBACK_BEGIN:
+			in_callback = 1;
+			trace_symbol(rec->ptr, sym, sizeof(sym));
+			evbuffer_add_printf(buf, ",\n{\"name\":\"%s\","
+			    "\"cat\":\"callback\",\"ph\":\"B\","
+			    "\"args\":{\"fd\":%d,\"events\":\"%s\"}",
+			    sym, rec->fd, trace_events(rec->res));
+			break;
+		case EVENT_TRACE_CALLBACK_END:
+			if (!in_callback)
+				continue;
+			in_callback = 0;
+			evbuffer_add_printf(buf, ",\n{\"ph\":\"E\"");
+			break;
+		default:
+			if (rec->type == EVENT_TRACE_TIMER)
+				name = "timeout";
+			else if (rec->type == EVENT_TRACE_ADD)
+				name = "event_add";
+			else
+				name = "event_del";
+			trace_symbol(rec->ptr, sym, sizeof(sym));
+			evbuffer_add_printf(buf, ",\n{\"name\":\"%s\","
+			    "\"ph\":\"i\",\"s\":\"t\",\"args\":{"
+			    "\"callback\":\"%s\",\"fd\":%d,\"events\":\"%s\"}",
+			    name, sym, rec->fd, trace_events(rec->res));
+			break;
+		}
+		evbuffer_add_printf(buf, ",\"pid\":%d,\"tid\":%d,"
+		    "\"ts\":%llu.%03u}", pid, trace->id,
+		    (unsigned long long)(ns / 1000), (unsigned)(ns % 1000));
+	}
+	evbuffer_add_printf(buf, "\n]}\n");
+	EVBASE_RELEASE_LOCK(base);
+	return (0);
+}
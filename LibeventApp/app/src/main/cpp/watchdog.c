@@ -0,0 +1,415 @@
+/*
+ * Copyright (c) 2026 The LibeventApp authors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * The watchdog of event_base_set_watchdog().
+ *
+ * The loop thread bumps base->wd_seq before and after every callback, so
+ * it is odd while one runs, and publishes the callback before the first
+ * bump.  The watchdog thread samples the counter every quarter of the
+ * threshold; once it has seen the same odd value for the threshold the
+ * callback is reported.  The stack is captured by the loop thread itself
+ * in a SIGURG handler and symbolized by the watchdog thread.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#if defined(HAVE_DLFCN_H) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE		/* for dladdr() */
+#endif
+
+#include <sys/types.h>
+#ifdef HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+#include <sys/queue.h>
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+#endif
+#ifdef HAVE_DLFCN_H
+#include <dlfcn.h>
+#endif
+#ifdef HAVE_UNWIND_H
+#include <unwind.h>
+#endif
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "event.h"
+#include "event-internal.h"
+#include "evutil.h"
+#include "log.h"
+#include "mm-internal.h"
+
+/* Formats addr as symbol+offset, or as offset into its object */
+void
+event_symbol(void *addr, char *buf, size_t len)
+{
+#ifdef HAVE_DLFCN_H
+	Dl_info info;
+
+	if (dladdr(addr, &info) != 0 && info.dli_fname != NULL) {
+		if (info.dli_sname != NULL) {
+			evutil_snprintf(buf, len, "%s+%#lx (%s)",
+			    info.dli_sname, (unsigned long)
+			    ((char *)addr - (char *)info.dli_saddr),
+			    info.dli_fname);
+		} else {
+			evutil_snprintf(buf, len, "%s+%#lx", info.dli_fname,
+			    (unsigned long)
+			    ((char *)addr - (char *)info.dli_fbase));
+		}
+		return;
+	}
+#endif
+	evutil_snprintf(buf, len, "%p", addr);
+}
+
+#ifdef HAVE_PTHREADS
+
+#define WATCHDOG_SIGNAL		SIGURG
+#define WATCHDOG_FRAMES		32
+/* how long the watchdog waits for the loop thread to take its stack */
+#define WATCHDOG_CAPTURE_MSEC	100
+
+struct event_watchdog {
+	struct event_base *base;
+	ev_uint64_t threshold;		/* in nanoseconds */
+	ev_uint64_t tick;
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int stop;
+
+	/* filled in by the signal handler */
+	pthread_t target;
+	void *frames[WATCHDOG_FRAMES];
+	int nframes;
+	int skip;			/* frames of the handler itself */
+	volatile int captured;
+};
+
+/* Captures are serialized, the signal handler finds its request here */
+static pthread_mutex_t watchdog_global_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct event_watchdog *volatile watchdog_capturing;
+static int watchdog_nthreads;
+static struct sigaction watchdog_old_action;
+
+#ifdef HAVE_UNWIND_H
+static _Unwind_Reason_Code
+watchdog_unwind_cb(struct _Unwind_Context *ctx, void *arg)
+{
+	struct event_watchdog *wd = arg;
+	void *ip = (void *)_Unwind_GetIP(ctx);
+
+	if (ip == NULL)
+		return (_URC_END_OF_STACK);
+	if (wd->skip > 0) {
+		wd->skip--;
+		return (_URC_NO_REASON);
+	}
+	wd->frames[wd->nframes++] = ip;
+	if (wd->nframes == WATCHDOG_FRAMES)
+		return (_URC_END_OF_STACK);
+	return (_URC_NO_REASON);
+}
+#endif
+
+static void
+watchdog_sighandler(int sig, siginfo_t *info, void *ctx)
+{
+	struct event_watchdog *wd = watchdog_capturing;
+	int save_errno = errno;
+
+	if (wd == NULL || wd->captured ||
+	    !pthread_equal(wd->target, pthread_self())) {
+		/* not ours, hand it to whoever had the signal before */
+		if (watchdog_old_action.sa_flags & SA_SIGINFO)
+			watchdog_old_action.sa_sigaction(sig, info, ctx);
+		else if (watchdog_old_action.sa_handler != SIG_DFL &&
+		    watchdog_old_action.sa_handler != SIG_IGN)
+			watchdog_old_action.sa_handler(sig);
+		errno = save_errno;
+		return;
+	}
+
+#ifdef HAVE_UNWIND_H
+	/* this handler and the signal trampoline */
+	wd->skip = 2;
+	wd->nframes = 0;
+	_Unwind_Backtrace(watchdog_unwind_cb, wd);
+#endif
+	__atomic_store_n(&wd->captured, 1, __ATOMIC_RELEASE);
+	errno = save_errno;
+}
+
+/* Has the loop thread fill in wd->frames, returns -1 if it did not */
+static int
+watchdog_capture(struct event_watchdog *wd, pthread_t target)
+{
+	int i, res = -1;
+
+	pthread_mutex_lock(&watchdog_global_lock);
+	wd->target = target;
+	wd->nframes = 0;
+	wd->captured = 0;
+	watchdog_capturing = wd;
+	if (pthread_kill(target, WATCHDOG_SIGNAL) == 0) {
+		for (i = 0; i < WATCHDOG_CAPTURE_MSEC; ++i) {
+			struct timespec ts = { 0, 1000000 };
+
+			if (__atomic_load_n(&wd->captured, __ATOMIC_ACQUIRE)) {
+				res = 0;
+				break;
+			}
+			nanosleep(&ts, NULL);
+		}
+	}
+	/* a late handler finds captured set and leaves the frames alone */
+	wd->captured = 1;
+	watchdog_capturing = NULL;
+	pthread_mutex_unlock(&watchdog_global_lock);
+	return (res);
+}
+
+static void
+watchdog_report(struct event_watchdog *wd, unsigned int seq,
+    ev_uint64_t elapsed)
+{
+	struct event_base *base = wd->base;
+	void (*callback)(int, short, void *);
+	char sym[256];
+	int fd, i;
+	short res;
+
+	callback = base->wd_callback;
+	fd = base->wd_fd;
+	res = base->wd_res;
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	if (__atomic_load_n(&base->wd_seq, __ATOMIC_RELAXED) != seq)
+		return;		/* it just finished */
+
+	base->wd_stalls++;
+
+	event_symbol((void *)callback, sym, sizeof(sym));
+	event_warnx("watchdog: callback %s on fd %d for%s%s%s%s "
+	    "has been running for %lu ms", sym, fd,
+	    res & EV_TIMEOUT ? " timeout" : "",
+	    res & EV_READ ? " read" : "",
+	    res & EV_WRITE ? " write" : "",
+	    res & EV_SIGNAL ? " signal" : "",
+	    (unsigned long)(elapsed / 1000000));
+
+	if (watchdog_capture(wd, base->th_owner_id) == -1 ||
+	    __atomic_load_n(&base->wd_seq, __ATOMIC_ACQUIRE) != seq) {
+		event_warnx("watchdog: no stack of the loop thread");
+		return;
+	}
+	for (i = 0; i < wd->nframes; ++i) {
+		event_symbol(wd->frames[i], sym, sizeof(sym));
+		event_warnx("watchdog:   #%d %p %s", i, wd->frames[i], sym);
+	}
+}
+
+static void *
+watchdog_thread(void *arg)
+{
+	struct event_watchdog *wd = arg;
+	struct event_base *base = wd->base;
+	unsigned int seq, last = 0, reported = 0;
+	ev_uint64_t now, since = 0;
+	struct timespec ts;
+
+	pthread_mutex_lock(&wd->lock);
+	while (!wd->stop) {
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		ts.tv_sec += wd->tick / 1000000000;
+		ts.tv_nsec += wd->tick % 1000000000;
+		if (ts.tv_nsec >= 1000000000) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000;
+		}
+		pthread_cond_timedwait(&wd->cond, &wd->lock, &ts);
+		if (wd->stop)
+			break;
+
+		seq = __atomic_load_n(&base->wd_seq, __ATOMIC_ACQUIRE);
+		now = event_monotonic_ns();
+		if (!(seq & 1) || seq != last) {
+			/* idle, or a callback we have not seen before */
+			last = seq;
+			since = now;
+			continue;
+		}
+		if (seq == reported || now - since < wd->threshold)
+			continue;
+
+		reported = seq;
+		pthread_mutex_unlock(&wd->lock);
+		watchdog_report(wd, seq, now - since);
+		pthread_mutex_lock(&wd->lock);
+	}
+	pthread_mutex_unlock(&wd->lock);
+	return (NULL);
+}
+
+static int
+watchdog_signal_install(void)
+{
+	struct sigaction sa;
+	int res = 0;
+
+	pthread_mutex_lock(&watchdog_global_lock);
+	if (watchdog_nthreads++ == 0) {
+		memset(&sa, 0, sizeof(sa));
+		sa.sa_sigaction = watchdog_sighandler;
+		sa.sa_flags = SA_SIGINFO | SA_RESTART;
+		sigemptyset(&sa.sa_mask);
+		if (sigaction(WATCHDOG_SIGNAL, &sa, &watchdog_old_action)
+		    == -1) {
+			event_warn("%s: sigaction", __func__);
+			watchdog_nthreads--;
+			res = -1;
+		}
+	}
+	pthread_mutex_unlock(&watchdog_global_lock);
+	return (res);
+}
+
+static void
+watchdog_signal_restore(void)
+{
+	pthread_mutex_lock(&watchdog_global_lock);
+	if (--watchdog_nthreads == 0 &&
+	    sigaction(WATCHDOG_SIGNAL, &watchdog_old_action, NULL) == -1)
+		event_warn("%s: sigaction", __func__);
+	pthread_mutex_unlock(&watchdog_global_lock);
+}
+
+void
+event_watchdog_free(struct event_watchdog *wd)
+{
+	pthread_mutex_lock(&wd->lock);
+	wd->stop = 1;
+	pthread_cond_signal(&wd->cond);
+	pthread_mutex_unlock(&wd->lock);
+	pthread_join(wd->thread, NULL);
+
+	wd->base->watchdog = NULL;
+	watchdog_signal_restore();
+	pthread_cond_destroy(&wd->cond);
+	pthread_mutex_destroy(&wd->lock);
+	mm_free(wd, EVENT_MEM_EVENT);
+}
+
+int
+event_base_set_watchdog(struct event_base *base,
+    const struct timeval *threshold)
+{
+	struct event_watchdog *wd = NULL;
+	pthread_condattr_t attr;
+	int res;
+
+	if (threshold != NULL && (threshold->tv_sec < 0 ||
+	    threshold->tv_usec < 0 || threshold->tv_usec >= 1000000 ||
+	    !evutil_timerisset(threshold)))
+		return (-1);
+
+	EVBASE_ACQUIRE_LOCK(base);
+	if (base->watchdog != NULL)
+		event_watchdog_free(base->watchdog);
+	if (threshold == NULL)
+		goto done;
+
+	if ((wd = mm_calloc(1, sizeof(struct event_watchdog),
+	    EVENT_MEM_EVENT)) == NULL) {
+		event_warn("%s: calloc", __func__);
+		goto error;
+	}
+	wd->base = base;
+	wd->threshold = (ev_uint64_t)threshold->tv_sec * 1000000000 +
+	    threshold->tv_usec * 1000;
+	wd->tick = wd->threshold / 4;
+	if (wd->tick < 1000000)
+		wd->tick = 1000000;
+
+	pthread_mutex_init(&wd->lock, NULL);
+	/* the timed waits of the watchdog thread must not jump */
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&wd->cond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	if (watchdog_signal_install() == -1)
+		goto error_sync;
+	if ((res = pthread_create(&wd->thread, NULL, watchdog_thread,
+		    wd)) != 0) {
+		event_warnx("%s: pthread_create: %s", __func__,
+		    strerror(res));
+		watchdog_signal_restore();
+		goto error_sync;
+	}
+	base->watchdog = wd;
+
+ done:
+	EVBASE_RELEASE_LOCK(base);
+	return (0);
+
+ error_sync:
+	pthread_cond_destroy(&wd->cond);
+	pthread_mutex_destroy(&wd->lock);
+ error:
+	mm_free(wd, EVENT_MEM_EVENT);
+	EVBASE_RELEASE_LOCK(base);
+	return (-1);
+}
+
+#else /* !HAVE_PTHREADS */
+
+void
+event_watchdog_free(struct event_watchdog *wd)
+{
+}
+
+int
+event_base_set_watchdog(struct event_base *base,
+    const struct timeval *threshold)
+{
+	if (threshold == NULL)
+		return (0);
+	event_warnx("%s: no thread support", __func__);
+	return (-1);
+}
+
+#endif /* HAVE_PTHREADS */